@@ -0,0 +1,216 @@
+#ifndef ASYNC_ROW_APPLIER_H
+#define ASYNC_ROW_APPLIER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+
+#include "row_range_applier.h"
+
+// applies the rows received in ROWS responses on a separate thread, so that the worker can carry on
+// decoding the next rows from the network while the database executes the statements for the previous
+// ones.  the queue between the two is limited in size, so if the database can't keep up we stop reading
+// from the network and the other end blocks in turn, giving the same flow control as applying in-context.
+//
+// the apply thread uses the worker's database connection, so the worker must call wait() before it
+// uses the connection itself.
+template <typename DatabaseClient>
+struct AsyncRowApplier {
+	static const size_t MAX_BYTES_TO_QUEUE = 16*1024*1024; // arbitrary, same as RowRangeApplier's MAX_BYTES_TO_BUFFER
+	static const size_t MAX_BYTES_PER_BATCH =   256*1024; // also arbitrary, just large enough to make the locking overhead negligible
+
+	struct RowBatch {
+		RowBatch(): starts_range(false), ends_range(false), insert_only(false), into_empty_table(false), bytes(0) {}
+
+		bool starts_range;
+		bool ends_range;
+
+		// these only need to be set on the batch that starts the range
+		bool insert_only;
+		bool into_empty_table; // only set with insert_only
+		ColumnValues prev_key;
+		ColumnValues last_key;
+		vector<ColumnValues> keys; // if not empty, the rows are the response to a ROWS_BY_KEYS command for these keys
+
+		vector<PackedRow> rows;
+		size_t bytes;
+	};
+
+	AsyncRowApplier(RowReplacer<DatabaseClient> &replacer, const Table &table):
+		replacer(replacer),
+		table(table),
+		bytes_queued(0),
+		busy(false),
+		stopping(false) {
+	}
+
+	~AsyncRowApplier() {
+		if (apply_thread.joinable()) {
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+			queue_changed.notify_all();
+			lock.unlock();
+			apply_thread.join();
+		}
+	}
+
+	template <typename InputStream>
+	void stream_from_input(Unpacker<InputStream> &input, const ColumnValues &prev_key, const ColumnValues &last_key, bool insert_only, bool into_empty_table, bool columnar) {
+		RowBatch batch;
+		batch.insert_only = insert_only;
+		batch.into_empty_table = into_empty_table;
+		batch.prev_key = prev_key;
+		batch.last_key = last_key;
+		stream_batches(input, move(batch), columnar);
+	}
+
+	template <typename InputStream>
+	void stream_from_input(Unpacker<InputStream> &input, vector<ColumnValues> &&keys) {
+		RowBatch batch;
+		batch.keys = move(keys);
+		stream_batches(input, move(batch), true /* ROWS_BY_KEYS responses are always columnar */);
+	}
+
+	template <typename InputStream>
+	void stream_batches(Unpacker<InputStream> &input, RowBatch &&batch, bool columnar) {
+		batch.starts_range = true;
+
+		RowStreamReader<InputStream> reader(input, columnar);
+		PackedRow row;
+
+		while (reader.next(row)) {
+			for (const PackedValue &value : row) {
+				batch.bytes += value.encoded_size();
+			}
+			batch.rows.push_back(move(row));
+
+			if (batch.bytes >= MAX_BYTES_PER_BATCH) {
+				push(move(batch));
+				batch = RowBatch();
+			}
+		}
+
+		batch.ends_range = true;
+		push(move(batch));
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!exception && (busy || !queue.empty())) {
+			queue_changed.wait(lock);
+		}
+		if (exception) rethrow_exception(exception);
+	}
+
+	void push(RowBatch &&batch) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (!apply_thread.joinable()) {
+			apply_thread = std::thread(&AsyncRowApplier<DatabaseClient>::apply_batches, this);
+		}
+
+		// always accept a batch if the queue is empty, so an oversize batch can't block forever
+		while (!exception && !queue.empty() && bytes_queued + batch.bytes > MAX_BYTES_TO_QUEUE) {
+			queue_changed.wait(lock);
+		}
+		if (exception) rethrow_exception(exception);
+
+		bytes_queued += batch.bytes;
+		queue.push_back(move(batch));
+		queue_changed.notify_all();
+	}
+
+	void apply_batches() {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true) {
+			while (!stopping && queue.empty()) {
+				queue_changed.wait(lock);
+			}
+			if (stopping) return;
+
+			RowBatch batch(move(queue.front()));
+			queue.pop_front();
+			busy = true;
+			lock.unlock(); // don't hold the mutex while doing IO
+
+			try {
+				apply_batch(batch);
+			} catch (...) {
+				// pass the error back to the worker thread next time it pushes or waits, and discard everything else queued
+				lock.lock();
+				exception = current_exception();
+				busy = false;
+				queue.clear();
+				bytes_queued = 0;
+				queue_changed.notify_all();
+				return;
+			}
+
+			lock.lock();
+			busy = false;
+			bytes_queued -= batch.bytes;
+			queue_changed.notify_all();
+		}
+	}
+
+	void apply_batch(RowBatch &batch) {
+		if (batch.starts_range) {
+			if (!batch.keys.empty()) {
+				keys_applier.reset(new RowKeysApplier<DatabaseClient>(replacer, table, batch.keys));
+			} else if (batch.insert_only) {
+				row_inserter.reset(new RowInserter<DatabaseClient>(replacer, table, batch.into_empty_table));
+			} else {
+				range_applier.reset(new RowRangeApplier<DatabaseClient>(replacer, table, batch.prev_key, batch.last_key));
+			}
+		}
+
+		if (keys_applier) {
+			for (const PackedRow &row : batch.rows) {
+				keys_applier->received_source_row(row);
+			}
+		} else if (row_inserter) {
+			for (const PackedRow &row : batch.rows) {
+				row_inserter->received_source_row(row);
+			}
+		} else {
+			for (PackedRow &row : batch.rows) {
+				range_applier->received_source_row(move(row)); // the batch is discarded after this
+			}
+		}
+
+		if (batch.ends_range) {
+			if (keys_applier) {
+				keys_applier->received_all_source_rows();
+				keys_applier.reset();
+			} else if (row_inserter) {
+				row_inserter.reset();
+			} else {
+				range_applier->received_all_source_rows();
+				range_applier.reset();
+			}
+		}
+	}
+
+	RowReplacer<DatabaseClient> &replacer;
+	const Table &table;
+
+	std::mutex mutex;
+	std::condition_variable queue_changed;
+	deque<RowBatch> queue;
+	size_t bytes_queued;
+	bool busy;
+	bool stopping;
+	exception_ptr exception;
+	std::thread apply_thread;
+
+	// only used by the apply thread
+	unique_ptr<RowRangeApplier<DatabaseClient>> range_applier;
+	unique_ptr<RowInserter<DatabaseClient>> row_inserter;
+	unique_ptr<RowKeysApplier<DatabaseClient>> keys_applier;
+};
+
+#endif
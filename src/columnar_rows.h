@@ -0,0 +1,306 @@
+#ifndef COLUMNAR_ROWS_H
+#define COLUMNAR_ROWS_H
+
+#include <map>
+#include <climits>
+#include "command.h"
+#include "message_pack/copy_packed.h"
+#include "row_serialization.h"
+
+// in protocol versions that support it, ROWS responses are sent as a series of columnar batches instead of
+// one array per row.  each batch is an array [row_count, column, column, ...], and each column is an array
+// whose first element gives the encoding used for the values of that column in this batch:
+//   plain:      [0, value, value, ...]
+//   delta:      [1, nulls, first_value, delta, delta, ...], only used for integer columns; nulls is a bitmap
+//               string with a bit set for each null value (least significant bit first), or empty if there are
+//               none, and only the non-null values are listed
+//   dictionary: [2, [value, value, ...], index, index, ...]
+// the encoder picks whichever of these is smallest for each column in each batch.  as before, the results are
+// terminated by an empty array.
+enum class ColumnEncoding {
+	plain = 0,
+	delta = 1,
+	dictionary = 2,
+};
+
+const size_t COLUMNAR_BATCH_MAX_ROWS  =      1024; // arbitrary, large enough to make dictionaries worthwhile
+const size_t COLUMNAR_BATCH_MAX_BYTES = 1024*1024; // also arbitrary, limits buffering for wide rows
+
+struct FixedPackBuffer {
+	FixedPackBuffer(): used(0) {}
+
+	inline void write(const uint8_t *src, size_t bytes) {
+		memcpy(buf + used, src, bytes);
+		used += bytes;
+	}
+
+	uint8_t buf[9]; // the largest integer encoding
+	size_t used;
+};
+
+inline size_t packed_integer_size(long long value) {
+	FixedPackBuffer buffer;
+	Packer<FixedPackBuffer> packer(buffer);
+	packer << value;
+	return buffer.used;
+}
+
+// returns true and sets \result if the value is an integer that we'd pack back into exactly the same bytes
+// from a long long, which is necessary for the decoded rows to compare equal to the rows at the other end.
+inline bool packed_integer_value(const PackedValue &value, long long &result) {
+	uint8_t leader = value.leader();
+	if (!value.encoded_size() || (leader > MSGPACK_POSITIVE_FIXNUM_MAX && leader < MSGPACK_NEGATIVE_FIXNUM_MIN && (leader < MSGPACK_UINT8 || leader > MSGPACK_INT64))) return false;
+
+	PackedValueReadStream stream(value);
+	Unpacker<PackedValueReadStream> unpacker(stream);
+	if (leader == MSGPACK_UINT64) {
+		unsigned long long unsigned_result = unpacker.next<unsigned long long>();
+		if (unsigned_result > LLONG_MAX) return false;
+		result = unsigned_result;
+	} else {
+		result = unpacker.next<long long>();
+	}
+
+	FixedPackBuffer buffer;
+	Packer<FixedPackBuffer> packer(buffer);
+	packer << result;
+	return (buffer.used == value.encoded_size() && memcmp(buffer.buf, value.data(), buffer.used) == 0);
+}
+
+struct PackedValuePointerLess {
+	inline bool operator()(const PackedValue *l, const PackedValue *r) const { return (*l < *r); }
+};
+
+template <typename OutputStream>
+void pack_columnar_column(Packer<OutputStream> &packer, const vector<PackedRow> &rows, size_t column) {
+	size_t plain_size = 0;
+	for (const PackedRow &row : rows) {
+		plain_size += row[column].encoded_size();
+	}
+
+	// see if the column is all integers (or nulls), and if so how much smaller the deltas would be
+	string nulls;
+	vector<long long> deltas;
+	bool deltas_possible = true;
+	size_t delta_size = 0;
+	long long prev_value = 0;
+	for (size_t row = 0; row < rows.size() && deltas_possible; row++) {
+		const PackedValue &value(rows[row][column]);
+		long long integer_value, delta;
+		if (value.is_nil()) {
+			if (nulls.empty()) nulls.resize((rows.size() + 7)/8);
+			nulls[row/8] |= (1 << (row % 8));
+		} else if (!packed_integer_value(value, integer_value)) {
+			deltas_possible = false;
+		} else if (deltas.empty()) {
+			deltas.push_back(integer_value);
+			delta_size += value.encoded_size();
+			prev_value = integer_value;
+		} else if (__builtin_sub_overflow(integer_value, prev_value, &delta)) {
+			deltas_possible = false;
+		} else {
+			deltas.push_back(delta);
+			delta_size += packed_integer_size(delta);
+			prev_value = integer_value;
+		}
+	}
+	delta_size += nulls.size() + 1;
+	deltas_possible = deltas_possible && !deltas.empty();
+
+	// and see how many distinct values there are; we give up as soon as it's clear it won't be worthwhile
+	map<const PackedValue *, size_t, PackedValuePointerLess> dictionary_indices;
+	vector<size_t> dictionary_values;
+	size_t dictionary_size = 0;
+	bool dictionary_possible = true;
+	for (size_t row = 0; row < rows.size() && dictionary_possible; row++) {
+		auto inserted = dictionary_indices.insert(make_pair(&rows[row][column], dictionary_indices.size()));
+		if (inserted.second) {
+			dictionary_values.push_back(row);
+			dictionary_size += rows[row][column].encoded_size();
+			dictionary_possible = (dictionary_indices.size() <= rows.size()/2);
+		}
+		dictionary_size += packed_integer_size(inserted.first->second);
+	}
+
+	if (deltas_possible && delta_size < plain_size && (!dictionary_possible || delta_size <= dictionary_size)) {
+		pack_array_length(packer, 2 + deltas.size());
+		packer << static_cast<int>(ColumnEncoding::delta);
+		packer << nulls;
+		for (long long delta : deltas) {
+			packer << delta;
+		}
+
+	} else if (dictionary_possible && dictionary_size < plain_size) {
+		pack_array_length(packer, 2 + rows.size());
+		packer << static_cast<int>(ColumnEncoding::dictionary);
+		pack_array_length(packer, dictionary_values.size());
+		for (size_t row : dictionary_values) {
+			packer << rows[row][column];
+		}
+		for (const PackedRow &row : rows) {
+			packer << dictionary_indices[&row[column]];
+		}
+
+	} else {
+		pack_array_length(packer, 1 + rows.size());
+		packer << static_cast<int>(ColumnEncoding::plain);
+		for (const PackedRow &row : rows) {
+			packer << row[column];
+		}
+	}
+}
+
+template <typename OutputStream>
+void pack_columnar_batch(Packer<OutputStream> &packer, const vector<PackedRow> &rows) {
+	size_t column_count = rows.front().size();
+	pack_array_length(packer, 1 + column_count);
+	packer << rows.size();
+	for (size_t column = 0; column < column_count; column++) {
+		pack_columnar_column(packer, rows, column);
+	}
+}
+
+template <typename InputStream>
+void unpack_columnar_column(Unpacker<InputStream> &input, vector<PackedRow> &rows, size_t column) {
+	size_t array_length = input.next_array_length();
+	if (array_length < 1) throw command_error("Empty column in columnar batch");
+	ColumnEncoding encoding = static_cast<ColumnEncoding>(input.template next<int>());
+
+	switch (encoding) {
+		case ColumnEncoding::plain:
+			if (array_length != 1 + rows.size()) throw command_error("Expected " + to_string(rows.size()) + " plain values in columnar batch, got " + to_string(array_length - 1));
+			for (PackedRow &row : rows) {
+				input >> row[column];
+			}
+			break;
+
+		case ColumnEncoding::delta: {
+			if (array_length < 2) throw command_error("Missing nulls in columnar batch");
+			string nulls(input.template next<string>());
+			if (!nulls.empty() && nulls.size() != (rows.size() + 7)/8) throw command_error("Wrong nulls bitmap size in columnar batch");
+			size_t values_remaining = array_length - 2;
+			bool first_value = true;
+			long long value = 0;
+			for (size_t row = 0; row < rows.size(); row++) {
+				rows[row][column].clear();
+				if (!nulls.empty() && (nulls[row/8] & (1 << (row % 8)))) {
+					rows[row][column] << nullptr;
+				} else {
+					if (!values_remaining--) throw command_error("Too few delta values in columnar batch");
+					long long delta = input.template next<long long>();
+					if (first_value) {
+						value = delta;
+						first_value = false;
+					} else if (__builtin_add_overflow(value, delta, &value)) {
+						throw command_error("Delta value overflow in columnar batch");
+					}
+					rows[row][column] << value;
+				}
+			}
+			if (values_remaining) throw command_error("Too many delta values in columnar batch");
+			break;
+		}
+
+		case ColumnEncoding::dictionary: {
+			if (array_length != 2 + rows.size()) throw command_error("Expected " + to_string(rows.size()) + " dictionary indices in columnar batch, got " + to_string(array_length - 2));
+			vector<PackedValue> dictionary(input.template next<vector<PackedValue>>());
+			for (PackedRow &row : rows) {
+				size_t index = input.template next<size_t>();
+				if (index >= dictionary.size()) throw command_error("Invalid dictionary index in columnar batch");
+				row[column] = dictionary[index];
+			}
+			break;
+		}
+
+		default:
+			throw command_error("Unknown column encoding " + to_string(static_cast<int>(encoding)));
+	}
+}
+
+template <typename InputStream>
+void unpack_columnar_batch(Unpacker<InputStream> &input, size_t array_length, vector<PackedRow> &rows) {
+	size_t row_count = input.template next<size_t>();
+	size_t column_count = array_length - 1;
+	rows.resize(row_count);
+	for (PackedRow &row : rows) {
+		row.resize(column_count);
+	}
+	for (size_t column = 0; column < column_count; column++) {
+		unpack_columnar_column(input, rows, column);
+	}
+}
+
+// packs rows into columnar batches as they are retrieved from the database; the caller must call flush()
+// after the last row.
+template <typename OutputStream>
+struct ColumnarRowPacker {
+	ColumnarRowPacker(Packer<OutputStream> &packer): packer(packer), batch_bytes(0) {}
+
+	template <typename DatabaseRow>
+	void operator()(const DatabaseRow &row) {
+		rows.resize(rows.size() + 1);
+		row.pack_row_into(rows.back());
+
+		for (const PackedValue &value : rows.back()) {
+			batch_bytes += value.encoded_size();
+		}
+		if (rows.size() >= COLUMNAR_BATCH_MAX_ROWS || batch_bytes >= COLUMNAR_BATCH_MAX_BYTES) {
+			flush();
+		}
+	}
+
+	void flush() {
+		if (!rows.empty()) {
+			pack_columnar_batch(packer, rows);
+			rows.clear();
+			batch_bytes = 0;
+		}
+	}
+
+	Packer<OutputStream> &packer;
+	vector<PackedRow> rows;
+	size_t batch_bytes;
+};
+
+template <typename OutputStream>
+struct ColumnarRowPackerAndLastKey: ColumnarRowPacker<OutputStream>, RowLastKey {
+	ColumnarRowPackerAndLastKey(Packer<OutputStream> &packer, const vector<size_t> &primary_key_columns): ColumnarRowPacker<OutputStream>(packer), RowLastKey(primary_key_columns) {
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		ColumnarRowPacker<OutputStream>::operator()(row);
+		RowLastKey::operator()(row);
+	}
+};
+
+// reads the rows in a ROWS response one at a time, whether they were sent one array per row or in columnar batches
+template <typename InputStream>
+struct RowStreamReader {
+	RowStreamReader(Unpacker<InputStream> &input, bool columnar): input(input), columnar(columnar), next_row(0) {}
+
+	// reads the next row into \row, returning false instead once the terminating empty array has been read
+	bool next(PackedRow &row) {
+		if (!columnar) {
+			input >> row;
+			return !row.empty();
+		}
+
+		while (next_row == batch.size()) {
+			size_t array_length = input.next_array_length();
+			if (!array_length) return false;
+			unpack_columnar_batch(input, array_length, batch);
+			next_row = 0;
+		}
+
+		row = move(batch[next_row++]);
+		return true;
+	}
+
+	Unpacker<InputStream> &input;
+	bool columnar;
+	vector<PackedRow> batch;
+	size_t next_row;
+};
+
+#endif
@@ -104,6 +104,13 @@ namespace Commands {
 	const verb_t HASH_ALGORITHM = 39;
 	const verb_t FILTERS = 40;
 	const verb_t TYPES = 41;
+	const verb_t COMPRESSION = 42;
+	const verb_t HASH_MULTI = 43;
+	const verb_t HASH_TREE = 44;
+	const verb_t ROW_HASHES = 45;
+	const verb_t ROWS_BY_KEYS = 46;
+	const verb_t HASH_IN_DATABASE = 47;
+	const verb_t TABLE_SIZES = 48;
 	const verb_t QUIT = 0;
 };
 
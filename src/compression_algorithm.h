@@ -0,0 +1,9 @@
+#ifndef COMPRESSION_ALGORITHM_H
+#define COMPRESSION_ALGORITHM_H
+
+enum class CompressionAlgorithm {
+	none = 0,
+	zstd = 1,
+};
+
+#endif
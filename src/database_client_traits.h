@@ -19,4 +19,10 @@ struct SetNullability {
 struct SupportsAddNonNullableColumns {
 };
 
+struct SupportsBulkLoad {
+};
+
+struct SupportsStatementParameters {
+};
+
 #endif
@@ -2,12 +2,24 @@
 #define DEFAULTS_H
 
 #include "hash_algorithm.h"
+#include "compression_algorithm.h"
 
 const HashAlgorithm DEFAULT_HASH_ALGORITHM = HashAlgorithm::md5; // can be overridden by command-line option
 
+const CompressionAlgorithm DEFAULT_COMPRESSION_ALGORITHM = CompressionAlgorithm::none; // can be overridden by command-line option
+const int DEFAULT_COMPRESSION_LEVEL = 3; // zstd's own default, which is a good tradeoff between ratio and speed on most links
+
 const size_t DEFAULT_MINIMUM_BLOCK_SIZE =      16*1024; // arbitrary, latency isn't as big a problem with pipelining, but this sets the point at which we stop re-hashing and send rows
 const size_t DEFAULT_MAXIMUM_BLOCK_SIZE = 64*1024*1024; // arbitrary, but needs to be small enough we don't waste unjustifiable amounts of CPU time if a block hash doesn't match
 
-const size_t DEFAULT_MAX_COMMANDS_TO_PIPELINE = 2;
+const size_t DEFAULT_MIN_COMMANDS_TO_PIPELINE = 2; // the depth we start at, and never go below, since even on a fast link this lets the other end work on the next command while we handle the last response
+const size_t DEFAULT_MAX_COMMANDS_TO_PIPELINE = 64; // arbitrary, the depth is adjusted to suit the link, but the other end has to buffer the commands
+const size_t DEFAULT_MAX_COMMAND_BYTES_TO_PIPELINE = 32*1024; // must be comfortably less than the pipe buffer size, see PipelineDepthController::can_send
+const size_t DEFAULT_MAX_RANGES_TO_HASH_AT_ONCE = 16; // arbitrary, limits how much work one worker takes from the ranges_to_check queue for a single HASH_MULTI command
+
+const size_t DEFAULT_MAX_KEYS_TO_RETRIEVE_AT_ONCE = 1000; // arbitrary, limits the size of the queries run for a ROWS_BY_KEYS command
+const size_t DEFAULT_MAX_KEY_BYTES_TO_RETRIEVE_AT_ONCE = DEFAULT_MAX_COMMAND_BYTES_TO_PIPELINE/DEFAULT_MIN_COMMANDS_TO_PIPELINE/2; // PipelineDepthController::can_send lets the first few commands through whatever their size, so each ROWS_BY_KEYS command must be small enough that those still fit comfortably in the pipe buffer
+
+const size_t DEFAULT_HASH_TREE_FANOUT = 16; // arbitrary, each mismatched hash tree leaf is rehashed as this many smaller leaves on the next level down
 
 #endif
@@ -22,12 +22,22 @@ int endpoint_main(int argc, char *argv[]) {
 		return 0;
 	}
 
-	if (argc < 2 || (argv[1] != string("from") && argv[1] != string("to"))) {
-		cerr << "This program is a part of Kitchen Sync.  Instead of running this program directly, run 'ks'.\n";
+	string mode(argc > 1 ? argv[1] : "");
+	bool multiplexed = (mode == "from-multiplexed");
+	bool listen = (mode == "listen");
+	bool connect = (mode == "connect");
+	bool from = (mode == "from" || multiplexed || listen || connect);
+
+	if (!from && mode != "to") {
+		cerr << "This program is a part of Kitchen Sync.  Instead of running this program directly, run 'ks'.\n"
+				"(To accept or make plain TCP connections for the 'from' end of a sync, run '" << argv[0] << " listen [host:]port' or\n"
+				"'" << argv[0] << " connect host:port workers', followed by the database host, port, name, username, password,\n"
+				"and variables to set, or set the ENDPOINT_DATABASE_* environment variables; see USAGE.md.)\n";
 		return 1;
 	}
 
-	bool from = (argv[1] == string("from"));
+	// the listen and connect modes take a network address (and connect also a number of workers) before the usual 'from' arguments
+	int first_database_arg = (listen ? 3 : connect ? 4 : 2);
 
 	try {
 		// // the first set of arguments are the same for both endpoints
@@ -39,16 +49,19 @@ int endpoint_main(int argc, char *argv[]) {
 		string set_variables(getenv_default("ENDPOINT_SET_VARIABLES", ""));
 
 		if (from) {
+			// currently only set using environment variables, since it's a property of the system the 'from' end runs on
+			string hash_cache_directory(getenv_default("ENDPOINT_HASH_CACHE", ""));
+
 			// for backwards compatibility, we currently send and support positional arguments to the 'from'
 			// endpoint (which may be on another system if the --via option is used), but we also accept
 			// environment variables (which we intend to use in the future).
-			if (argc > 7) {
-				database_host = argv[2];
-				database_port = argv[3];
-				database_name = argv[4];
-				database_username = argv[5];
-				database_password = argv[6];
-				set_variables = argv[7];
+			if (argc > first_database_arg + 5) {
+				database_host = argv[first_database_arg];
+				database_port = argv[first_database_arg + 1];
+				database_name = argv[first_database_arg + 2];
+				database_username = argv[first_database_arg + 3];
+				database_password = argv[first_database_arg + 4];
+				set_variables = argv[first_database_arg + 5];
 
 				// unfortunately when we transport program arguments over SSH it flattens them into a string and so empty arguments get lost; we work around by using "-"
 				if (database_port     == string("-")) database_port     = "";
@@ -62,7 +75,21 @@ int endpoint_main(int argc, char *argv[]) {
 			char *end_of_last_arg = last_arg + strlen(last_arg);
 			size_t status_size = end_of_last_arg - status_area;
 
-			sync_from<DatabaseClient>(database_host, database_port, database_name, database_username, database_password, set_variables, STDIN_FILENO, STDOUT_FILENO, status_area, status_size);
+			if (listen || connect) {
+				if (argc < first_database_arg) throw runtime_error("Expected the address" + string(connect ? " and number of workers" : ""));
+				if (listen) {
+					sync_from_listening<DatabaseClient>(argv[2], database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, status_area, status_size);
+				} else {
+					sync_from_connecting<DatabaseClient>(argv[2], atoi(argv[3]), database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, status_area, status_size);
+				}
+			} else if (multiplexed) {
+				// when all the workers are run over one SSH session, the number of workers is given as an extra argument
+				int workers = (argc > 8 ? atoi(argv[8]) : 0);
+				if (workers < 1) throw runtime_error("Expected the number of workers to multiplex");
+				sync_from_multiplexed<DatabaseClient>(workers, database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, status_area, status_size);
+			} else {
+				sync_from<DatabaseClient>(database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, STDIN_FILENO, STDOUT_FILENO, status_area, status_size);
+			}
 		} else {
 			// the 'to' endpoint has already been converted to pass options using environment variables -
 			// since it's always on the same system as the ks command, it doesn't need legacy support.
@@ -78,11 +105,17 @@ int endpoint_main(int argc, char *argv[]) {
 			bool alter = getenv_default("ENDPOINT_ALTER", true);
 			CommitLevel commit_level = CommitLevel(getenv_default("ENDPOINT_COMMIT_LEVEL", CommitLevel::success));
 			HashAlgorithm hash_algorithm = static_cast<HashAlgorithm>(getenv_default("ENDPOINT_HASH_ALGORITHM", static_cast<int>(DEFAULT_HASH_ALGORITHM)));
+			CompressionAlgorithm compression_algorithm = static_cast<CompressionAlgorithm>(getenv_default("ENDPOINT_COMPRESSION_ALGORITHM", static_cast<int>(DEFAULT_COMPRESSION_ALGORITHM)));
+			int compression_level = getenv_default("ENDPOINT_COMPRESSION_LEVEL", DEFAULT_COMPRESSION_LEVEL);
+			bool hash_tree = getenv_default("ENDPOINT_HASH_TREE", false);
+			bool hash_in_database = getenv_default("ENDPOINT_HASH_IN_DATABASE", false);
 			size_t target_minimum_block_size = getenv_default("ENDPOINT_TARGET_MINIMUM_BLOCK_SIZE", DEFAULT_MINIMUM_BLOCK_SIZE); // only set by tests
 			size_t target_maximum_block_size = getenv_default("ENDPOINT_TARGET_MAXIMUM_BLOCK_SIZE", DEFAULT_MAXIMUM_BLOCK_SIZE); // not currently used except manual testing
+			size_t maximum_commands_to_pipeline = getenv_default("ENDPOINT_MAXIMUM_COMMANDS_TO_PIPELINE", DEFAULT_MAX_COMMANDS_TO_PIPELINE); // only set by tests
 			bool structure_only = getenv_default("ENDPOINT_STRUCTURE_ONLY", false);
+			string statistics_file(getenv_default("ENDPOINT_STATISTICS_FILE", ""));
 
-			sync_to<DatabaseClient>(workers, startfd, database_host, database_port, database_name, database_username, database_password, set_variables, filters_file, ignore, only, verbose, progress, snapshot, alter, commit_level, hash_algorithm, target_minimum_block_size, target_maximum_block_size, structure_only);
+			sync_to<DatabaseClient>(workers, startfd, statistics_file, database_host, database_port, database_name, database_username, database_password, set_variables, filters_file, ignore, only, verbose, progress, snapshot, alter, commit_level, hash_algorithm, compression_algorithm, compression_level, hash_tree, hash_in_database, target_minimum_block_size, target_maximum_block_size, maximum_commands_to_pipeline, structure_only);
 		}
 	} catch (const sync_error& e) {
 		// the worker thread has already output the error to cerr
@@ -13,9 +13,9 @@ struct stream_closed_error: public stream_error {
 };
 
 struct FDReadStream {
-	FDReadStream(int fd): fd(fd), buf_pos(0), buf_avail(0) {}
+	FDReadStream(int fd): total_bytes_read(0), fd(fd), buf_pos(0), buf_avail(0) {}
 
-	~FDReadStream() {
+	virtual ~FDReadStream() {
 		close();
 	}
 
@@ -52,34 +52,41 @@ protected:
 	// attempts to populate at least some bytes in buf, which is assumed to be completely empty.
 	// sets buf_pos to 0, and buf_avail to the number of bytes present in the buffer, even if an
 	// error occurs.
-	void populate_buf() {
+	virtual void populate_buf() {
+		buf_pos = buf_avail = 0; // in case read_fd throws
+		buf_avail = read_fd(buf, sizeof(buf));
+	}
+
+	// reads at least one and at most the given number of bytes straight from the descriptor.
+	size_t read_fd(uint8_t *dest, size_t bytes) {
 		ssize_t bytes_read;
-		buf_pos = 0;
 		while (true) {
-			bytes_read = ::read(fd, buf, sizeof(buf));
+			bytes_read = ::read(fd, dest, bytes);
 			if (bytes_read == 0) {
-				buf_avail = 0;
 				throw stream_closed_error();
 			}
 			if (bytes_read < 0) {
 				if (errno == EINTR) continue;
-				buf_avail = 0;
 				throw stream_error("Couldn't read from descriptor: " + string(strerror(errno)));
 			}
-			buf_avail = bytes_read;
-			break;
+			total_bytes_read += bytes_read;
+			return bytes_read;
 		}
 	}
 
+public:
+	size_t total_bytes_read; // total read from the descriptor, ie. after any compression; used to measure throughput
+
+protected:
 	int fd;
 	size_t buf_pos, buf_avail;
 	uint8_t buf[16384];
 };
 
 struct FDWriteStream {
-	FDWriteStream(int fd): fd(fd), buf_used(0) {}
+	FDWriteStream(int fd): total_bytes_written(0), fd(fd), buf_used(0) {}
 	
-	~FDWriteStream() {
+	virtual ~FDWriteStream() {
 		close();
 	}
 
@@ -93,11 +100,11 @@ struct FDWriteStream {
 	// writes the given number of bytes as-is to the data stream, possibly using a buffer; call flush() to force that to the underlying descriptor
 	inline void write(const uint8_t *src, size_t bytes) {
 		if (bytes > sizeof(buf)) { // this both protects against integer overflows and avoids unnecessary copying into our buffer for large objects
-			flush();
+			empty_buf();
 			write_buf(src, bytes);
 
 		} else if (buf_used + bytes > sizeof(buf)) {
-			flush();
+			empty_buf();
 			memcpy(buf, src, bytes);
 			buf_used = bytes;
 
@@ -108,13 +115,17 @@ struct FDWriteStream {
 	}
 
 	// forces any bytes currently in the buffer to the underlying descriptor
-	inline void flush() {
+	virtual void flush() {
+		empty_buf();
+	}
+
+protected:
+	inline void empty_buf() {
 		write_buf(buf, buf_used);
 		buf_used = 0;
 	}
 
-protected:
-	void write_buf(const uint8_t* ptr, size_t bytes) {
+	virtual void write_buf(const uint8_t* ptr, size_t bytes) {
 		ssize_t bytes_written;
 		while (bytes > 0) {
 			bytes_written = ::write(fd, ptr, bytes);
@@ -124,9 +135,14 @@ protected:
 			}
 			ptr   += bytes_written;
 			bytes -= bytes_written;
+			total_bytes_written += bytes_written;
 		}
 	}
 
+public:
+	size_t total_bytes_written; // total written to the descriptor, ie. after any compression
+
+protected:
 	int fd;
 	size_t buf_used;
 	uint8_t buf[16384];
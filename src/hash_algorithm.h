@@ -4,6 +4,15 @@
 enum class HashAlgorithm {
 	md5 = 0,
 	xxh64 = 1,
+	xxh3_128 = 2,
+	blake2b = 3,
+	xxh3_128_sum = 4,
 };
 
+// the commutative algorithms hash each row separately and add the results together, so the digest doesn't depend
+// on the order the rows are hashed in, and digests of parts of a range can be combined to give the digest of the range
+inline bool hash_algorithm_commutative(HashAlgorithm hash_algorithm) {
+	return (hash_algorithm == HashAlgorithm::xxh3_128_sum);
+}
+
 #endif
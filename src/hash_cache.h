@@ -0,0 +1,222 @@
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H
+
+#include <map>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "command.h"
+#include "schema.h"
+#include "row_serialization.h"
+#include "fdstream.h"
+
+// optionally, the 'from' end keeps the hashes it computes for HASH commands in a directory, so that repeated
+// syncs from a database that hasn't changed can answer them without reading the rows again.  each table's
+// hashes are only valid while the table's modification marker (given by the database client, for example
+// the WAL position or an update timestamp) is unchanged; tables with no marker aren't cached.
+//
+// there's one file per table and set of options that affect the hashes, holding a header array [version,
+// identity, marker] followed by an array [prev_key, last_key, rows_to_hash, row_count, hash] for each range.
+// when the marker changes, the file is rewritten; otherwise new ranges are appended.  the files are locked
+// while they're being read or written, so any number of workers (and runs) can share the directory.
+//
+// the markers must change whenever a change is committed, so the clients mustn't use statistics that the database
+// updates asynchronously.  they may change more often than that - the PostgreSQL marker changes whenever anything
+// in the cluster is written - so the cache is intended for source databases that change in batches, not ones that
+// are being written to continuously.  see HashCache::set_table_markers for when they're read.
+
+const int HASH_CACHE_FORMAT_VERSION = 1;
+
+typedef tuple<ColumnValues, ColumnValues, size_t> HashCacheKey; // prev_key, last_key, rows_to_hash
+
+struct HashCacheEntry {
+	size_t row_count;
+	string hash;
+};
+
+struct HashCacheFileStream {
+	HashCacheFileStream(): pos(0) {}
+
+	inline void read(uint8_t *dest, size_t bytes) {
+		if (data.size() - pos < bytes) throw runtime_error("Truncated hash cache file");
+		memcpy(dest, data.data() + pos, bytes);
+		pos += bytes;
+	}
+
+	inline void write(const uint8_t *src, size_t bytes) {
+		data.append((const char *)src, bytes);
+	}
+
+	string data;
+	size_t pos;
+};
+
+struct TableHashCache {
+	TableHashCache(const string &path, const string &identity, const string &marker): path(path), identity(identity), marker(marker) {
+		load();
+	}
+
+	bool lookup(const HashCacheKey &key, HashCacheEntry &entry) const {
+		auto it = entries.find(key);
+		if (it == entries.end()) return false;
+		entry = it->second;
+		return true;
+	}
+
+	void store(const HashCacheKey &key, const HashCacheEntry &entry) {
+		if (entries.insert(make_pair(key, entry)).second) {
+			new_entries.push_back(key);
+		}
+	}
+
+	void load() {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			if (errno == ENOENT) return;
+			throw runtime_error("Couldn't open hash cache file " + path + ": " + strerror(errno));
+		}
+
+		HashCacheFileStream stream;
+		read_locked(fd, LOCK_SH, stream);
+		::close(fd);
+
+		read_entries(stream, entries);
+	}
+
+	void save() {
+		if (new_entries.empty()) return;
+
+		int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd < 0) throw runtime_error("Couldn't create hash cache file " + path + ": " + strerror(errno));
+		FDWriteStream output_stream(fd); // closes the descriptor, and so releases the lock, when destroyed
+
+		// another worker may have written the file since we loaded it, so check it again now that we have it locked
+		HashCacheFileStream stream;
+		read_locked(fd, LOCK_EX, stream);
+		map<HashCacheKey, HashCacheEntry> current_entries;
+		bool can_append = read_entries(stream, current_entries);
+
+		HashCacheFileStream output;
+		Packer<HashCacheFileStream> packer(output);
+		if (!can_append) {
+			// the file is for an older marker (or is empty, or was left incomplete), so start it again
+			if (ftruncate(fd, 0) < 0) throw runtime_error("Couldn't truncate hash cache file " + path + ": " + strerror(errno));
+			send_array(packer, HASH_CACHE_FORMAT_VERSION, identity, marker);
+		}
+		for (const HashCacheKey &key : new_entries) {
+			if (can_append && current_entries.count(key)) continue;
+			const HashCacheEntry &entry(entries[key]);
+			send_array(packer, get<0>(key), get<1>(key), get<2>(key), entry.row_count, entry.hash);
+		}
+
+		if (lseek(fd, 0, SEEK_END) < 0) throw runtime_error("Couldn't seek in hash cache file " + path + ": " + strerror(errno));
+		output_stream.write((const uint8_t *)output.data.data(), output.data.size());
+		output_stream.flush();
+		new_entries.clear();
+	}
+
+	void read_locked(int fd, int operation, HashCacheFileStream &stream) {
+		while (flock(fd, operation) < 0) {
+			if (errno != EINTR) throw runtime_error("Couldn't lock hash cache file " + path + ": " + strerror(errno));
+		}
+
+		char buf[16384];
+		ssize_t bytes_read;
+		while ((bytes_read = ::read(fd, buf, sizeof(buf))) != 0) {
+			if (bytes_read < 0) {
+				if (errno == EINTR) continue;
+				throw runtime_error("Couldn't read hash cache file " + path + ": " + strerror(errno));
+			}
+			stream.data.append(buf, bytes_read);
+		}
+	}
+
+	// reads the entries from the file if it's for the same identity and marker, returning true if it was complete
+	bool read_entries(HashCacheFileStream &stream, map<HashCacheKey, HashCacheEntry> &result) {
+		Unpacker<HashCacheFileStream> unpacker(stream);
+		try {
+			int file_version;
+			string file_identity, file_marker;
+			read_array(unpacker, file_version, file_identity, file_marker);
+			if (file_version != HASH_CACHE_FORMAT_VERSION || file_identity != identity || file_marker != marker) return false;
+
+			while (stream.pos < stream.data.size()) {
+				ColumnValues prev_key, last_key;
+				size_t rows_to_hash;
+				HashCacheEntry entry;
+				read_array(unpacker, prev_key, last_key, rows_to_hash, entry.row_count, entry.hash);
+				result.insert(make_pair(HashCacheKey(move(prev_key), move(last_key), rows_to_hash), move(entry)));
+			}
+			return true;
+		} catch (const exception &e) {
+			// keep any complete entries; the file will be rewritten next time it's saved
+			return false;
+		}
+	}
+
+	string path;
+	string identity;
+	string marker;
+	map<HashCacheKey, HashCacheEntry> entries;
+	vector<HashCacheKey> new_entries;
+};
+
+struct HashCache {
+	HashCache(const string &directory): directory(directory) {}
+
+	inline bool enabled() const { return !directory.empty(); }
+
+	// the markers must be read both before the worker's read transaction starts (or imports another worker's
+	// snapshot), and again once it has; only the tables whose markers were the same both times are cached.  any change
+	// committed before the first read is counted in the marker; any change committed between the two reads may be in
+	// our snapshot, but will have changed the marker, so we don't use the cache for that table; and any change
+	// committed later isn't in our snapshot, and either isn't counted in the marker at all or will have changed the
+	// marker by the time we save (in which case we don't).  note that the snapshot a worker imports may have been
+	// taken well before its first read, so that read can't be left out.
+	void set_table_markers(map<string, string> &&markers) {
+		table_markers = move(markers);
+	}
+
+	void check_table_markers(const map<string, string> &current_markers) {
+		for (auto &it : table_markers) {
+			auto current_marker = current_markers.find(it.first);
+			if (current_marker == current_markers.end() || current_marker->second != it.second) {
+				it.second.clear(); // as for tables that have no marker
+			}
+		}
+	}
+
+	// returns the cache for the given table, or nullptr if it can't be cached; the identity must cover everything
+	// other than the table contents that affects the hashes, such as the database, hash algorithm, and filters.
+	TableHashCache *for_table(const Table &table, const string &identity) {
+		if (!enabled()) return nullptr;
+
+		auto it = tables.find(table.name);
+		if (it == tables.end()) {
+			auto marker = table_markers.find(table.name);
+			if (marker == table_markers.end() || marker->second.empty()) return nullptr;
+
+			char filename[32];
+			snprintf(filename, sizeof(filename), "%016llx.hashes", (unsigned long long)XXH64(identity.data(), identity.size(), 0));
+			it = tables.emplace(piecewise_construct, forward_as_tuple(table.name), forward_as_tuple(directory + "/" + filename, identity, marker->second)).first;
+		}
+		return &it->second;
+	}
+
+	// writes out the new hashes for the tables whose markers haven't changed since they were read
+	void save(const map<string, string> &current_markers) {
+		for (auto &it : tables) {
+			auto current_marker = current_markers.find(it.first);
+			if (current_marker != current_markers.end() && current_marker->second == it.second.marker) {
+				it.second.save();
+			}
+		}
+	}
+
+	string directory;
+	map<string, string> table_markers;
+	map<string, TableHashCache> tables;
+};
+
+#endif
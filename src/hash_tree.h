@@ -0,0 +1,96 @@
+#ifndef HASH_TREE_H
+#define HASH_TREE_H
+
+#include <memory>
+#include "command.h"
+#include "schema.h"
+#include "row_serialization.h"
+
+// one leaf of a hash tree level, as sent by the 'from' end in response to a HASH_TREE command; the leaf covers
+// the rows after the previous leaf's last key (or the start of the requested range) up to and including last_key.
+struct HashTreeLeaf {
+	ColumnValues last_key;
+	size_t row_count;
+	string hash;
+};
+
+// hashes the rows it is given in leaves of at least bytes_per_leaf bytes, sending each leaf to the other
+// end as soon as it's complete so we don't need to buffer up the level.
+template <typename OutputStream>
+struct HashTreeLeafPacker {
+	HashTreeLeafPacker(Packer<OutputStream> &packer, HashAlgorithm hash_algorithm, const vector<size_t> &primary_key_columns, size_t bytes_per_leaf):
+		packer(packer), hash_algorithm(hash_algorithm), row_last_key(primary_key_columns), bytes_per_leaf(bytes_per_leaf), leaves_sent(0) {
+		start_leaf();
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		(*hasher)(row);
+		row_last_key(row);
+		row_count++;
+
+		if (hasher->size >= bytes_per_leaf) {
+			finish_leaf(row_last_key.last_key);
+		}
+	}
+
+	void finish(const ColumnValues &last_key) {
+		// the last leaf always extends to the end of the requested range, even if we have no more rows, since
+		// the other end may have rows in that part of the range that it needs to know we don't have
+		if (leaves_sent == 0 || last_key_sent != last_key) {
+			finish_leaf(last_key);
+		}
+	}
+
+	inline void start_leaf() {
+		hasher.reset(new RowHasher(hash_algorithm));
+		row_count = 0;
+	}
+
+	inline void finish_leaf(const ColumnValues &last_key) {
+		send_array(packer, last_key, row_count, hasher->finish());
+		last_key_sent = last_key;
+		leaves_sent++;
+		start_leaf();
+	}
+
+	Packer<OutputStream> &packer;
+	HashAlgorithm hash_algorithm;
+	RowLastKey row_last_key;
+	size_t bytes_per_leaf;
+	unique_ptr<RowHasher> hasher;
+	size_t row_count;
+	ColumnValues last_key_sent;
+	size_t leaves_sent;
+};
+
+// hashes the rows of a range into the leaves given by the other end's HASH_TREE response, in one pass over the range.
+// each row must have the number of the leaf it falls in as an extra last column; see retrieve_rows_in_leaves_sql.
+struct HashTreeLeafHashers {
+	HashTreeLeafHashers(HashAlgorithm hash_algorithm, size_t leaves): row_counts(leaves) {
+		for (size_t leaf = 0; leaf < leaves; leaf++) {
+			hashers.emplace_back(new RowHasher(hash_algorithm));
+		}
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		size_t columns = row.n_columns() - 1;
+		size_t leaf = row.uint_at(columns);
+		if (leaf >= hashers.size()) throw logic_error("Row is in leaf " + to_string(leaf) + " but there are only " + to_string(hashers.size()) + " leaves");
+
+		// pack the row as pack_row_into would, but without the leaf number
+		RowHasher &hasher(*hashers[leaf]);
+		pack_array_length(hasher.row_packer, columns);
+		for (size_t column_number = 0; column_number < columns; column_number++) {
+			row.pack_column_into(hasher.row_packer, column_number);
+		}
+		hasher.finish_row();
+		row_counts[leaf]++;
+	}
+
+	vector<unique_ptr<RowHasher>> hashers;
+	vector<size_t> row_counts;
+};
+
+#endif
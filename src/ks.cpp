@@ -1,10 +1,13 @@
 #include <iostream>
 #include <vector>
+#include <memory>
 
 #include "options.h"
 #include "env.h"
 #include "process.h"
 #include "unidirectional_pipe.h"
+#include "multiplexer.h"
+#include "tcp_socket.h"
 #include "to_string.h"
 
 using namespace std;
@@ -50,6 +53,14 @@ bool greet_remote_server(Options &options, const string &ssh_binary, const strin
 	return true;
 }
 
+void dup_descriptor(int fd, int to_fd) {
+	int result;
+	do { result = dup2(fd, to_fd); } while (result < 0 && errno == EINTR);
+	if (result < 0) {
+		throw runtime_error("Couldn't reattach descriptor: " + string(strerror(errno)));
+	}
+}
+
 int main(int argc, char *argv[]) {
 	try
 	{
@@ -76,11 +87,20 @@ int main(int argc, char *argv[]) {
 		if (options.set_from_variables.empty()) options.set_from_variables = "-";
 		if (options.cipher.empty()) options.cipher = "aes256-ctr";
 
-		const char *from_args[] = { ssh_binary.c_str(), "-C", "-c", options.cipher.c_str(), options.via.c_str(),
-									from_binary.c_str(), "from", options.from.host.c_str(), options.from.port.c_str(), options.from.database.c_str(), options.from.username.c_str(), options.from.password.c_str(), options.set_from_variables.c_str(), nullptr };
+		// there's no point having SSH compress the stream if we're going to compress it ourselves
+		const char *ssh_compression_arg = (options.compression_algorithm == CompressionAlgorithm::none ? "-C" : "-oCompression=no");
+
+		// normally we run all the workers over one SSH session, so that adding workers doesn't add more SSH
+		// handshakes and processes; this requires that the other end has the same version of Kitchen Sync.
+		bool multiplexed = (!options.via.empty() && options.multiplex && options.workers > 1);
+		string workers_arg(to_string(options.workers));
+
+		const char *from_args[] = { ssh_binary.c_str(), ssh_compression_arg, "-c", options.cipher.c_str(), options.via.c_str(),
+									from_binary.c_str(), multiplexed ? "from-multiplexed" : "from", options.from.host.c_str(), options.from.port.c_str(), options.from.database.c_str(), options.from.username.c_str(), options.from.password.c_str(), options.set_from_variables.c_str(),
+									multiplexed ? workers_arg.c_str() : nullptr, nullptr };
 		const char **applicable_from_args = (options.via.empty() ? from_args + 5 : from_args);
 
-		if (options.verbose >= VERY_VERBOSE) {
+		if (options.verbose >= VERY_VERBOSE && options.connect.empty() && options.listen.empty()) {
 			cout << "from command:";
 			for (const char **p = applicable_from_args; *p; p++) cout << ' ' << (**p ? *p : "''");
 			cout << endl;
@@ -92,13 +112,61 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+		// the 'from' end takes this from the environment, which it inherits from us when run locally
+		if (!options.hash_cache.empty()) {
+			setenv("ENDPOINT_HASH_CACHE", options.hash_cache);
+		}
+
 		vector<pid_t> child_pids;
-		for (int worker = 0; worker < options.workers; ++worker) {
-			UnidirectionalPipe stdin_pipe;
-			UnidirectionalPipe stdout_pipe;
-			child_pids.push_back(Process::fork_and_exec(*applicable_from_args, applicable_from_args, stdin_pipe, stdout_pipe));
-			stdout_pipe.dup_read_to(to_descriptor_list_start + worker);
-			stdin_pipe.dup_write_to(to_descriptor_list_start + worker + options.workers);
+		unique_ptr<Multiplexer> multiplexer;
+
+		if (!options.connect.empty() || !options.listen.empty()) {
+			// the 'from' end has been started separately, and we talk to it over plain TCP connections -
+			// the 'to' end just reads from and writes to the sockets like it would the pipes
+			int listener = -1;
+			if (!options.listen.empty()) {
+				listener = TCPSocket::listen(options.listen);
+				if (options.verbose) cout << "waiting for " << options.workers << " connection(s) on " << options.listen << endl;
+			}
+
+			for (int worker = 0; worker < options.workers; ++worker) {
+				int fd = (listener < 0 ? TCPSocket::connect(options.connect) : TCPSocket::accept(listener));
+				dup_descriptor(fd, to_descriptor_list_start + worker);
+				dup_descriptor(fd, to_descriptor_list_start + worker + options.workers);
+				::close(fd);
+			}
+
+			if (listener >= 0) ::close(listener);
+		} else if (multiplexed) {
+			// the descriptors we keep for ourselves must stay out of the way of the ones we hand to the 'to' end
+			int min_fd = to_descriptor_list_start + 2*options.workers;
+			int transport_read_fd, transport_write_fd;
+			{
+				UnidirectionalPipe stdin_pipe;
+				UnidirectionalPipe stdout_pipe;
+				child_pids.push_back(Process::fork_and_exec(*applicable_from_args, applicable_from_args, stdin_pipe, stdout_pipe));
+				transport_read_fd = stdout_pipe.detach_read(min_fd);
+				transport_write_fd = stdin_pipe.detach_write(min_fd);
+			}
+
+			vector<MultiplexedChannel> channels;
+			for (int worker = 0; worker < options.workers; ++worker) {
+				UnidirectionalPipe stdin_pipe;
+				UnidirectionalPipe stdout_pipe;
+				stdin_pipe.dup_read_to(to_descriptor_list_start + worker);
+				stdout_pipe.dup_write_to(to_descriptor_list_start + worker + options.workers);
+				channels.push_back(MultiplexedChannel(stdout_pipe.detach_read(min_fd), stdin_pipe.detach_write(min_fd)));
+			}
+
+			multiplexer.reset(new Multiplexer(transport_read_fd, transport_write_fd, channels));
+		} else {
+			for (int worker = 0; worker < options.workers; ++worker) {
+				UnidirectionalPipe stdin_pipe;
+				UnidirectionalPipe stdout_pipe;
+				child_pids.push_back(Process::fork_and_exec(*applicable_from_args, applicable_from_args, stdin_pipe, stdout_pipe));
+				stdout_pipe.dup_read_to(to_descriptor_list_start + worker);
+				stdin_pipe.dup_write_to(to_descriptor_list_start + worker + options.workers);
+			}
 		}
 
 		// we pass all options to the 'to' end in the environment
@@ -120,7 +188,12 @@ int main(int argc, char *argv[]) {
 		setenv("ENDPOINT_ALTER", options.alter ? "1" : "0", 1);
 		setenv("ENDPOINT_COMMIT_LEVEL", to_string(options.commit_level));
 		setenv("ENDPOINT_HASH_ALGORITHM", to_string(static_cast<int>(options.hash_algorithm)));
+		setenv("ENDPOINT_COMPRESSION_ALGORITHM", to_string(static_cast<int>(options.compression_algorithm)));
+		setenv("ENDPOINT_COMPRESSION_LEVEL", to_string(options.compression_level));
+		setenv("ENDPOINT_HASH_TREE", options.hash_tree ? "1" : "0", 1);
+		setenv("ENDPOINT_HASH_IN_DATABASE", options.hash_in_database ? "1" : "0", 1);
 		setenv("ENDPOINT_STRUCTURE_ONLY", to_string(options.structure_only));
+		setenv("ENDPOINT_STATISTICS_FILE", options.statistics_file);
 
 		const char *to_args[] = { to_binary.c_str(), "to", nullptr };
 		child_pids.push_back(Process::fork_and_exec(to_binary, to_args));
@@ -134,6 +207,7 @@ int main(int argc, char *argv[]) {
 		for (pid_t pid : child_pids) {
 			success &= Process::wait_for_and_check(pid);
 		}
+		if (multiplexer) multiplexer->wait();
 
 		if (success) {
 			cout << "Finished Kitchen Syncing." << endl;
@@ -234,6 +234,9 @@ public:
 	string export_snapshot();
 	void import_snapshot(const string &snapshot);
 	void unhold_snapshot();
+	map<string, string> table_modification_markers();
+	map<string, size_t> table_size_estimates();
+	vector<string> histogram_bounds(const Table &table, const Column &column);
 	bool supports_explicit_read_only_transactions();
 	void start_read_transaction();
 	void start_write_transaction();
@@ -254,7 +257,10 @@ public:
 	string column_default(const Table &table, const Column &column);
 	string column_definition(const Table &table, const Column &column);
 	string key_definition(const Table &table, const Key &key);
+	string row_text_sql(const Table &table, const string &alias);
+	string aggregate_hash_sql(const Table &table, const string &row_text);
 
+	inline string aggregate_hash_dialect() const { return "mysql"; }
 	inline bool information_schema_column_default_shows_escaped_expressions() const { return (server_is_mariadb && server_version >= MARIADB_10_2_7); }
 	inline bool information_schema_brackets_generated_column_expressions() const { return server_is_mariadb; }
 	inline bool supports_srid_settings_on_columns() const { return srid_column_exists; }
@@ -455,6 +461,55 @@ void MySQLClient::unhold_snapshot() {
 	execute("UNLOCK TABLES");
 }
 
+map<string, string> MySQLClient::table_modification_markers() {
+	// mysql 8 caches the table statistics for a day by default, which would make them useless for this
+	if (!server_is_mariadb && server_version >= MYSQL_8_0_0) {
+		execute("SET SESSION information_schema_stats_expiry = 0");
+	}
+
+	// UPDATE_TIME is only given to the second, so if the table was updated in the last second it might be updated again
+	// without the marker changing; we don't give a marker in that case.  it's also NULL for tables that haven't been
+	// updated since the server was started, and CREATE_TIME changes if the table is truncated or rebuilt.
+	TableModificationMarkerCollector collector;
+	query(
+		"SELECT TABLE_NAME, CASE WHEN UPDATE_TIME < NOW() - INTERVAL 1 SECOND THEN CONCAT(CREATE_TIME, ' ', UPDATE_TIME) END "
+		  "FROM INFORMATION_SCHEMA.TABLES "
+		 "WHERE TABLE_SCHEMA = SCHEMA() AND TABLE_TYPE = 'BASE TABLE'",
+		collector);
+	return collector.markers;
+}
+
+map<string, size_t> MySQLClient::table_size_estimates() {
+	// these are only estimates for InnoDB tables, and may be cached for a while, but that's all we need
+	TableSizeCollector collector;
+	query(
+		"SELECT TABLE_NAME, DATA_LENGTH "
+		  "FROM INFORMATION_SCHEMA.TABLES "
+		 "WHERE TABLE_SCHEMA = SCHEMA() AND TABLE_TYPE = 'BASE TABLE'",
+		collector);
+	return collector.sizes;
+}
+
+vector<string> MySQLClient::histogram_bounds(const Table &table, const Column &column) {
+	// mysql 8 only has histograms if they've been created using ANALYZE TABLE ... UPDATE HISTOGRAM, and mariadb's are
+	// in a different form altogether.  we use the upper bound of each bucket of equi-height histograms, which hold
+	// roughly equal numbers of rows; string values are encoded in the histograms, so we only use integer columns.
+	if (server_is_mariadb || server_version < MYSQL_8_0_0) return vector<string>();
+	if (column.column_type < ColumnType::integer_min || column.column_type > ColumnType::integer_max) return vector<string>();
+
+	HistogramBoundsCollector collector;
+	query(
+		"SELECT buckets.upper_bound "
+		  "FROM INFORMATION_SCHEMA.COLUMN_STATISTICS, "
+		       "JSON_TABLE(HISTOGRAM, '$.buckets[*]' COLUMNS (upper_bound VARCHAR(32) PATH '$[1]')) AS buckets "
+		 "WHERE SCHEMA_NAME = SCHEMA() AND "
+		       "TABLE_NAME = '" + escape_string_value(table.name) + "' AND "
+		       "COLUMN_NAME = '" + escape_string_value(column.name) + "' AND "
+		       "HISTOGRAM->>'$.\"histogram-type\"' = 'equi-height'",
+		collector);
+	return collector.bounds;
+}
+
 void MySQLClient::disable_referential_integrity() {
 	execute("SET foreign_key_checks = 0");
 	execute("SET unique_checks = 0");
@@ -782,6 +837,31 @@ string MySQLClient::key_definition(const Table &table, const Key &key) {
 	return result;
 }
 
+string MySQLClient::row_text_sql(const Table &table, const string &alias) {
+	// QUOTE gives NULL values as the bare word NULL, so they can't be confused with the string 'NULL'
+	string result("CONCAT_WS(',', ");
+	bool first = true;
+	for (const Column &column : table.columns) {
+		if (column.generated_always()) continue; // not selected by retrieve_rows_sql
+		if (!first) result += ", ";
+		first = false;
+		result += "QUOTE(" + alias + "." + quote_identifier(column.name) + ")";
+	}
+	result += ")";
+	return result;
+}
+
+string MySQLClient::aggregate_hash_sql(const Table &table, const string &row_text) {
+	// there's no ordered string aggregate function that doesn't truncate to group_concat_max_len, so instead we
+	// XOR together the MD5 hashes of the rows, in two 64-bit halves since BIT_XOR only works on BIGINTs.  since
+	// each row includes its primary key, the result doesn't need to depend on the order of the rows.
+	string md5("MD5(" + row_text + ")");
+	return
+		"LOWER(CONCAT("
+			"LPAD(HEX(BIT_XOR(CAST(CONV(SUBSTRING(" + md5 + ", 1, 16), 16, 10) AS UNSIGNED))), 16, '0'), "
+			"LPAD(HEX(BIT_XOR(CAST(CONV(SUBSTRING(" + md5 + ", 17, 16), 16, 10) AS UNSIGNED))), 16, '0')))";
+}
+
 inline ColumnTypeList MySQLClient::supported_types() {
 	ColumnTypeList result{
 		ColumnType::binary,
@@ -173,7 +173,7 @@ private:
 };
 
 
-class PostgreSQLClient: public GlobalKeys, public SequenceColumns, public DropKeysWhenColumnsDropped, public SetNullability {
+class PostgreSQLClient: public GlobalKeys, public SequenceColumns, public DropKeysWhenColumnsDropped, public SetNullability, public SupportsBulkLoad, public SupportsStatementParameters {
 public:
 	typedef PostgreSQLRow RowType;
 
@@ -191,6 +191,9 @@ public:
 	string export_snapshot();
 	void import_snapshot(const string &snapshot);
 	void unhold_snapshot();
+	map<string, string> table_modification_markers();
+	map<string, size_t> table_size_estimates();
+	vector<string> histogram_bounds(const Table &table, const Column &column);
 	void start_read_transaction();
 	void start_write_transaction();
 	void commit_transaction();
@@ -206,18 +209,26 @@ public:
 	string &append_quoted_bytea_value_to(string &result, const string &value);
 	string &append_quoted_spatial_value_to(string &result, const string &value);
 	string &append_quoted_column_value_to(string &result, const Column &column, const string &value);
+	string &append_bulk_load_row_to(string &result, const Columns &columns, const PackedRow &row);
+	void bulk_load(const Table &table, const string &data);
+	void append_statement_parameters_to(StatementParameters &parameters, const Columns &columns, const PackedRow &row);
+	string &append_parameter_placeholder_to(string &result, const Column &column, size_t parameter_number);
 	string column_type(const Column &column);
 	string column_sequence_name(const Table &table, const Column &column);
 	string column_default(const Table &table, const Column &column);
 	string column_definition(const Table &table, const Column &column);
 	string key_definition(const Table &table, const Key &key);
+	string row_text_sql(const Table &table, const string &alias);
+	string aggregate_hash_sql(const Table &table, const string &row_text);
 
 	inline string quote_identifier(const string &name) { return ::quote_identifier(name, '"'); };
+	inline string aggregate_hash_dialect() const { return "postgresql"; }
 	inline bool supports_jsonb_column_type() const { return (server_version >= POSTGRESQL_9_4); }
 	inline bool supports_generated_as_identity() const { return (server_version >= POSTGRESQL_10); }
 	inline bool supports_generated_columns() const { return (server_version >= POSTGRESQL_12); }
 
 	size_t execute(const string &sql);
+	size_t execute(const string &sql, const StatementParameters &parameters, size_t first_parameter, size_t number_of_parameters, bool prepare);
 	string select_one(const string &sql);
 
 	template <typename RowFunction>
@@ -243,6 +254,7 @@ private:
 	PGconn *conn;
 	int server_version;
 	TypeMap type_map;
+	map<string, string> prepared_statement_names;
 
 	// forbid copying
 	PostgreSQLClient(const PostgreSQLClient &_) = delete;
@@ -298,6 +310,46 @@ size_t PostgreSQLClient::execute(const string &sql) {
     return res.rows_affected();
 }
 
+size_t PostgreSQLClient::execute(const string &sql, const StatementParameters &parameters, size_t first_parameter, size_t number_of_parameters, bool prepare) {
+	vector<const char *> values(number_of_parameters);
+	for (size_t n = 0; n < number_of_parameters; n++) {
+		values[n] = parameters.value(first_parameter + n);
+	}
+	const int *lengths = parameters.lengths.data() + first_parameter;
+	const int *formats = parameters.formats.data() + first_parameter;
+
+	if (!prepare) {
+		PostgreSQLRes res(PQexecParams(conn, sql.c_str(), number_of_parameters, nullptr, values.data(), lengths, formats, 0 /* text-format results only */), type_map);
+
+		if (res.status() != PGRES_COMMAND_OK && res.status() != PGRES_TUPLES_OK) {
+			throw runtime_error(sql_error(sql));
+		}
+
+		return res.rows_affected();
+	}
+
+	// statements are prepared the first time they're used and kept for the rest of the session
+	auto prepared_statement = prepared_statement_names.find(sql);
+	if (prepared_statement == prepared_statement_names.end()) {
+		string name("ks_statement_" + to_string(prepared_statement_names.size() + 1));
+		PostgreSQLRes res(PQprepare(conn, name.c_str(), sql.c_str(), number_of_parameters, nullptr), type_map);
+
+		if (res.status() != PGRES_COMMAND_OK) {
+			throw runtime_error(sql_error(sql));
+		}
+
+		prepared_statement = prepared_statement_names.insert(make_pair(sql, name)).first;
+	}
+
+	PostgreSQLRes res(PQexecPrepared(conn, prepared_statement->second.c_str(), number_of_parameters, values.data(), lengths, formats, 0 /* text-format results only */), type_map);
+
+	if (res.status() != PGRES_COMMAND_OK && res.status() != PGRES_TUPLES_OK) {
+		throw runtime_error(sql_error(sql));
+	}
+
+	return res.rows_affected();
+}
+
 string PostgreSQLClient::select_one(const string &sql) {
 	PostgreSQLRes res(PQexecParams(conn, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0 /* text-format results only */), type_map);
 
@@ -352,6 +404,57 @@ void PostgreSQLClient::unhold_snapshot() {
 	// do nothing - only needed for lock-based systems like mysql
 }
 
+map<string, string> PostgreSQLClient::table_modification_markers() {
+	// postgresql has nothing per-table that's updated synchronously when a change is committed: the statistics
+	// counters are sent or flushed by each backend some time after its transactions commit, which can be arbitrarily
+	// later if the backend is busy (and never, if the message is dropped, before version 15), so a marker made from
+	// them could still match after a change and the cache would silently skip that change.  instead we use the
+	// transaction ID snapshot, which changes whenever a transaction that writes anything commits or aborts, but not for
+	// reads (including our own, even when they set hint bits or prune pages), vacuums, or checkpoints; inside a
+	// repeatable read transaction it gives that transaction's snapshot, so it describes exactly the rows we see.
+	// this is for the whole cluster, so the cache is only useful for databases that are left alone between syncs.
+	// the relfilenode changes if the table is truncated or rewritten, and the server start time covers the cluster
+	// being restored from a backup.
+	TableModificationMarkerCollector collector;
+	query(
+		"SELECT pg_class.relname, concat_ws(' ', pg_class.relfilenode, txid_current_snapshot(), pg_postmaster_start_time()) "
+		  "FROM pg_class, pg_namespace "
+		 "WHERE pg_class.relnamespace = pg_namespace.oid AND "
+		       "pg_namespace.nspname = ANY (current_schemas(false)) AND "
+		       "relkind = 'r'",
+		collector);
+	return collector.markers;
+}
+
+map<string, size_t> PostgreSQLClient::table_size_estimates() {
+	// relpages is only updated by vacuum and analyze, so we look at the size of the files instead, which is just as
+	// cheap; we include the TOAST table since big values are stored there but still need to be retrieved and hashed
+	TableSizeCollector collector;
+	query(
+		"SELECT pg_class.relname, pg_relation_size(pg_class.oid) + COALESCE(pg_relation_size(NULLIF(pg_class.reltoastrelid, 0)), 0) "
+		  "FROM pg_class, pg_namespace "
+		 "WHERE pg_class.relnamespace = pg_namespace.oid AND "
+		       "pg_namespace.nspname = ANY (current_schemas(false)) AND "
+		       "relkind = 'r'",
+		collector);
+	return collector.sizes;
+}
+
+vector<string> PostgreSQLClient::histogram_bounds(const Table &table, const Column &column) {
+	// maintained by analyze; the bounds divide the values other than the most common values into groups of roughly
+	// equal population, with the first and last being the lowest and highest values seen in its sample
+	HistogramBoundsCollector collector;
+	query(
+		"SELECT unnest(histogram_bounds::text::text[]) "
+		  "FROM pg_stats "
+		 "WHERE schemaname = ANY (current_schemas(false)) AND "
+		       "tablename = '" + escape_string_value(table.name) + "' AND "
+		       "attname = '" + escape_string_value(column.name) + "' AND "
+		       "NOT inherited",
+		collector);
+	return collector.bounds;
+}
+
 void PostgreSQLClient::disable_referential_integrity() {
 	execute("SET CONSTRAINTS ALL DEFERRED");
 
@@ -417,6 +520,132 @@ string &PostgreSQLClient::append_quoted_column_value_to(string &result, const Co
 	}
 }
 
+inline bool packed_value_is_string(const PackedValue &value) {
+	uint8_t leader = value.leader();
+	return ((leader >= MSGPACK_FIXRAW_MIN && leader <= MSGPACK_FIXRAW_MAX) || (leader >= MSGPACK_RAW8 && leader <= MSGPACK_RAW32) || (leader >= MSGPACK_BIN8 && leader <= MSGPACK_BIN32));
+}
+
+inline void append_copy_escaped_value_to(string &result, const string &value) {
+	for (char c : value) {
+		switch (c) {
+			case '\\': result += "\\\\"; break;
+			case '\t': result += "\\t"; break;
+			case '\n': result += "\\n"; break;
+			case '\r': result += "\\r"; break;
+			default:   result += c;
+		}
+	}
+}
+
+inline void append_copy_hex_value_to(string &result, const string &value) {
+	static const char hex_digits[] = "0123456789abcdef";
+	for (unsigned char c : value) {
+		result += hex_digits[c >> 4];
+		result += hex_digits[c & 0x0f];
+	}
+}
+
+string &PostgreSQLClient::append_bulk_load_row_to(string &result, const Columns &columns, const PackedRow &row) {
+	// produces a line in COPY's text format; see bulk_load below
+	for (size_t n = 0; n < row.size(); n++) {
+		if (n > 0) result += '\t';
+
+		const PackedValue &value(row[n]);
+
+		if (value.is_nil()) {
+			result += "\\N";
+		} else if (value.is_false()) {
+			result += 'f';
+		} else if (value.is_true()) {
+			result += 't';
+		} else if (!packed_value_is_string(value)) {
+			// numbers come out the same as they do in SQL
+			sql_encode_and_append_packed_value_to(result, *this, columns[n], value);
+		} else {
+			PackedValueReadStream stream(value);
+			Unpacker<PackedValueReadStream> unpacker(stream);
+			string str(unpacker.template next<string>());
+
+			if (columns[n].column_type == ColumnType::binary) {
+				result += "\\\\x"; // the bytea hex format, with its backslash escaped for COPY
+				append_copy_hex_value_to(result, str);
+			} else if (columns[n].column_type == ColumnType::spatial) {
+				append_copy_hex_value_to(result, str); // PostGIS accepts hex EWKB as input
+			} else {
+				append_copy_escaped_value_to(result, str);
+			}
+		}
+	}
+	result += '\n';
+	return result;
+}
+
+void PostgreSQLClient::bulk_load(const Table &table, const string &data) {
+	// COPY is the fastest way to load rows into PostgreSQL, and unlike INSERT it writes the values we give for
+	// identity columns even if they're GENERATED ALWAYS, so we don't need OVERRIDING SYSTEM VALUE.  we use the
+	// text format since the rest of our value encodings are text; it's parsing the statements that we're avoiding.
+	string sql("COPY " + quote_identifier(table.name) + " (" + columns_list(*this, table.columns) + ") FROM STDIN");
+
+	PostgreSQLRes copy_res(PQexec(conn, sql.c_str()), type_map);
+	if (copy_res.status() != PGRES_COPY_IN) {
+		throw runtime_error(sql_error(sql));
+	}
+
+	if (PQputCopyData(conn, data.data(), data.size()) != 1 || PQputCopyEnd(conn, nullptr) != 1) {
+		throw runtime_error(sql_error(sql));
+	}
+
+	PostgreSQLRes res(PQgetResult(conn), type_map);
+	bool succeeded = (res.status() == PGRES_COMMAND_OK);
+
+	// we have to read results until we get a null, even after an error
+	while (PGresult *extra_res = PQgetResult(conn)) PQclear(extra_res);
+
+	if (!succeeded) {
+		throw runtime_error(sql_error(sql));
+	}
+}
+
+void PostgreSQLClient::append_statement_parameters_to(StatementParameters &parameters, const Columns &columns, const PackedRow &row) {
+	for (size_t n = 0; n < row.size(); n++) {
+		const PackedValue &value(row[n]);
+		size_t offset = parameters.data.size();
+
+		if (value.is_nil()) {
+			parameters.add_null();
+		} else if (value.is_false()) {
+			parameters.data += 'f';
+			parameters.add_text_from(offset);
+		} else if (value.is_true()) {
+			parameters.data += 't';
+			parameters.add_text_from(offset);
+		} else if (!packed_value_is_string(value)) {
+			sql_encode_and_append_packed_value_to(parameters.data, *this, columns[n], value);
+			parameters.add_text_from(offset);
+		} else {
+			PackedValueReadStream stream(value);
+			Unpacker<PackedValueReadStream> unpacker(stream);
+			parameters.data += unpacker.template next<string>();
+
+			// the binary format for bytea is just the bytes themselves, which saves encoding them; the text
+			// formats for other types aren't escaped, so we don't need the binary formats for those
+			if (columns[n].column_type == ColumnType::binary || columns[n].column_type == ColumnType::spatial) {
+				parameters.add_binary_from(offset);
+			} else {
+				parameters.add_text_from(offset);
+			}
+		}
+	}
+}
+
+string &PostgreSQLClient::append_parameter_placeholder_to(string &result, const Column &column, size_t parameter_number) {
+	if (column.column_type == ColumnType::spatial) {
+		return result += "ST_GeomFromEWKB($" + to_string(parameter_number) + ")";
+	} else {
+		return result += "$" + to_string(parameter_number);
+	}
+}
+
 void PostgreSQLClient::convert_unsupported_database_schema(Database &database) {
 	for (Table &table : database.tables) {
 		for (Column &column : table.columns) {
@@ -650,6 +879,25 @@ string PostgreSQLClient::key_definition(const Table &table, const Key &key) {
 	return result;
 }
 
+string PostgreSQLClient::row_text_sql(const Table &table, const string &alias) {
+	// the text form of the row type, which quotes and escapes values as necessary; we list the columns qualified by
+	// the alias rather than using the alias on its own, which would refer to any column that had the same name
+	string result("ROW(");
+	bool first = true;
+	for (const Column &column : table.columns) {
+		if (column.generated_always()) continue; // not selected by retrieve_rows_sql
+		if (!first) result += ", ";
+		first = false;
+		result += alias + "." + quote_identifier(column.name);
+	}
+	result += ")::text";
+	return result;
+}
+
+string PostgreSQLClient::aggregate_hash_sql(const Table &table, const string &row_text) {
+	return "md5(string_agg(" + row_text + ", '' ORDER BY " + columns_list(*this, table.columns, table.primary_key_columns) + "))";
+}
+
 inline ColumnTypeList PostgreSQLClient::supported_types() {
 	ColumnTypeList result{
 		ColumnType::time,
@@ -12,6 +12,13 @@ uint8_t *copy_bytes(Unpacker<Stream> &unpacker, PackedValue &obj, size_t bytes)
 	return start_of_data;
 }
 
+template <typename Stream>
+void copy_payload(Unpacker<Stream> &unpacker, PackedValue &obj, size_t bytes) {
+	// for long strings, allocate exactly what we need rather than letting extend() double the allocation
+	obj.reserve(obj.encoded_size() + bytes);
+	copy_bytes(unpacker, obj, bytes);
+}
+
 template <typename Stream>
 uint8_t copy_and_read_uint8_t(Unpacker<Stream> &unpacker, PackedValue &obj) {
 	uint8_t *p = copy_bytes(unpacker, obj, sizeof(uint8_t));
@@ -32,7 +39,12 @@ uint32_t copy_and_read_uint32_t(Unpacker<Stream> &unpacker, PackedValue &obj) {
 
 template <typename Stream>
 void copy_object(Unpacker<Stream> &unpacker, PackedValue &obj) {
-	uint8_t leader = *copy_bytes(unpacker, obj, 1);
+	uint8_t leader;
+	unpacker.read_bytes(&leader, 1);
+	if (leader >= MSGPACK_FIXRAW_MIN && leader <= MSGPACK_FIXRAW_MAX) {
+		obj.reserve(obj.encoded_size() + 1 + (leader & 31)); // short strings are common enough to be worth allocating exactly
+	}
+	*obj.extend(1) = leader;
 
 	if ((leader == MSGPACK_NIL || leader == MSGPACK_FALSE || leader == MSGPACK_TRUE) ||
 		(leader >= MSGPACK_POSITIVE_FIXNUM_MIN && leader <= MSGPACK_POSITIVE_FIXNUM_MAX) ||
@@ -92,17 +104,17 @@ void copy_object(Unpacker<Stream> &unpacker, PackedValue &obj) {
 
 			case MSGPACK_BIN8:
 			case MSGPACK_RAW8:
-				copy_bytes(unpacker, obj, copy_and_read_uint8_t(unpacker, obj));
+				copy_payload(unpacker, obj, copy_and_read_uint8_t(unpacker, obj));
 				break;
 
 			case MSGPACK_RAW16:
 			case MSGPACK_BIN16:
-				copy_bytes(unpacker, obj, copy_and_read_uint16_t(unpacker, obj));
+				copy_payload(unpacker, obj, copy_and_read_uint16_t(unpacker, obj));
 				break;
 
 			case MSGPACK_RAW32:
 			case MSGPACK_BIN32:
-				copy_bytes(unpacker, obj, copy_and_read_uint32_t(unpacker, obj));
+				copy_payload(unpacker, obj, copy_and_read_uint32_t(unpacker, obj));
 				break;
 
 			case MSGPACK_ARRAY16:
@@ -7,57 +7,80 @@
 #include "type_codes.h"
 
 struct PackedValue {
-	PackedValue(): encoded_bytes(nullptr), used(0) {}
+	// most values - nulls, booleans, numbers, and the short strings typical of keys - fit in this many bytes, so we
+	// keep them inside the object itself and only allocate memory for longer values.  this also means that copying
+	// keys around doesn't normally need to allocate anything other than the vector of values.
+	static const size_t INLINE_CAPACITY = 16;
+
+	PackedValue(): used(0), capacity(INLINE_CAPACITY) {}
 
 	~PackedValue() {
-		free(encoded_bytes);
+		if (on_heap()) free(heap_bytes);
 	}
 
-	PackedValue(const PackedValue &from): encoded_bytes(nullptr) {
+	PackedValue(const PackedValue &from): used(0), capacity(INLINE_CAPACITY) {
 		*this = from;
 	}
 
-	PackedValue(PackedValue &&from): encoded_bytes(nullptr) {
+	PackedValue(PackedValue &&from): used(0), capacity(INLINE_CAPACITY) {
 		*this = std::move(from);
 	}
 
 	PackedValue &operator=(const PackedValue &from) {
 		if (&from != this) {
-			free(encoded_bytes);
-			encoded_bytes = nullptr;
+			used = 0;
+			reserve(from.used);
+			memcpy(mutable_data(), from.data(), from.used);
 			used = from.used;
-			if (used) {
-				encoded_bytes = (uint8_t *)malloc(used);
-				if (!encoded_bytes) throw std::bad_alloc();
-				memcpy(encoded_bytes, from.encoded_bytes, used);
-			}
 		}
 		return *this;
 	}
 
 	PackedValue &operator=(PackedValue &&from) {
 		if (this != &from) {
-			free(encoded_bytes);
+			if (from.on_heap()) {
+				if (on_heap()) free(heap_bytes);
+				heap_bytes = from.heap_bytes;
+				capacity = from.capacity;
+				from.capacity = INLINE_CAPACITY;
+			} else {
+				// there's nothing to take over, but it fits in whatever space we have already
+				memcpy(mutable_data(), from.inline_bytes, from.used);
+			}
 			used = from.used;
-			encoded_bytes = from.encoded_bytes;
-			from.encoded_bytes = nullptr;
 			from.used = 0;
 		}
 		return *this;
 	}
 
+	inline void reserve(size_t bytes) {
+		if (bytes <= capacity) return;
+		uint8_t *new_heap_bytes;
+		if (on_heap()) {
+			new_heap_bytes = (uint8_t *)realloc(heap_bytes, bytes);
+			if (!new_heap_bytes) throw std::bad_alloc();
+		} else {
+			new_heap_bytes = (uint8_t *)malloc(bytes);
+			if (!new_heap_bytes) throw std::bad_alloc();
+			memcpy(new_heap_bytes, inline_bytes, used);
+		}
+		heap_bytes = new_heap_bytes;
+		capacity = bytes;
+	}
+
+	// values are usually built up a few bytes at a time - for example the leader, then the length, then the
+	// string itself - so rather than reallocating each time, we at least double the size each time we need more
 	inline uint8_t *extend(size_t bytes) {
-		uint8_t *new_encoded_bytes = (uint8_t *)realloc(encoded_bytes, used + bytes);
-		if (!new_encoded_bytes) throw std::bad_alloc();
+		if (used + bytes > capacity) {
+			reserve(capacity*2 > used + bytes ? capacity*2 : used + bytes);
+		}
 		size_t size_before = used;
 		used += bytes;
-		encoded_bytes = new_encoded_bytes;
-		return encoded_bytes + size_before;
+		return mutable_data() + size_before;
 	}
 
+	// keeps any allocated memory, since the value is usually about to be replaced by a similar value
 	inline void clear() {
-		free(encoded_bytes);
-		encoded_bytes = nullptr;
 		used = 0;
 	}
 
@@ -66,8 +89,8 @@ struct PackedValue {
 	}
 
 	inline size_t encoded_size() const { return used; }
-	inline uint8_t leader() const { return (used ? *encoded_bytes : 0); }
-	inline const uint8_t *data() const { return encoded_bytes; }
+	inline uint8_t leader() const { return (used ? *data() : 0); }
+	inline const uint8_t *data() const { return (on_heap() ? heap_bytes : inline_bytes); }
 
 	inline bool is_nil()   const { return (leader() == MSGPACK_NIL); }
 	inline bool is_false() const { return (leader() == MSGPACK_FALSE); }
@@ -87,8 +110,15 @@ struct PackedValue {
 	}
 
 protected:
-	uint8_t *encoded_bytes;
+	inline bool on_heap() const { return (capacity > INLINE_CAPACITY); }
+	inline uint8_t *mutable_data() { return (on_heap() ? heap_bytes : inline_bytes); }
+
 	size_t used;
+	size_t capacity;
+	union {
+		uint8_t *heap_bytes;
+		uint8_t inline_bytes[INLINE_CAPACITY];
+	};
 };
 
 #endif
@@ -0,0 +1,240 @@
+#include "multiplexer.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+const size_t MAX_FRAME_DATA_SIZE = 65536;
+const size_t FRAME_HEADER_SIZE = 2*sizeof(uint32_t);
+const uint32_t CREDIT_FRAME = 0x80000000;
+
+static bool read_fully(int fd, uint8_t *buf, size_t bytes) {
+	while (bytes > 0) {
+		ssize_t bytes_read = ::read(fd, buf, bytes);
+		if (bytes_read == 0) return false;
+		if (bytes_read < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		buf += bytes_read;
+		bytes -= bytes_read;
+	}
+	return true;
+}
+
+static bool write_fully(int fd, const uint8_t *buf, size_t bytes) {
+	while (bytes > 0) {
+		ssize_t bytes_written = ::write(fd, buf, bytes);
+		if (bytes_written <= 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		buf += bytes_written;
+		bytes -= bytes_written;
+	}
+	return true;
+}
+
+static void set_close_on_exec(int fd) {
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+Multiplexer::Multiplexer(int transport_read_fd, int transport_write_fd, const vector<MultiplexedChannel> &channels, size_t window_size):
+	transport_read_fd(transport_read_fd), transport_write_fd(transport_write_fd), channels(channels), window_size(window_size), buffers(channels.size()), windows(channels.size()), senders_open(channels.size()), transport_write_failed(false) {
+	// the other end starts out able to buffer a whole window for each channel
+	for (ChannelWindow &window : windows) window.credit = window_size;
+
+	// we handle write errors ourselves, and don't want to be killed if the other end goes away
+	signal(SIGPIPE, SIG_IGN);
+
+	// don't let any processes we start later inherit our ends of the pipes, or they would never see them close
+	set_close_on_exec(transport_read_fd);
+	set_close_on_exec(transport_write_fd);
+	for (const MultiplexedChannel &channel : channels) {
+		set_close_on_exec(channel.read_fd);
+		set_close_on_exec(channel.write_fd);
+	}
+
+	for (size_t channel = 0; channel < channels.size(); channel++) {
+		threads.push_back(thread(&Multiplexer::send_from_channel, this, channel));
+		threads.push_back(thread(&Multiplexer::deliver_to_channel, this, channel));
+	}
+	threads.push_back(thread(&Multiplexer::receive_from_transport, this));
+}
+
+Multiplexer::~Multiplexer() {
+	wait();
+}
+
+void Multiplexer::wait() {
+	for (thread &t : threads) {
+		if (t.joinable()) t.join();
+	}
+	if (transport_read_fd >= 0) {
+		::close(transport_read_fd);
+		transport_read_fd = -1;
+	}
+	if (transport_write_fd >= 0) {
+		::close(transport_write_fd);
+		transport_write_fd = -1;
+	}
+}
+
+void Multiplexer::send_from_channel(size_t channel) {
+	uint8_t buf[FRAME_HEADER_SIZE + MAX_FRAME_DATA_SIZE];
+	*(uint32_t*)buf = htonl(channel);
+	ChannelWindow &window(windows[channel]);
+
+	while (true) {
+		// only read as much as the other end has room to buffer for this channel; if the worker at the
+		// other end isn't keeping up, this blocks our worker rather than the whole transport
+		unique_lock<std::mutex> window_lock(window.mutex);
+		while (window.credit == 0 && !window.closed) window.cond.wait(window_lock);
+		size_t bytes_to_read = (window.closed ? MAX_FRAME_DATA_SIZE : min(window.credit, MAX_FRAME_DATA_SIZE));
+		window_lock.unlock();
+
+		ssize_t bytes_read = ::read(channels[channel].read_fd, buf + FRAME_HEADER_SIZE, bytes_to_read);
+		if (bytes_read < 0 && errno == EINTR) continue;
+		if (bytes_read < 0) bytes_read = 0; // treat errors the same as the channel being closed
+
+		window_lock.lock();
+		if (!window.closed) window.credit -= bytes_read;
+		window_lock.unlock();
+
+		// a zero-length frame tells the other end the channel has been closed
+		*(uint32_t*)(buf + sizeof(uint32_t)) = htonl(bytes_read);
+
+		// if the transport has failed, we keep reading and discarding until the channel is closed so the worker doesn't block
+		write_to_transport(buf, FRAME_HEADER_SIZE + bytes_read);
+
+		if (bytes_read == 0) break;
+	}
+
+	::close(channels[channel].read_fd);
+	senders_open--;
+}
+
+bool Multiplexer::write_to_transport(const uint8_t *buf, size_t bytes) {
+	unique_lock<std::mutex> lock(transport_write_mutex);
+	if (transport_write_failed) return false;
+	if (write_fully(transport_write_fd, buf, bytes)) return true;
+	transport_write_failed = true;
+	lock.unlock();
+
+	// the other end has gone away, so it won't be giving us any more credit
+	close_all_channel_windows();
+	return false;
+}
+
+void Multiplexer::receive_from_transport() {
+	uint8_t header[FRAME_HEADER_SIZE];
+	size_t channels_open = buffers.size();
+
+	// keep going until the other end has closed all the channels, and we've closed all ours so don't need any more
+	// credit (or the transport has closed or failed)
+	while ((channels_open || senders_open) && read_fully(transport_read_fd, header, sizeof(header))) {
+		uint32_t channel = ntohl(*(uint32_t*)header);
+		uint32_t length = ntohl(*(uint32_t*)(header + sizeof(uint32_t)));
+
+		if (channel & CREDIT_FRAME) {
+			channel &= ~CREDIT_FRAME;
+			if (channel >= windows.size()) break; // corrupt stream
+			add_credit(channel, length);
+			continue;
+		}
+
+		if (channel >= buffers.size() || length > MAX_FRAME_DATA_SIZE) break; // corrupt stream
+
+		string data(length, '\0');
+		if (!read_fully(transport_read_fd, (uint8_t*)&data[0], length)) break;
+
+		ChannelBuffer &buffer(buffers[channel]);
+		unique_lock<std::mutex> lock(buffer.mutex);
+		if (buffer.bytes + length > window_size) break; // the other end isn't respecting the window
+
+		if (length == 0) {
+			if (!buffer.closed) channels_open--;
+			buffer.closed = true;
+		} else if (!buffer.closed) {
+			buffer.bytes += length;
+			buffer.chunks.push_back(move(data));
+		}
+		buffer.cond.notify_all();
+	}
+
+	if (!channels_open && !senders_open) {
+		// if the other end closed its last channel before we did, it's still waiting to read more frames, so
+		// send an empty credit frame to wake it up and let it see that we've finished too
+		uint8_t empty_credit_frame[FRAME_HEADER_SIZE];
+		*(uint32_t*)empty_credit_frame = htonl(0 | CREDIT_FRAME);
+		*(uint32_t*)(empty_credit_frame + sizeof(uint32_t)) = htonl(0);
+		write_to_transport(empty_credit_frame, sizeof(empty_credit_frame));
+	}
+
+	// there'll be no more data for any channel, nor credit for sending any
+	close_all_channel_buffers();
+	close_all_channel_windows();
+}
+
+void Multiplexer::add_credit(size_t channel, size_t bytes) {
+	ChannelWindow &window(windows[channel]);
+	unique_lock<std::mutex> lock(window.mutex);
+	window.credit += bytes;
+	window.cond.notify_all();
+}
+
+void Multiplexer::close_all_channel_buffers() {
+	for (ChannelBuffer &buffer : buffers) {
+		unique_lock<std::mutex> lock(buffer.mutex);
+		buffer.closed = true;
+		buffer.cond.notify_all();
+	}
+}
+
+void Multiplexer::close_all_channel_windows() {
+	for (ChannelWindow &window : windows) {
+		unique_lock<std::mutex> lock(window.mutex);
+		window.closed = true;
+		window.cond.notify_all();
+	}
+}
+
+void Multiplexer::deliver_to_channel(size_t channel) {
+	ChannelBuffer &buffer(buffers[channel]);
+	bool write_failed = false;
+	size_t credit_to_give = 0;
+	uint8_t credit_frame[FRAME_HEADER_SIZE];
+	*(uint32_t*)credit_frame = htonl(channel | CREDIT_FRAME);
+
+	while (true) {
+		unique_lock<std::mutex> lock(buffer.mutex);
+		while (buffer.chunks.empty() && !buffer.closed) buffer.cond.wait(lock);
+		if (buffer.chunks.empty()) break; // and closed
+
+		string data(move(buffer.chunks.front()));
+		buffer.chunks.pop_front();
+		lock.unlock();
+
+		// if the worker has gone away, discard the data so we don't block the other channels
+		if (!write_failed) write_failed = !write_fully(channels[channel].write_fd, (const uint8_t*)data.data(), data.size());
+
+		lock.lock();
+		buffer.bytes -= data.size();
+		lock.unlock();
+
+		// give the other end back the space, but in batches rather than sending a frame for every chunk
+		credit_to_give += data.size();
+		if (credit_to_give >= window_size/4) {
+			*(uint32_t*)(credit_frame + sizeof(uint32_t)) = htonl(credit_to_give);
+			write_to_transport(credit_frame, sizeof(credit_frame));
+			credit_to_give = 0;
+		}
+	}
+
+	::close(channels[channel].write_fd);
+}
@@ -0,0 +1,87 @@
+#ifndef MULTIPLEXER_H
+#define MULTIPLEXER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdexcept>
+
+using namespace std;
+
+// carries several independent channels over a single pair of transport descriptors (such as the
+// stdin and stdout of one SSH session), so that each worker can still use its own plain pipes.
+//
+// each chunk of data is framed as a 32-bit channel number and a 32-bit length followed by the data
+// itself; a zero-length frame indicates that the channel has been closed by the sending end.
+//
+// the transport has only one reader at each end, so it must never wait for any one channel's worker,
+// or a worker that is waiting on another worker's progress could deadlock them both.  instead each
+// channel has a window: the sending end may only have that many bytes outstanding, and the receiving
+// end gives credit back (in a frame with the top bit of the channel number set, whose length is the
+// number of bytes credited) as it writes the data out to the channel's worker.
+const size_t DEFAULT_MULTIPLEXER_WINDOW_SIZE = 16*1024*1024;
+
+struct MultiplexedChannel {
+	MultiplexedChannel(int read_fd, int write_fd): read_fd(read_fd), write_fd(write_fd) {}
+
+	int read_fd;  // data read from this descriptor is sent to the corresponding channel at the other end
+	int write_fd; // data received for the channel from the other end is written to this descriptor
+};
+
+class Multiplexer {
+public:
+	// takes ownership of all the descriptors given, and closes them when done
+	Multiplexer(int transport_read_fd, int transport_write_fd, const vector<MultiplexedChannel> &channels, size_t window_size = DEFAULT_MULTIPLEXER_WINDOW_SIZE);
+	~Multiplexer();
+
+	// waits until all channels have been closed in both directions (or the transport has failed)
+	void wait();
+
+private:
+	struct ChannelBuffer {
+		ChannelBuffer(): bytes(0), closed(false) {}
+
+		std::mutex mutex;
+		condition_variable cond;
+		deque<string> chunks;
+		size_t bytes;
+		bool closed;
+	};
+
+	struct ChannelWindow {
+		ChannelWindow(): credit(0), closed(false) {}
+
+		std::mutex mutex;
+		condition_variable cond;
+		size_t credit;
+		bool closed; // no more credit will arrive, so there's no point waiting for it
+	};
+
+	void send_from_channel(size_t channel);
+	void receive_from_transport();
+	void deliver_to_channel(size_t channel);
+	bool write_to_transport(const uint8_t *buf, size_t bytes);
+	void add_credit(size_t channel, size_t bytes);
+	void close_all_channel_buffers();
+	void close_all_channel_windows();
+
+	int transport_read_fd;
+	int transport_write_fd;
+	vector<MultiplexedChannel> channels;
+	size_t window_size;
+	vector<ChannelBuffer> buffers;
+	vector<ChannelWindow> windows;
+	std::atomic<size_t> senders_open;
+	std::mutex transport_write_mutex;
+	bool transport_write_failed;
+	vector<thread> threads;
+
+	// forbid copying
+	Multiplexer(const Multiplexer& copy_from) { throw logic_error("copying forbidden"); }
+};
+
+#endif
@@ -9,8 +9,9 @@
 #include "db_url.h"
 
 struct Options {
-	inline Options(): workers(1), verbose(0), progress(false), snapshot(true), alter(false), structure_only(false),
-    commit_level(CommitLevel::success), hash_algorithm(DEFAULT_HASH_ALGORITHM) {}
+	inline Options(): workers(1), verbose(0), progress(false), snapshot(true), multiplex(true), alter(false), structure_only(false),
+    commit_level(CommitLevel::success), hash_algorithm(DEFAULT_HASH_ALGORITHM),
+    compression_algorithm(DEFAULT_COMPRESSION_ALGORITHM), compression_level(DEFAULT_COMPRESSION_LEVEL), hash_tree(false), hash_in_database(false) {}
 
 	void help() {
 		cerr <<
@@ -29,12 +30,29 @@ struct Options {
 			"                             datacentre, and may even be the case on local LANs\n"
 			"                             if you have very fast disks.\n"
 			"\n"
+			"  --connect host:port        Connect to a 'from' end that has been started with\n"
+			"                             'ks_postgresql listen' or 'ks_mysql listen' on\n"
+			"                             another server, rather than starting one.  The\n"
+			"                             connections are not encrypted, so only use this on\n"
+			"                             trusted networks.  The database details are given\n"
+			"                             when starting the 'from' end instead of --from.\n"
+			"\n"
+			"  --listen [host:]port       Accept connections from a 'from' end started with\n"
+			"                             'ks_postgresql connect' or 'ks_mysql connect' on\n"
+			"                             another server.  As with --connect, this is not\n"
+			"                             encrypted.\n"
+			"\n"
 			"  --cipher                   Specify the cipher when using 'via' option.\n"
 			"                             Defaults to aes256-ctr.\n"
 			"\n"
 			"  --workers num              The number of concurrent workers to use at each end.\n"
 			"                             Defaults to 1.\n"
 			"\n"
+			"  --without-multiplexing     Use a separate SSH session for each worker when\n"
+			"                             using the 'via' option.  Normally all the workers\n"
+			"                             share one SSH session, but this requires the same\n"
+			"                             version of Kitchen Sync at both ends.\n"
+			"\n"
 			"  --ignore tables            Comma-separated list of tables to ignore.\n"
 			"\n"
 			"  --only tables              Comma-separated list of tables to process (causing \n"
@@ -87,10 +105,52 @@ struct Options {
 			"                             would use are printed as suggestions.)"
 			"\n"
 			"  --hash arg                 Use the specified checksum algorithm.  The default\n"
-			"                             is MD5.  You can downgrade to XXH64 if you are more\n"
-			"                             interested in performance than data integrity.\n"
-			"                             This is not considered appropriate for production\n"
-			"                             use, but may be useful for dev/test machines.\n"
+			"                             is MD5.  XXH128 is much faster and has a low enough\n"
+			"                             collision rate for most purposes.  BLAKE2B is a\n"
+			"                             cryptographic hash, and faster than MD5 on 64-bit\n"
+			"                             CPUs.  XXH128SUM adds up the XXH128 hashes of each\n"
+			"                             row, so that the database can return the rows in\n"
+			"                             any order when possible.  You can downgrade to\n"
+			"                             XXH64 if you are more interested in performance\n"
+			"                             than data integrity.  This is not considered\n"
+			"                             appropriate for production use, but may be useful\n"
+			"                             for dev/test machines.\n"
+			"                             Run ks_bench to compare them on your systems.\n"
+			"\n"
+			"  --compression arg          Compress the data sent between the two ends using the\n"
+			"                             specified algorithm.  May be 'none' (the default) or\n"
+			"                             'zstd' (if Kitchen Sync was built with libzstd).\n"
+			"                             Worthwhile whenever the network link rather than the\n"
+			"                             database is the bottleneck.  When used with --via,\n"
+			"                             SSH's own (slower) compression is turned off.\n"
+			"\n"
+			"  --compression-level num    The compression level to use.  Higher levels give\n"
+			"                             better compression but use more CPU time.\n"
+			"                             Defaults to 3.\n"
+			"\n"
+			"  --hash-tree                Compare whole ranges of each table in one pass at\n"
+			"                             each end, then descend into the parts that don't\n"
+			"                             match, instead of scanning forward progressively\n"
+			"                             larger blocks of rows.  Finds scattered changes in\n"
+			"                             very large tables in far fewer round trips.\n"
+			"\n"
+			"  --hash-in-database         Hash ranges of rows using aggregate queries run by\n"
+			"                             the database servers, instead of retrieving all the\n"
+			"                             rows to hash them.  Only used if both ends are the\n"
+			"                             same type of database.\n"
+			"\n"
+			"  --hash-cache directory     Keep the hashes computed by the 'from' end in the\n"
+			"                             given directory, and reuse them in later runs for\n"
+			"                             tables that haven't been modified since.  Only\n"
+			"                             supported when the 'from' end is run locally; when\n"
+			"                             using --via, --connect, or --listen, set the\n"
+			"                             ENDPOINT_HASH_CACHE environment variable for the\n"
+			"                             'from' end instead.\n"
+			"\n"
+			"  --statistics-file file.yml Keep statistics about the differences found in each\n"
+			"                             table in the given file, and use them to choose\n"
+			"                             the initial block sizes the next time.  Useful\n"
+			"                             when syncing the same databases repeatedly.\n"
 			"\n"
 			"  --from-path                Directory in which to find the Kitchen Sync binaries\n"
 			"                             on the source end.  Normally you should not need this\n"
@@ -109,13 +169,15 @@ struct Options {
 
 	inline bool parse(int argc, char *argv[]) {
 		try {
-			int urls = 0;
+			bool have_from = false, have_to = false;
 			while (true) {
 				static struct option longopts[] = {
 					{ "from",						required_argument,	NULL,	'f' },
 					{ "to",							required_argument,	NULL,	't' },
 					{ "via",						required_argument,	NULL,	'v' },
 					{ "cipher",						required_argument,	NULL,	'C' },
+					{ "connect",					required_argument,	NULL,	'n' },
+					{ "listen",						required_argument,	NULL,	'L' },
 					{ "from-path",					required_argument,	NULL,	'P' },
 					{ "workers",					required_argument,	NULL,	'w' },
 					{ "ignore",						required_argument,	NULL,	'i' },
@@ -125,9 +187,16 @@ struct Options {
 					{ "set-from-variables",			required_argument,	NULL,	'F' },
 					{ "set-to-variables",			required_argument,	NULL,	'T' },
 					{ "without-snapshot-export",	no_argument,		NULL,	'W' },
+					{ "without-multiplexing",		no_argument,		NULL,	'M' },
 					{ "commit",						required_argument,	NULL,	'c' },
 					{ "alter",						no_argument,		NULL,	'a' },
 					{ "hash",					    required_argument,	NULL,	'h' },
+					{ "compression",				required_argument,	NULL,	'z' },
+					{ "compression-level",			required_argument,	NULL,	'Z' },
+					{ "hash-tree",					no_argument,		NULL,	'H' },
+					{ "hash-in-database",			no_argument,		NULL,	'D' },
+					{ "hash-cache",					required_argument,	NULL,	'K' },
+					{ "statistics-file",			required_argument,	NULL,	'S' },
 					{ "verbose",					no_argument,		NULL,	'V' },
 					{ "progress",					no_argument,		NULL,	'p' },
 					{ "debug",						no_argument,		NULL,	'd' },
@@ -140,18 +209,26 @@ struct Options {
 				switch (ch) {
 					case 'f':
 						from = DbUrl(optarg);
-						urls++;
+						have_from = true;
 						break;
 
 					case 't':
 						to = DbUrl(optarg);
-						urls++;
+						have_to = true;
 						break;
 
 					case 'v':
 						via = optarg;
 						break;
 
+					case 'n':
+						connect = optarg;
+						break;
+
+					case 'L':
+						listen = optarg;
+						break;
+
 					case 'P':
 						from_path = optarg;
 						if (from_path.size() > 0 && from_path[from_path.size() - 1] != '/') {
@@ -192,6 +269,10 @@ struct Options {
 						snapshot = false;
 						break;
 
+					case 'M':
+						multiplex = false;
+						break;
+
 					case 'C':
 						cipher = optarg;
 						break;
@@ -219,9 +300,46 @@ struct Options {
 							hash_algorithm = HashAlgorithm::md5;
 						} else if (!strcmp(optarg, "XXH64")) {
 							hash_algorithm = HashAlgorithm::xxh64;
+						} else if (!strcmp(optarg, "XXH128")) {
+							hash_algorithm = HashAlgorithm::xxh3_128;
+						} else if (!strcmp(optarg, "XXH128SUM")) {
+							hash_algorithm = HashAlgorithm::xxh3_128_sum;
+						} else if (!strcmp(optarg, "BLAKE2B")) {
+							hash_algorithm = HashAlgorithm::blake2b;
 						} else {
 							throw invalid_argument("Unknown hash algorithm: " + string(optarg));
 						}
+						break;
+
+					case 'z':
+						if (!strcmp(optarg, "none")) {
+							compression_algorithm = CompressionAlgorithm::none;
+						} else if (!strcmp(optarg, "zstd")) {
+							compression_algorithm = CompressionAlgorithm::zstd;
+						} else {
+							throw invalid_argument("Unknown compression algorithm: " + string(optarg));
+						}
+						break;
+
+					case 'Z':
+						compression_level = atoi(optarg);
+						break;
+
+					case 'H':
+						hash_tree = true;
+						break;
+
+					case 'D':
+						hash_in_database = true;
+						break;
+
+					case 'K':
+						hash_cache = optarg;
+						break;
+
+					case 'S':
+						statistics_file = optarg;
+						break;
 
 					case 'V':
 						verbose = 1;
@@ -241,11 +359,21 @@ struct Options {
 				}
 			}
 
-			if (urls < 2) {
+			// when using --connect or --listen, the 'from' end is started separately and is told the database details itself
+			bool remote_from = (!connect.empty() || !listen.empty());
+			if (!have_to || (!have_from && !remote_from)) {
 				help();
 				return false;
 			}
 
+			if (remote_from && (!via.empty() || (!connect.empty() && !listen.empty()))) {
+				throw invalid_argument("Only one of --via, --connect, and --listen may be used");
+			}
+
+			if (!hash_cache.empty() && (remote_from || !via.empty())) {
+				throw invalid_argument("--hash-cache can only be used when the 'from' end is run locally");
+			}
+
 			return true;
 		} catch (const exception &e) {
 			cerr << e.what() << endl;
@@ -256,6 +384,8 @@ struct Options {
 
 	DbUrl from, to;
 	string via;
+	string connect;
+	string listen;
 	string cipher;
 	string from_path;
 	string filters;
@@ -265,9 +395,16 @@ struct Options {
 	int verbose;
 	bool progress;
 	bool snapshot;
+	bool multiplex;
 	bool alter;
 	CommitLevel commit_level;
 	HashAlgorithm hash_algorithm;
+	CompressionAlgorithm compression_algorithm;
+	int compression_level;
+	bool hash_tree;
+	bool hash_in_database;
+	string hash_cache;
+	string statistics_file;
 	bool structure_only;
 	string ignore, only;
 };
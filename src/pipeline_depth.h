@@ -0,0 +1,122 @@
+#ifndef PIPELINE_DEPTH_H
+#define PIPELINE_DEPTH_H
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include "defaults.h"
+
+// decides how many commands the 'to' end keeps outstanding.  too few and we leave the link idle while each
+// response makes its way back; too many and commands just queue up at the other end, where they hold memory and
+// take work that another worker could have shared.  we want enough to cover the bandwidth-delay product.
+//
+// this is essentially TCP Vegas applied to commands: the lowest round trip time we see tells us how long a
+// command takes when it doesn't have to wait for others, so from the smoothed round trip time we can estimate
+// how many of the outstanding commands are just sitting in the queue: in_flight * (1 - base_rtt/smoothed_rtt).
+// we grow the depth while that's less than one command, and shrink it when it's more than a few.
+//
+// since commands for different tables can take very different amounts of time, the base round trip time is
+// measured again for each table, but the depth carries over as the best starting point we have.
+struct PipelineDepthController {
+	static constexpr double RTT_SMOOTHING = 0.125; // the same gain TCP uses
+	static constexpr double MIN_COMMANDS_QUEUED = 1;
+	static constexpr double MAX_COMMANDS_QUEUED = 3;
+
+	struct CommandSent {
+		double time_sent;
+		size_t in_flight;
+		size_t command_bytes;
+	};
+
+	PipelineDepthController(size_t maximum_depth = DEFAULT_MAX_COMMANDS_TO_PIPELINE): maximum_depth(std::max(maximum_depth, DEFAULT_MIN_COMMANDS_TO_PIPELINE)), depth(DEFAULT_MIN_COMMANDS_TO_PIPELINE), base_rtt(0), smoothed_rtt(0), smoothed_bytes_per_second(0), command_bytes_outstanding(0), responses_before_next_change(0), last_bytes_written(0), last_bytes_read(0), last_response_time(0) {}
+
+	static double now() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline size_t outstanding() const { return commands.size(); }
+
+	// as well as the depth, we limit the total size of the commands we have outstanding, since if the other
+	// end blocks writing its responses to us while we're blocked writing more commands to it, neither of us
+	// would ever get to read anything; this is only a concern for commands with long lists of keys.
+	inline bool can_send() const {
+		return outstanding() < depth && (outstanding() < DEFAULT_MIN_COMMANDS_TO_PIPELINE || command_bytes_outstanding < DEFAULT_MAX_COMMAND_BYTES_TO_PIPELINE);
+	}
+
+	// call before sending the first command for a table, with the totals so far from the input and output streams
+	void start_table(size_t total_bytes_written, size_t total_bytes_read) {
+		base_rtt = smoothed_rtt = 0;
+		last_bytes_written = total_bytes_written;
+		last_bytes_read = total_bytes_read;
+	}
+
+	// call after sending each command, with the time just before it was sent and the total bytes written to the output stream so far
+	void command_sent(double time_sent, size_t total_bytes_written) {
+		size_t command_bytes = total_bytes_written - last_bytes_written;
+		last_bytes_written = total_bytes_written;
+		if (commands.empty()) last_response_time = time_sent; // the link was idle, so don't count the idle time against its throughput
+		commands.push_back(CommandSent{time_sent, commands.size() + 1, command_bytes});
+		command_bytes_outstanding += command_bytes;
+	}
+
+	// call after handling each response (which come back in the order the commands were sent), with the total bytes
+	// read from the input stream so far; returns true if the depth was changed
+	bool response_received(double time, size_t total_bytes_read) {
+		CommandSent command(commands.front());
+		commands.pop_front();
+		command_bytes_outstanding -= command.command_bytes;
+
+		double rtt = time - command.time_sent;
+		if (base_rtt == 0 || rtt < base_rtt) base_rtt = rtt;
+		smoothed_rtt = (smoothed_rtt == 0 ? rtt : smoothed_rtt + (rtt - smoothed_rtt)*RTT_SMOOTHING);
+
+		// the input stream reads ahead, so the bytes attributed to any one response are approximate, but the total is right
+		size_t response_bytes = total_bytes_read - last_bytes_read;
+		last_bytes_read = total_bytes_read;
+		if (time > last_response_time) {
+			double bytes_per_second = response_bytes/(time - last_response_time);
+			smoothed_bytes_per_second = (smoothed_bytes_per_second == 0 ? bytes_per_second : smoothed_bytes_per_second + (bytes_per_second - smoothed_bytes_per_second)*RTT_SMOOTHING);
+		}
+		last_response_time = time;
+
+		// like Vegas, only change the depth once per round trip, since the commands already outstanding were sent
+		// before the last change and so can't tell us anything about it
+		if (responses_before_next_change) {
+			responses_before_next_change--;
+			return false;
+		}
+
+		double commands_queued = (smoothed_rtt > 0 ? command.in_flight*(1 - base_rtt/smoothed_rtt) : 0);
+		size_t new_depth = depth;
+		if (commands_queued < MIN_COMMANDS_QUEUED && command.in_flight >= depth) {
+			// only grow if we were actually using the depth we had, otherwise we were limited by the work available
+			new_depth = std::min(depth + 1, maximum_depth);
+		} else if (commands_queued > MAX_COMMANDS_QUEUED) {
+			new_depth = std::max(depth - 1, DEFAULT_MIN_COMMANDS_TO_PIPELINE);
+		}
+		if (new_depth == depth) return false;
+
+		depth = new_depth;
+		responses_before_next_change = outstanding();
+		return true;
+	}
+
+	// an estimate of the bandwidth-delay product, for logging
+	inline double bandwidth_delay_product() const {
+		return smoothed_bytes_per_second*base_rtt;
+	}
+
+	size_t maximum_depth;
+	size_t depth;
+	double base_rtt;
+	double smoothed_rtt;
+	double smoothed_bytes_per_second;
+	std::deque<CommandSent> commands;
+	size_t command_bytes_outstanding;
+	size_t responses_before_next_change;
+	size_t last_bytes_written;
+	size_t last_bytes_read;
+	double last_response_time;
+};
+
+#endif
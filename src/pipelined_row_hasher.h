@@ -0,0 +1,130 @@
+#ifndef PIPELINED_ROW_HASHER_H
+#define PIPELINED_ROW_HASHER_H
+
+#include <thread>
+#include "row_serialization.h"
+#include "spsc_ring.h"
+
+struct HashChunk {
+	string data;
+	vector<size_t> row_ends; // only needed for the commutative algorithms, which hash each row separately
+};
+
+// a drop-in replacement for RowHasher that overlaps retrieving rows from the database and hashing them.
+// the thread running the query decodes and packs each row into a chunk buffer as before, but full chunks are
+// handed off through a lock-free ring to a second thread that runs the hash function over them, so neither
+// the database client nor the hash function has to wait for the other.
+//
+// small ranges (the common case when we're homing in on a difference) never fill a chunk, so they're
+// hashed in finish() on the calling thread without ever starting the second thread.
+struct PipelinedRowHasher {
+	static const size_t BYTES_PER_CHUNK = 64*1024; // arbitrary, large enough that handing off chunks is negligible
+	static const size_t CHUNKS_IN_RING = 8;        // also arbitrary, enough to absorb variation in row retrieval times
+
+	PipelinedRowHasher(HashAlgorithm hash_algorithm): hasher(hash_algorithm), commutative(hash_algorithm_commutative(hash_algorithm)), size(0), row_packer(*this), producer_finished(false) {
+	}
+
+	~PipelinedRowHasher() {
+		// normally already stopped by finish(), but we may be unwinding after an error retrieving the rows
+		stop_hash_thread();
+	}
+
+	// forbid copying, since the row packer and the hash thread refer back to this object
+	PipelinedRowHasher(const PipelinedRowHasher &_) = delete;
+	PipelinedRowHasher &operator=(const PipelinedRowHasher &_) = delete;
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		row.pack_row_into(row_packer);
+		if (commutative) chunk.row_ends.push_back(chunk.data.size());
+
+		// chunks always end at the end of a row
+		if (chunk.data.size() >= BYTES_PER_CHUNK) {
+			hand_off_chunk();
+		}
+	}
+
+	inline void write(const uint8_t *buf, size_t bytes) {
+		size += bytes;
+		chunk.data.append((const char *)buf, bytes);
+	}
+
+	const Hash &finish() {
+		if (hash_thread.joinable()) {
+			if (!chunk.data.empty()) hand_off_chunk();
+			stop_hash_thread();
+		} else {
+			hash_chunk(chunk);
+		}
+		return hasher.finish();
+	}
+
+	void hash_chunk(HashChunk &chunk_to_hash) {
+		const uint8_t *data = (const uint8_t *)chunk_to_hash.data.data();
+		if (commutative) {
+			size_t row_start = 0;
+			for (size_t row_end : chunk_to_hash.row_ends) {
+				hasher.write_row(data + row_start, row_end - row_start);
+				row_start = row_end;
+			}
+		} else {
+			hasher.write(data, chunk_to_hash.data.size());
+		}
+		chunk_to_hash.data.clear();
+		chunk_to_hash.row_ends.clear();
+	}
+
+	void hand_off_chunk() {
+		if (!hash_thread.joinable()) {
+			hash_thread = std::thread(&PipelinedRowHasher::hash_chunks, this);
+		}
+		// we get back the buffers that were last in that slot, which have already been hashed and cleared
+		ring.push(chunk);
+	}
+
+	void stop_hash_thread() {
+		if (hash_thread.joinable()) {
+			producer_finished.store(true, std::memory_order_release);
+			hash_thread.join();
+		}
+	}
+
+	void hash_chunks() {
+		HashChunk hashing;
+		size_t attempts = 0;
+		while (true) {
+			// check the flag before the ring, so that if it's set we know every chunk has already been pushed
+			bool finished = producer_finished.load(std::memory_order_acquire);
+			if (ring.try_pop(hashing)) {
+				hash_chunk(hashing);
+				attempts = 0;
+			} else if (finished) {
+				return;
+			} else {
+				ring.wait_a_moment(attempts++);
+			}
+		}
+	}
+
+	RowHasher hasher; // only used by the hash thread while it's running
+	bool commutative;
+	size_t size;
+	Packer<PipelinedRowHasher> row_packer;
+	HashChunk chunk;
+	SPSCRing<HashChunk, CHUNKS_IN_RING> ring;
+	std::atomic<bool> producer_finished;
+	std::thread hash_thread;
+};
+
+struct PipelinedRowHasherAndLastKey: PipelinedRowHasher, RowLastKey {
+	PipelinedRowHasherAndLastKey(HashAlgorithm hash_algorithm, const vector<size_t> &primary_key_columns): PipelinedRowHasher(hash_algorithm), RowLastKey(primary_key_columns) {
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		PipelinedRowHasher::operator()(row);
+		RowLastKey::operator()(row);
+	}
+};
+
+#endif
@@ -2,9 +2,16 @@
 #define PROTOCOL_VERSIONS_H
 
 const int EARLIEST_PROTOCOL_VERSION_SUPPORTED = 7;
-const int LATEST_PROTOCOL_VERSION_SUPPORTED = 8;
+const int LATEST_PROTOCOL_VERSION_SUPPORTED = 15;
 
 const int LAST_FILTERS_AFTER_SNAPSHOT_PROTOCOL_VERSION = 7;
 const int LAST_LEGACY_SCHEMA_FORMAT_VERSION = 7;
+const int LAST_UNCOMPRESSED_PROTOCOL_VERSION = 8;
+const int LAST_SINGLE_RANGE_HASH_PROTOCOL_VERSION = 9;
+const int LAST_NO_HASH_TREE_PROTOCOL_VERSION = 10;
+const int LAST_ROW_ORIENTED_PROTOCOL_VERSION = 11;
+const int LAST_NO_ROW_HASHES_PROTOCOL_VERSION = 12;
+const int LAST_NO_HASH_IN_DATABASE_PROTOCOL_VERSION = 13;
+const int LAST_NO_TABLE_SIZES_PROTOCOL_VERSION = 14;
 
 #endif
@@ -35,4 +35,76 @@ size_t retrieve_rows(DatabaseClient &client, RowReceiver &row_receiver, const Ta
 	return client.query(retrieve_rows_sql(client, table, prev_key, last_key, row_count), row_receiver);
 }
 
+template <typename DatabaseClient>
+ColumnValues key_at_offset(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t offset) {
+	ValueCollector receiver;
+	client.query(select_key_at_offset_sql(client, table, prev_key, last_key, offset), receiver);
+	return receiver.values;
+}
+
+struct DatabaseHashCollector {
+	DatabaseHashCollector(): row_count(0), size(0) {}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		row_count = row.uint_at(0);
+		hash = row.string_at(1);
+		size = row.uint_at(2);
+	}
+
+	size_t row_count;
+	string hash;
+	size_t size;
+};
+
+template <typename DatabaseClient, typename RowReceiver>
+size_t retrieve_rows_in_any_order(DatabaseClient &client, RowReceiver &row_receiver, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+	return client.query(retrieve_rows_in_any_order_sql(client, table, prev_key, last_key), row_receiver);
+}
+
+template <typename DatabaseClient, typename RowReceiver>
+size_t retrieve_rows_in_leaves(DatabaseClient &client, RowReceiver &row_receiver, const Table &table, const ColumnValues &prev_key, const vector<ColumnValues> &leaf_last_keys, bool ordered) {
+	return client.query(retrieve_rows_in_leaves_sql(client, table, prev_key, leaf_last_keys, ordered), row_receiver);
+}
+
+template <typename DatabaseClient>
+DatabaseHashCollector hash_rows_in_database(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+	DatabaseHashCollector receiver;
+	client.query(hash_rows_in_database_sql(client, table, prev_key, last_key, row_count), receiver);
+	return receiver;
+}
+
+// collects the results of the database clients' table modification marker queries; see hash_cache.h
+struct TableModificationMarkerCollector {
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		markers[row.string_at(0)] = (row.null_at(1) ? string() : row.string_at(1));
+	}
+
+	map<string, string> markers;
+};
+
+struct TableSizeCollector {
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		sizes[row.string_at(0)] = (row.null_at(1) ? 0 : row.uint_at(1));
+	}
+
+	map<string, size_t> sizes;
+};
+
+struct HistogramBoundsCollector {
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		if (!row.null_at(0)) bounds.push_back(row.string_at(0));
+	}
+
+	vector<string> bounds;
+};
+
+template <typename DatabaseClient, typename RowReceiver>
+size_t retrieve_rows_by_keys(DatabaseClient &client, RowReceiver &row_receiver, const Table &table, const vector<ColumnValues> &keys) {
+	return client.query(retrieve_rows_by_keys_sql(client, table, keys), row_receiver);
+}
+
 #endif
@@ -0,0 +1,121 @@
+#ifndef ROW_FINGERPRINTS_H
+#define ROW_FINGERPRINTS_H
+
+#include <list>
+#include <map>
+#include "command.h"
+#include "schema.h"
+#include "row_serialization.h"
+#include "defaults.h"
+
+// when a range that doesn't match is small enough that we'd retrieve it, we first exchange a fingerprint (the
+// XXH64 hash of the packed row) for each row in it using the ROW_HASHES command, and then retrieve only the rows
+// whose fingerprints differ using the ROWS_BY_KEYS command.  this saves sending all the rows that did match.
+struct RowFingerprint {
+	ColumnValues key;
+	uint64_t hash;
+};
+
+struct RowFingerprinter {
+	RowFingerprinter(): row_packer(*this) {}
+
+	template <typename DatabaseRow>
+	inline uint64_t operator()(const DatabaseRow &row) {
+		XXH64_reset(&xxh64_state, 0);
+		row.pack_row_into(row_packer);
+		return XXH64_digest(&xxh64_state);
+	}
+
+	inline void write(const uint8_t *buf, size_t bytes) {
+		XXH64_update(&xxh64_state, buf, bytes);
+	}
+
+	XXH64_state_t xxh64_state;
+	Packer<RowFingerprinter> row_packer;
+};
+
+// sends an array [key, fingerprint] for each row
+template <typename OutputStream>
+struct RowFingerprintPacker: RowLastKey {
+	RowFingerprintPacker(Packer<OutputStream> &packer, const vector<size_t> &primary_key_columns): RowLastKey(primary_key_columns), packer(packer) {
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		RowLastKey::operator()(row);
+		send_array(packer, last_key, fingerprinter(row));
+	}
+
+	Packer<OutputStream> &packer;
+	RowFingerprinter fingerprinter;
+};
+
+struct RowFingerprintCollector: RowLastKey {
+	RowFingerprintCollector(const vector<size_t> &primary_key_columns): RowLastKey(primary_key_columns) {
+	}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		RowLastKey::operator()(row);
+		fingerprints.push_back(RowFingerprint{last_key, fingerprinter(row)});
+	}
+
+	RowFingerprinter fingerprinter;
+	vector<RowFingerprint> fingerprints;
+};
+
+template <typename InputStream>
+void read_row_fingerprints(Unpacker<InputStream> &input, vector<RowFingerprint> &fingerprints) {
+	while (size_t array_length = input.next_array_length()) {
+		if (array_length != 2) throw command_error("Expected 2 arguments, got " + to_string(array_length));
+		fingerprints.emplace_back();
+		read_values(input, fingerprints.back().key, fingerprints.back().hash);
+	}
+}
+
+// returns the keys of the rows that are missing from either end or have different fingerprints.  note that we
+// can't simply merge the two lists, since the database's key order isn't the same as the order of the packed values.
+inline vector<ColumnValues> keys_of_changed_rows(const vector<RowFingerprint> &ours, const vector<RowFingerprint> &theirs) {
+	map<ColumnValues, uint64_t> their_hashes;
+	for (const RowFingerprint &their_row : theirs) {
+		their_hashes[their_row.key] = their_row.hash;
+	}
+
+	vector<ColumnValues> result;
+	for (const RowFingerprint &our_row : ours) {
+		auto their_row = their_hashes.find(our_row.key);
+		if (their_row == their_hashes.end()) {
+			result.push_back(our_row.key);
+		} else {
+			if (their_row->second != our_row.hash) result.push_back(our_row.key);
+			their_hashes.erase(their_row);
+		}
+	}
+	for (const auto &their_row : their_hashes) {
+		result.push_back(their_row.first);
+	}
+	return result;
+}
+
+// splits the keys into batches to retrieve using ROWS_BY_KEYS commands.  we limit the bytes as well as the number of
+// keys, since long keys would otherwise make commands too big to pipeline safely; a key too big to fit on its own
+// still has to be sent, but goes in a batch by itself.
+inline void batch_keys_to_retrieve(vector<ColumnValues> &&keys, list<vector<ColumnValues>> &batches, size_t max_keys = DEFAULT_MAX_KEYS_TO_RETRIEVE_AT_ONCE, size_t max_bytes = DEFAULT_MAX_KEY_BYTES_TO_RETRIEVE_AT_ONCE) {
+	size_t start = 0;
+	while (start < keys.size()) {
+		size_t end = start, batch_bytes = 0;
+		while (end < keys.size() && end - start < max_keys) {
+			size_t key_bytes = 0;
+			for (const PackedValue &value : keys[end]) {
+				key_bytes += value.encoded_size();
+			}
+			if (end > start && batch_bytes + key_bytes > max_bytes) break;
+			batch_bytes += key_bytes;
+			end++;
+		}
+		batches.emplace_back(make_move_iterator(keys.begin() + start), make_move_iterator(keys.begin() + end));
+		start = end;
+	}
+}
+
+#endif
@@ -1,16 +1,27 @@
 #ifndef ROW_RANGE_APPLIER_H
 #define ROW_RANGE_APPLIER_H
 
+#include <unordered_map>
+#include "query_functions.h"
 #include "row_replacer.h"
-
+#include "columnar_rows.h"
+#include "xxHash/xxhash.h"
+
+// applies the rows received in a ROWS response, comparing them to the rows in the same range of the database.
+//
+// both ends give us the rows in primary key order, so this is essentially a merge join: normally each database row
+// matches the next source row we haven't matched yet, or one a few rows later if there are new rows at the other
+// end.  but we can't compare the keys themselves to tell which comes first, since the two databases may not
+// collate them the same way, so if we don't find the matching row nearby we look it up in a hash index of the
+// buffered source rows, which we only build if we need it.
 template <typename DatabaseClient>
 struct RowRangeApplier {
 	static const size_t MAX_BYTES_TO_BUFFER = 16*1024*1024; // no particular rationale for this value - just large enough that it isn't usually the deciding factor in when we apply statements
 	static const size_t MAX_ROWS_TO_SELECT = 10000; // also somewhat arbitrary, but because we can't send DELETE statements while we are still receiving the results of a SELECT query on the same connection, this can effectively determine how many IDs we list in a single DELETE statement
 	static const size_t MAX_SENSIBLE_INSERT_STATEMENT_SIZE = 4*1024*1024;
 	static const size_t MAX_SENSIBLE_DELETE_STATEMENT_SIZE =     16*1024;
-
-	typedef map<ColumnValues, PackedRow> RowsByPrimaryKey;
+	static const size_t ROWS_TO_LOOK_AHEAD = 16; // arbitrary, enough to skip short runs of new rows without using the index
+	static const size_t NOT_FOUND = (size_t)-1;
 
 	RowRangeApplier(RowReplacer<DatabaseClient> &replacer, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key):
 		replacer(replacer),
@@ -19,21 +30,23 @@ struct RowRangeApplier {
 		prev_key(prev_key),
 		curr_key(prev_key),
 		last_key(last_key),
+		next_source_row(0),
+		rows_indexed(0),
 		approx_buffered_bytes(0) {
 	}
 
 	template <typename InputStream>
-	void stream_from_input(Unpacker<InputStream> &input) {
+	void stream_from_input(Unpacker<InputStream> &input, bool columnar) {
+		RowStreamReader<InputStream> reader(input, columnar);
 		PackedRow row;
 
 		while (true) {
 			// in the KS protocol command responses are a series of arrays, terminated by an empty array.
 			// this avoids having to determine the number of results in advance; an empty array is not a
 			// valid database row, so it's unambiguous.
-			input >> row;
-			if (row.size() == 0) break;
+			if (!reader.next(row)) break;
 
-			received_source_row(row);
+			received_source_row(move(row));
 		}
 
 		received_all_source_rows();
@@ -48,9 +61,31 @@ struct RowRangeApplier {
 		return primary_key;
 	}
 
-	void received_source_row(const PackedRow &row) {
-		curr_key = primary_key_of(row);
-		source_rows[curr_key] = row;
+	inline bool same_primary_key(const PackedRow &source_row, const PackedRow &database_row) {
+		if (source_row.empty()) return false; // already matched, see below
+		for (size_t column_number : table.primary_key_columns) {
+			if (source_row[column_number] != database_row[column_number]) return false;
+		}
+		return true;
+	}
+
+	uint64_t hash_primary_key(const PackedRow &row) {
+		uint64_t hash = 0;
+		for (size_t column_number : table.primary_key_columns) {
+			hash = XXH64(row[column_number].data(), row[column_number].encoded_size(), hash);
+		}
+		return hash;
+	}
+
+	inline void received_source_row(const PackedRow &row) {
+		received_source_row(PackedRow(row));
+	}
+
+	void received_source_row(PackedRow &&row) {
+		for (const PackedValue &value : row) {
+			approx_buffered_bytes += value.encoded_size();
+		}
+		source_rows.push_back(move(row));
 
 		// if the other end is sending a large set of data (for example, the entire remainder of the
 		// table), we need to periodically apply the data received so far rather than buffering up
@@ -58,9 +93,6 @@ struct RowRangeApplier {
 		// mostly avoided this particular problem, but we still had trouble in the case where the
 		// source dataset had deleted a large range that was still present on the local end; this
 		// way around requires fewer special cases.
-		for (const PackedValue &value : row) {
-			approx_buffered_bytes += value.encoded_size();
-		}
 		if (approx_buffered_bytes > MAX_BYTES_TO_BUFFER) {
 			check_rows_to_curr_key();
 			insert_remaining_rows();
@@ -68,6 +100,8 @@ struct RowRangeApplier {
 	}
 
 	void received_all_source_rows() {
+		if (!source_rows.empty()) curr_key = primary_key_of(source_rows.back());
+
 		// clear any rows after the last entry we should have in the table (within the range we are
 		// processing, which may or may not go to the end of the table); this is an optimisation, as
 		// the retrieve_rows callback would do the same thing for each extra row found.
@@ -84,45 +118,72 @@ struct RowRangeApplier {
 	}
 
 	void check_rows_to_curr_key() {
+		if (!source_rows.empty()) curr_key = primary_key_of(source_rows.back());
+
 		// we select in batches to avoid large buffering in clients that can't turn buffering off; and in those
 		// that can, we also need to execute DML periodically (but can't do that while SELECT is returning results)
 		while (retrieve_rows(client, *this, table, prev_key, curr_key, MAX_ROWS_TO_SELECT) == MAX_ROWS_TO_SELECT) {
+			prev_key = primary_key_of(database_row); // the last row retrieved
 			if (need_to_apply()) replacer.apply();
 		}
 		if (need_to_apply()) replacer.apply();
-		prev_key = curr_key; // prev_key is iteratively updated in operator() to serve the loop above, but we may not have had the curr_key row locally
+		prev_key = curr_key; // we may not have had the curr_key row locally
 	}
 
-	void operator()(const typename DatabaseClient::RowType &database_row) {
-		PackedRow row;
-		database_row.pack_row_into(row);
-		prev_key = primary_key_of(row);
+	size_t find_source_row(const PackedRow &row) {
+		for (size_t n = next_source_row; n < source_rows.size() && n < next_source_row + ROWS_TO_LOOK_AHEAD; n++) {
+			if (same_primary_key(source_rows[n], row)) {
+				next_source_row = n + 1;
+				return n;
+			}
+		}
 
-		RowsByPrimaryKey::iterator source_row = source_rows.find(prev_key);
+		// not nearby, so index any rows we haven't yet and look it up
+		for (; rows_indexed < source_rows.size(); rows_indexed++) {
+			source_row_index.insert(make_pair(hash_primary_key(source_rows[rows_indexed]), rows_indexed));
+		}
+		auto range = source_row_index.equal_range(hash_primary_key(row));
+		for (auto entry = range.first; entry != range.second; ++entry) {
+			if (same_primary_key(source_rows[entry->second], row)) {
+				if (entry->second >= next_source_row) next_source_row = entry->second + 1;
+				return entry->second;
+			}
+		}
+		return NOT_FOUND;
+	}
 
-		if (source_row == source_rows.end()) {
-			// we have a row that we shouldn't have, so we need to remove it
-			replacer.remove_row(row);
+	void operator()(const typename DatabaseClient::RowType &row) {
+		database_row.clear();
+		row.pack_row_into(database_row);
 
-		} else if (source_row->second != row) {
-			// we do have the row at both ends, but it's changed, so we need to replace it
-			replacer.replace_row(source_row->second);
+		size_t source_row = find_source_row(database_row);
 
-			// done with this row, don't need to insert it in insert_remaining_rows
-			source_rows.erase(source_row);
+		if (source_row == NOT_FOUND) {
+			// we have a row that we shouldn't have, so we need to remove it
+			replacer.remove_row(database_row);
 
 		} else {
-			// the row matches; done with this row, don't need to insert it in insert_remaining_rows
-			source_rows.erase(source_row);
+			if (source_rows[source_row] != database_row) {
+				// we do have the row at both ends, but it's changed, so we need to replace it
+				replacer.replace_row(source_rows[source_row], database_row);
+			}
+
+			// done with this row, don't need to insert it in insert_remaining_rows; an empty row can't be a
+			// real row, so we use that to mark it
+			source_rows[source_row].clear();
 		}
 	}
 
 	void insert_remaining_rows() {
-		for (RowsByPrimaryKey::iterator source_row = source_rows.begin(); source_row != source_rows.end(); ++source_row) {
-			replacer.insert_row(source_row->second);
+		for (const PackedRow &source_row : source_rows) {
+			if (source_row.empty()) continue;
+			replacer.insert_row(source_row);
 			if (need_to_apply()) replacer.apply();
 		}
 		source_rows.clear();
+		source_row_index.clear();
+		next_source_row = 0;
+		rows_indexed = 0;
 		approx_buffered_bytes = 0;
 	}
 
@@ -133,9 +194,9 @@ struct RowRangeApplier {
 		// execute another statement while one is already running, because we turn off database
 		// client row buffering for efficiency.
 
-		if (replacer.insert_sql.curr.size() > MAX_SENSIBLE_INSERT_STATEMENT_SIZE) return true;
+		if (replacer.bytes_to_insert() > MAX_SENSIBLE_INSERT_STATEMENT_SIZE) return true;
 
-		for (auto unique_key_clearer : replacer.unique_key_clearers) {
+		for (const auto &unique_key_clearer : replacer.unique_key_clearers) {
 			if (unique_key_clearer.delete_sql.curr.size() > MAX_SENSIBLE_DELETE_STATEMENT_SIZE) return true;
 		}
 
@@ -148,41 +209,109 @@ struct RowRangeApplier {
 	ColumnValues prev_key;
 	ColumnValues curr_key;
 	ColumnValues last_key;
-	RowsByPrimaryKey source_rows;
+	vector<PackedRow> source_rows;
+	size_t next_source_row;
+	unordered_multimap<uint64_t, size_t> source_row_index;
+	size_t rows_indexed;
+	PackedRow database_row;
 	size_t approx_buffered_bytes;
 };
 
+// applies the rows received in a ROWS_BY_KEYS response.  each row received replaces any existing row with the
+// same key, and the keys requested that weren't sent back no longer exist at the other end, so are removed.
+template <typename DatabaseClient>
+struct RowKeysApplier {
+	static const size_t MAX_SENSIBLE_INSERT_STATEMENT_SIZE = 4*1024*1024;
+	static const size_t MAX_SENSIBLE_DELETE_STATEMENT_SIZE =     16*1024;
+
+	RowKeysApplier(RowReplacer<DatabaseClient> &replacer, const Table &table, const vector<ColumnValues> &keys):
+		replacer(replacer),
+		table(table),
+		keys_not_received(keys.begin(), keys.end()) {
+	}
+
+	void received_source_row(const PackedRow &row) {
+		ColumnValues primary_key;
+		primary_key.reserve(table.primary_key_columns.size());
+		for (size_t column_number : table.primary_key_columns) {
+			primary_key.push_back(row[column_number]);
+		}
+		keys_not_received.erase(primary_key);
+
+		replacer.replace_row(row);
+		if (need_to_apply()) replacer.apply();
+	}
+
+	void received_all_source_rows() {
+		for (const ColumnValues &key : keys_not_received) {
+			// remove_row only looks at the primary key columns, so we don't need to retrieve the rest of the row
+			PackedRow row(table.columns.size());
+			for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+				row[table.primary_key_columns[n]] = key[n];
+			}
+			replacer.remove_row(row);
+			if (need_to_apply()) replacer.apply();
+		}
+		keys_not_received.clear();
+	}
+
+	bool need_to_apply() {
+		// as for RowRangeApplier
+		if (replacer.bytes_to_insert() > MAX_SENSIBLE_INSERT_STATEMENT_SIZE) return true;
+
+		for (const auto &unique_key_clearer : replacer.unique_key_clearers) {
+			if (unique_key_clearer.delete_sql.curr.size() > MAX_SENSIBLE_DELETE_STATEMENT_SIZE) return true;
+		}
+
+		return false;
+	}
+
+	RowReplacer<DatabaseClient> &replacer;
+	const Table &table;
+	set<ColumnValues> keys_not_received;
+};
+
 // special-case version of RowRangeApplier that simply inserts all the received rows without comparing
 // them to the current database (because the caller knows that there are no comparable rows in the database)
 template <typename DatabaseClient>
 struct RowInserter {
 	static const size_t MAX_SENSIBLE_INSERT_STATEMENT_SIZE = 4*1024*1024;
 
-	RowInserter(RowReplacer<DatabaseClient> &replacer, const Table &table):
+	RowInserter(RowReplacer<DatabaseClient> &replacer, const Table &table, bool into_empty_table = false):
 		replacer(replacer),
-		table(table) {
+		table(table),
+		into_empty_table(into_empty_table) {
 	}
 
 	template <typename InputStream>
-	void stream_from_input(Unpacker<InputStream> &input) {
+	void stream_from_input(Unpacker<InputStream> &input, bool columnar) {
+		RowStreamReader<InputStream> reader(input, columnar);
 		PackedRow row;
 
 		while (true) {
 			// in the KS protocol command responses are a series of arrays, terminated by an empty array.
 			// this avoids having to determine the number of results in advance; an empty array is not a
 			// valid database row, so it's unambiguous.
-			input >> row;
-			if (row.size() == 0) break;
+			if (!reader.next(row)) break;
+
+			received_source_row(row);
+		}
+	}
 
+	void received_source_row(const PackedRow &row) {
+		if (into_empty_table) {
+			replacer.insert_row_into_empty_table(row);
+		} else {
 			replacer.insert_row(row);
-			if (replacer.insert_sql.curr.size() > MAX_SENSIBLE_INSERT_STATEMENT_SIZE) {
-				replacer.apply();
-			}
+		}
+		if (replacer.bytes_to_insert() > MAX_SENSIBLE_INSERT_STATEMENT_SIZE) {
+			replacer.apply();
 		}
 	}
 
 	RowReplacer<DatabaseClient> &replacer;
 	const Table &table;
+	bool into_empty_table;
 };
 
 #endif
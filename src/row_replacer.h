@@ -1,10 +1,12 @@
 #ifndef SQL_ROW_REPLACER
 #define SQL_ROW_REPLACER
 
+#include <algorithm>
 #include <functional>
 
 #include "database_client_traits.h"
 #include "sql_functions.h"
+#include "statement_parameters.h"
 #include "unique_key_clearer.h"
 
 template <typename DatabaseClient>
@@ -18,6 +20,100 @@ void append_row_tuple(DatabaseClient &client, const Columns &columns, BaseSQL &s
 	}
 }
 
+// batches up rows to insert using a multi-row INSERT statement with the values given as SQL literals
+template <typename DatabaseClient, bool = is_base_of<SupportsStatementParameters, DatabaseClient>::value>
+struct InsertStatement {
+	InsertStatement(const Table &, const string &prefix, const string &suffix):
+		sql(prefix, suffix) {
+	}
+
+	inline void add_row(DatabaseClient &client, const Columns &columns, const PackedRow &row) {
+		append_row_tuple(client, columns, sql, row);
+	}
+
+	inline size_t size() const {
+		return sql.curr.size();
+	}
+
+	inline void apply(DatabaseClient &client) {
+		sql.apply(client);
+	}
+
+	BaseSQL sql;
+};
+
+// batches up rows to insert using multi-row INSERT statements with the values given as statement parameters,
+// which saves escaping the values and the database parsing them out of the statement again.  the statements
+// for full batches of rows are prepared, so that the database can reuse them for each batch in the table.
+template <typename DatabaseClient>
+struct InsertStatement<DatabaseClient, true> {
+	static const size_t MAX_PARAMETERS_PER_STATEMENT = 65535; // PostgreSQL's protocol limit
+	static const size_t MAX_ROWS_PER_STATEMENT = 1000; // arbitrary, large enough that per-statement overhead is negligible
+
+	InsertStatement(const Table &table, const string &prefix, const string &suffix):
+		table(table),
+		prefix(prefix),
+		suffix(suffix),
+		rows(0),
+		parameters_per_row(0) {
+	}
+
+	inline void add_row(DatabaseClient &client, const Columns &columns, const PackedRow &row) {
+		client.append_statement_parameters_to(parameters, columns, row);
+		parameters_per_row = row.size();
+		rows++;
+	}
+
+	inline size_t size() const {
+		return parameters.data.size();
+	}
+
+	void apply(DatabaseClient &client) {
+		if (!rows) return;
+
+		size_t rows_per_statement = MAX_PARAMETERS_PER_STATEMENT/parameters_per_row;
+		if (rows_per_statement > MAX_ROWS_PER_STATEMENT) rows_per_statement = MAX_ROWS_PER_STATEMENT;
+		size_t rows_applied = 0;
+
+		if (rows >= rows_per_statement) {
+			if (full_batch_sql.empty()) full_batch_sql = statement_sql(client, rows_per_statement);
+			for (; rows - rows_applied >= rows_per_statement; rows_applied += rows_per_statement) {
+				client.execute(full_batch_sql, parameters, rows_applied*parameters_per_row, rows_per_statement*parameters_per_row, true /* prepare */);
+			}
+		}
+
+		if (rows_applied < rows) {
+			// the last batch is usually a different size each time, so isn't worth preparing
+			client.execute(statement_sql(client, rows - rows_applied), parameters, rows_applied*parameters_per_row, (rows - rows_applied)*parameters_per_row, false);
+		}
+
+		parameters.clear();
+		rows = 0;
+	}
+
+	string statement_sql(DatabaseClient &client, size_t rows_in_statement) {
+		string result(prefix);
+		size_t parameter_number = 1;
+		for (size_t row = 0; row < rows_in_statement; row++) {
+			if (row > 0) result += "),\n(";
+			for (size_t column = 0; column < parameters_per_row; column++) {
+				if (column > 0) result += ',';
+				client.append_parameter_placeholder_to(result, table.columns[column], parameter_number++);
+			}
+		}
+		result += suffix;
+		return result;
+	}
+
+	const Table &table;
+	string prefix;
+	string suffix;
+	StatementParameters parameters;
+	size_t rows;
+	size_t parameters_per_row;
+	string full_batch_sql;
+};
+
 typedef std::function<void ()> ProgressCallback;
 
 template <typename DatabaseClient>
@@ -30,14 +126,23 @@ struct RowReplacerBuilder {
 			(client.supports_generated_as_identity() ? ") OVERRIDING SYSTEM VALUE VALUES\n(" : ") VALUES\n(");
 	}
 
-	static void construct_clearers(RowReplacer<DatabaseClient> &row_replacer) {
-		// databases that don't support the REPLACE statement must explicitly clear conflicting rows
-		for (const Key &key : row_replacer.table.keys) {
-			if (key.unique()) {
-				row_replacer.unique_key_clearers.emplace_back(row_replacer.client, row_replacer.table, key.columns);
-			}
+	static string upsert_sql_base(DatabaseClient &client, const Table &table) {
+		return insert_sql_base(client, table);
+	}
+
+	static string upsert_sql_suffix(DatabaseClient &client, const Table &table, const ColumnIndices &update_columns) {
+		string result(")\nON CONFLICT " + columns_tuple(client, table.columns, table.primary_key_columns) + " DO UPDATE SET ");
+		for (size_t column : update_columns) {
+			if (column != update_columns.front()) result += ", ";
+			result += client.quote_identifier(table.columns[column].name);
+			result += " = EXCLUDED.";
+			result += client.quote_identifier(table.columns[column].name);
 		}
+		return result;
+	}
 
+	static void construct_clearers(RowReplacer<DatabaseClient> &row_replacer) {
+		// databases that don't support the REPLACE statement must explicitly clear conflicting rows
 		row_replacer.replace_clearers_start = row_replacer.unique_key_clearers.begin();
 		row_replacer.insert_clearers_start = row_replacer.unique_key_clearers.begin() + 1;
 	}
@@ -49,6 +154,22 @@ struct RowReplacerBuilder<DatabaseClient, true> {
 		return "REPLACE INTO " + client.quote_identifier(table.name) + " (" + columns_list(client, table.columns) + ") VALUES\n(";
 	}
 
+	static string upsert_sql_base(DatabaseClient &client, const Table &table) {
+		return "INSERT INTO " + client.quote_identifier(table.name) + " (" + columns_list(client, table.columns) + ") VALUES\n(";
+	}
+
+	static string upsert_sql_suffix(DatabaseClient &client, const Table &table, const ColumnIndices &update_columns) {
+		string result(")\nON DUPLICATE KEY UPDATE ");
+		for (size_t column : update_columns) {
+			if (column != update_columns.front()) result += ", ";
+			result += client.quote_identifier(table.columns[column].name);
+			result += " = VALUES(";
+			result += client.quote_identifier(table.columns[column].name);
+			result += ')';
+		}
+		return result;
+	}
+
 	static void construct_clearers(RowReplacer<DatabaseClient> &row_replacer) {
 		// databases that support the REPLACE statement will clear any conflicting rows automatically
 		row_replacer.replace_clearers_start = row_replacer.unique_key_clearers.end();
@@ -56,20 +177,68 @@ struct RowReplacerBuilder<DatabaseClient, true> {
 	}
 };
 
+template <typename DatabaseClient, bool = is_base_of<SupportsBulkLoad, DatabaseClient>::value>
+struct RowBulkLoadBuilder {
+	static void append_row(RowReplacer<DatabaseClient> &row_replacer, const PackedRow &row) {
+		// databases that don't have a bulk load statement use the normal INSERT statement
+		row_replacer.insert_sql.add_row(row_replacer.client, row_replacer.table.columns, row);
+	}
+
+	static void apply(RowReplacer<DatabaseClient> &) {
+		// nothing to do, since the rows were added to the INSERT statement
+	}
+};
+
+template <typename DatabaseClient>
+struct RowBulkLoadBuilder<DatabaseClient, true> {
+	static void append_row(RowReplacer<DatabaseClient> &row_replacer, const PackedRow &row) {
+		row_replacer.client.append_bulk_load_row_to(row_replacer.bulk_load_data, row_replacer.table.columns, row);
+	}
+
+	static void apply(RowReplacer<DatabaseClient> &row_replacer) {
+		if (row_replacer.bulk_load_data.empty()) return;
+		row_replacer.client.bulk_load(row_replacer.table, row_replacer.bulk_load_data);
+		row_replacer.bulk_load_data.clear();
+	}
+};
+
 template <typename DatabaseClient>
 struct RowReplacer {
 	RowReplacer(DatabaseClient &client, const Table &table, bool commit_often, ProgressCallback progress_callback):
 		client(client),
 		table(table),
-		insert_sql(RowReplacerBuilder<DatabaseClient>::insert_sql_base(client, table), ")"),
+		insert_sql(table, RowReplacerBuilder<DatabaseClient>::insert_sql_base(client, table), ")"),
+		upsert_columns(columns_to_upsert(table)),
+		upsert_sql(table,
+		           upsert_columns.empty() ? "" : RowReplacerBuilder<DatabaseClient>::upsert_sql_base(client, table),
+		           upsert_columns.empty() ? "" : RowReplacerBuilder<DatabaseClient>::upsert_sql_suffix(client, table, upsert_columns)),
 		commit_often(commit_often),
 		progress_callback(progress_callback),
 		rows_changed(0) {
 		// set up the clearers we'll need to insert rows - these clear any conflicting values from elsewhere in the same table
 		unique_key_clearers.emplace_back(client, table, table.primary_key_columns);
+		for (const Key &key : table.keys) {
+			if (key.unique()) {
+				unique_key_clearers.emplace_back(client, table, key.columns);
+			}
+		}
 		RowReplacerBuilder<DatabaseClient>::construct_clearers(*this);
 	}
 
+	static ColumnIndices columns_to_upsert(const Table &table) {
+		// we can update rows in place if we can tell the database which columns to update when the primary key
+		// already exists.  we don't bother if there are none, and we can't update GENERATED ALWAYS identity columns.
+		ColumnIndices result;
+		if (table.primary_key_type == PrimaryKeyType::no_available_key) return result;
+		for (size_t column = 0; column < table.columns.size(); column++) {
+			if (find(table.primary_key_columns.begin(), table.primary_key_columns.end(), column) != table.primary_key_columns.end()) continue;
+			if (table.columns[column].default_type == DefaultType::generated_always_as_identity) return ColumnIndices();
+			if (table.columns[column].generated_always()) continue;
+			result.push_back(column);
+		}
+		return result;
+	}
+
 	inline void insert_row(const PackedRow &row) {
 		// before we can insert our rows we will also have to first clear any other rows with the
 		// same unique key values.
@@ -78,23 +247,70 @@ struct RowReplacer {
 		}
 
 		// we can then batch up a big INSERT statement
-		append_row_tuple(client, table.columns, insert_sql, row);
+		insert_sql.add_row(client, table.columns, row);
 
 		rows_changed++;
 	}
 
+	inline void insert_row_into_empty_table(const PackedRow &row) {
+		// if the table was empty to start with, there's nothing the rows could conflict with, so we don't need the
+		// clearers, and databases that have a bulk load statement can use that instead of INSERT statements
+		RowBulkLoadBuilder<DatabaseClient>::append_row(*this, row);
+
+		rows_changed++;
+	}
+
+	inline size_t bytes_to_insert() const {
+		return insert_sql.size() + upsert_sql.size() + bulk_load_data.size();
+	}
+
 	inline void replace_row(const PackedRow &row) {
-		// when we apply(), first we will delete existing rows - we do that rather than use UPDATE
-		// statements because you can't really batch UPDATE, whereas you can batch DELETE & INSERT.
-		for (auto unique_key_clearer = replace_clearers_start; unique_key_clearer != unique_key_clearers.end(); ++unique_key_clearer) {
-			unique_key_clearer->row(row);
+		if (!upsert_columns.empty()) {
+			// we don't know what the row's values were before, so we have to assume its unique keys may have changed
+			for (auto unique_key_clearer = unique_key_clearers.begin() + 1; unique_key_clearer != unique_key_clearers.end(); ++unique_key_clearer) {
+				unique_key_clearer->row(row);
+			}
+
+			upsert_sql.add_row(client, table.columns, row);
+
+		} else {
+			// when we apply(), first we will delete existing rows - we do that rather than use UPDATE
+			// statements because you can't really batch UPDATE, whereas you can batch DELETE & INSERT.
+			for (auto unique_key_clearer = replace_clearers_start; unique_key_clearer != unique_key_clearers.end(); ++unique_key_clearer) {
+				unique_key_clearer->row(row);
+			}
+
+			insert_sql.add_row(client, table.columns, row);
 		}
 
-		append_row_tuple(client, table.columns, insert_sql, row);
+		rows_changed++;
+	}
+
+	inline void replace_row(const PackedRow &row, const PackedRow &existing_row) {
+		if (upsert_columns.empty()) return replace_row(row);
+
+		// we update the row in place using an upsert statement, which unlike deleting and reinserting the row only
+		// touches the indexes whose columns have changed.  that can't resolve conflicts with the other unique keys,
+		// but we only need to clear those if the row's values for them have changed - if not, no other row can have
+		// the same values (and any rows that are changing to those values will clear this row themselves).
+		for (auto unique_key_clearer = unique_key_clearers.begin() + 1; unique_key_clearer != unique_key_clearers.end(); ++unique_key_clearer) {
+			if (key_values_changed(*unique_key_clearer->key_columns, row, existing_row)) {
+				unique_key_clearer->row(row);
+			}
+		}
+
+		upsert_sql.add_row(client, table.columns, row);
 
 		rows_changed++;
 	}
 
+	static bool key_values_changed(const ColumnIndices &key_columns, const PackedRow &row, const PackedRow &existing_row) {
+		for (size_t column : key_columns) {
+			if (row[column] != existing_row[column]) return true;
+		}
+		return false;
+	}
+
 	inline void remove_row(const PackedRow &row) {
 		unique_key_clearers.front().row(row);
 
@@ -106,7 +322,9 @@ struct RowReplacer {
 			unique_key_clearer.apply();
 		}
 
+		upsert_sql.apply(client);
 		insert_sql.apply(client);
+		RowBulkLoadBuilder<DatabaseClient>::apply(*this);
 
 		if (commit_often) {
 			client.commit_transaction();
@@ -120,7 +338,10 @@ struct RowReplacer {
 
 	DatabaseClient &client;
 	const Table &table;
-	BaseSQL insert_sql;
+	InsertStatement<DatabaseClient> insert_sql;
+	ColumnIndices upsert_columns;
+	InsertStatement<DatabaseClient> upsert_sql;
+	string bulk_load_data;
 	vector< UniqueKeyClearer<DatabaseClient> > unique_key_clearers;
 	typename vector< UniqueKeyClearer<DatabaseClient> >::iterator insert_clearers_start;
 	typename vector< UniqueKeyClearer<DatabaseClient> >::iterator replace_clearers_start;
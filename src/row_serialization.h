@@ -6,6 +6,10 @@
 	#include <CommonCrypto/CommonDigest.h>
 #else
 	#include <openssl/md5.h>
+	#include <openssl/evp.h>
+	// BLAKE3 would be faster, but neither OpenSSL nor CommonCrypto provide it, and without the platform-specific
+	// SIMD implementations that would have to be built alongside it, it loses most of its lead over BLAKE2b
+	#define HAVE_BLAKE2B
 #endif
 
 #define XXH_STATIC_LINKING_ONLY
@@ -42,7 +46,25 @@ struct RowPacker {
 	Packer<OutputStream> &packer;
 };
 
-#define MAX_DIGEST_LENGTH MD5_DIGEST_LENGTH
+inline bool hash_algorithm_supported(HashAlgorithm hash_algorithm) {
+	switch (hash_algorithm) {
+		case HashAlgorithm::md5:
+		case HashAlgorithm::xxh64:
+		case HashAlgorithm::xxh3_128:
+		case HashAlgorithm::xxh3_128_sum:
+			return true;
+
+#ifdef HAVE_BLAKE2B
+		case HashAlgorithm::blake2b:
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+#define MAX_DIGEST_LENGTH 64 /* BLAKE2b-512 */
 
 struct Hash {
 	inline Hash(): md_len(0) {}
@@ -86,12 +108,84 @@ struct RowHasher {
 			case HashAlgorithm::xxh64:
 				XXH64_reset(&xxh64_state, 0);
 				break;
+
+			case HashAlgorithm::xxh3_128:
+				// the XXH3 state needs stricter alignment than we can guarantee for this object, so let xxHash allocate it
+				xxh3_state = XXH3_createState();
+				if (!xxh3_state) throw bad_alloc();
+				XXH3_128bits_reset(xxh3_state);
+				break;
+
+			case HashAlgorithm::xxh3_128_sum:
+				xxh3_sum.low64 = xxh3_sum.high64 = 0;
+				break;
+
+#ifdef HAVE_BLAKE2B
+			case HashAlgorithm::blake2b:
+				evp_mdctx = EVP_MD_CTX_new();
+				if (!evp_mdctx) throw bad_alloc();
+				if (!EVP_DigestInit_ex(evp_mdctx, EVP_blake2b512(), nullptr)) {
+					EVP_MD_CTX_free(evp_mdctx);
+					throw runtime_error("Couldn't initialize BLAKE2b");
+				}
+				break;
+#endif
+
+			default:
+				throw runtime_error("Unsupported hash algorithm " + to_string(static_cast<int>(hash_algorithm)));
+		}
+	}
+
+	~RowHasher() {
+		switch (hash_algorithm) {
+			case HashAlgorithm::xxh3_128:
+				XXH3_freeState(xxh3_state);
+				break;
+
+#ifdef HAVE_BLAKE2B
+			case HashAlgorithm::blake2b:
+				EVP_MD_CTX_free(evp_mdctx);
+				break;
+#endif
+
+			default:
+				break;
 		}
 	}
 
+	// forbid copying, since the row packer refers back to this object
+	RowHasher(const RowHasher &_) = delete;
+	RowHasher &operator=(const RowHasher &_) = delete;
+
 	template <typename DatabaseRow>
 	inline void operator()(const DatabaseRow &row) {
 		row.pack_row_into(row_packer);
+		finish_row();
+	}
+
+	// must be called after writing each row, if not using operator(); only the commutative algorithms need to know
+	inline void finish_row() {
+		if (hash_algorithm == HashAlgorithm::xxh3_128_sum && !row_buffer.empty()) {
+			add_row_hash((const uint8_t *)row_buffer.data(), row_buffer.size());
+			row_buffer.clear();
+		}
+	}
+
+	// writes a complete packed row, avoiding buffering it again if using a commutative algorithm
+	inline void write_row(const uint8_t *buf, size_t bytes) {
+		if (hash_algorithm == HashAlgorithm::xxh3_128_sum) {
+			size += bytes;
+			add_row_hash(buf, bytes);
+		} else {
+			write(buf, bytes);
+		}
+	}
+
+	inline void add_row_hash(const uint8_t *buf, size_t bytes) {
+		// add the 128-bit hashes, carrying from the low half to the high half
+		XXH128_hash_t row_hash = XXH3_128bits(buf, bytes);
+		xxh3_sum.low64 += row_hash.low64;
+		xxh3_sum.high64 += row_hash.high64 + (xxh3_sum.low64 < row_hash.low64);
 	}
 
 	inline void write(const uint8_t *buf, size_t bytes) {
@@ -105,6 +199,23 @@ struct RowHasher {
 			case HashAlgorithm::xxh64:
 				XXH64_update(&xxh64_state, buf, bytes);
 				break;
+
+			case HashAlgorithm::xxh3_128:
+				XXH3_128bits_update(xxh3_state, buf, bytes);
+				break;
+
+			case HashAlgorithm::xxh3_128_sum:
+				row_buffer.append((const char *)buf, bytes);
+				break;
+
+#ifdef HAVE_BLAKE2B
+			case HashAlgorithm::blake2b:
+				EVP_DigestUpdate(evp_mdctx, buf, bytes);
+				break;
+#endif
+
+			default:
+				break;
 		}
 	}
 
@@ -113,6 +224,7 @@ struct RowHasher {
 			return hash;
 		}
 		finished = true;
+		finish_row();
 		switch (hash_algorithm) {
 			case HashAlgorithm::md5:
 				hash.md_len = MD5_DIGEST_LENGTH;
@@ -124,6 +236,23 @@ struct RowHasher {
 				hash.md_value_64 = htonll(XXH64_digest(&xxh64_state));
 				return hash;
 
+			case HashAlgorithm::xxh3_128:
+				// the canonical form is big-endian, high half first
+				hash.md_len = sizeof(XXH128_canonical_t);
+				XXH128_canonicalFromHash((XXH128_canonical_t *)hash.md_value, XXH3_128bits_digest(xxh3_state));
+				return hash;
+
+			case HashAlgorithm::xxh3_128_sum:
+				hash.md_len = sizeof(XXH128_canonical_t);
+				XXH128_canonicalFromHash((XXH128_canonical_t *)hash.md_value, xxh3_sum);
+				return hash;
+
+#ifdef HAVE_BLAKE2B
+			case HashAlgorithm::blake2b:
+				EVP_DigestFinal_ex(evp_mdctx, hash.md_value, &hash.md_len);
+				return hash;
+#endif
+
 			default:
 				// never hit, but silence compiler warning
 				return hash;
@@ -134,9 +263,15 @@ struct RowHasher {
 	union {
 		MD5_CTX mdctx;
 		XXH64_state_t xxh64_state;
+		XXH3_state_t *xxh3_state;
+		XXH128_hash_t xxh3_sum;
+#ifdef HAVE_BLAKE2B
+		EVP_MD_CTX *evp_mdctx;
+#endif
 	};
 	size_t size;
 	Packer<RowHasher> row_packer;
+	string row_buffer; // only used by the commutative algorithms
 	Hash hash;
 	bool finished;
 };
@@ -0,0 +1,55 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+
+// fixed-size lock-free queue for exactly one producer thread and one consumer thread.  values are swapped in
+// and out of the slots rather than copied, so buffers can be handed back and forth without reallocating.
+template <typename T, size_t Capacity>
+struct SPSCRing {
+	SPSCRing(): head(0), tail(0) {}
+
+	// swaps \value into the ring and returns true, or returns false if the ring is full
+	bool try_push(T &value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == Capacity) return false;
+		std::swap(slots[h % Capacity], value);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// swaps the oldest value out of the ring into \value and returns true, or returns false if the ring is empty
+	bool try_pop(T &value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) return false;
+		std::swap(value, slots[t % Capacity]);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	void push(T &value) {
+		for (size_t attempts = 0; !try_push(value); attempts++) {
+			wait_a_moment(attempts);
+		}
+	}
+
+	// used by both sides while waiting for the other; spins briefly, since the other side is normally only
+	// a moment away, but then sleeps so that we don't burn a core while waiting for the database
+	static inline void wait_a_moment(size_t attempts) {
+		if (attempts < 100) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+
+	std::atomic<size_t> head; // only written by the producer
+	char padding[64]; // keep the two indices on separate cache lines
+	std::atomic<size_t> tail; // only written by the consumer
+	T slots[Capacity];
+};
+
+#endif
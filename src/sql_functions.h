@@ -12,7 +12,7 @@ using namespace std;
 const string ASCENDING("ASC");
 const string DESCENDING("DESC");
 
-string quote_identifier(const string &name, char quote) {
+inline string quote_identifier(const string &name, char quote) {
 	string result = quote + name + quote;
 	for (size_t pos = 1; (pos = result.find(quote, pos)) != result.length() - 1; pos += 2) {
 		result.insert(pos, 1, quote);
@@ -79,7 +79,7 @@ string values_list(DatabaseClient &client, const Table &table, const ColumnValue
 	}
 
 	string result("(");
-	for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+	for (size_t n = 0; n < values.size(); n++) { // may be only the leading columns, see key_columns_tuple
 		if (n > 0) {
 			result += ',';
 		}
@@ -89,6 +89,37 @@ string values_list(DatabaseClient &client, const Table &table, const ColumnValue
 	return result;
 }
 
+// formats values for log and error messages.  unlike the database clients, this doesn't use the database connection
+// to escape the values, since it may be in use by another thread at the time (see AsyncRowApplier); the result is only
+// meant to be read, so binary values are simply given in hex.
+struct LogValueFormatter {
+	string &append_quoted_column_value_to(string &result, const Column &column, const string &value) {
+		if (!column.values_need_quoting()) return result += value;
+
+		if (column.column_type == ColumnType::binary || column.column_type == ColumnType::spatial) {
+			static const char hex_digits[] = "0123456789abcdef";
+			result += "X'";
+			for (unsigned char c : value) {
+				result += hex_digits[c >> 4];
+				result += hex_digits[c & 0xf];
+			}
+			return result += '\'';
+		}
+
+		result += '\'';
+		for (char c : value) {
+			if (c == '\'') result += '\'';
+			result += c;
+		}
+		return result += '\'';
+	}
+};
+
+inline string log_values_list(const Table &table, const ColumnValues &values) {
+	LogValueFormatter formatter;
+	return values_list(formatter, table, values);
+}
+
 template <typename DatabaseClient>
 string values_list(DatabaseClient &client, const vector<string> &values) {
 	if (values.empty()) {
@@ -106,6 +137,14 @@ string values_list(DatabaseClient &client, const vector<string> &values) {
 	return result;
 }
 
+// keys interpolated when subdividing composite primary keys may only give values for the leading columns, in which
+// case we compare just those columns
+template <typename DatabaseClient>
+inline string key_columns_tuple(DatabaseClient &client, const Table &table, const string &all_key_columns, const ColumnValues &key) {
+	if (key.size() >= table.primary_key_columns.size()) return all_key_columns;
+	return columns_tuple(client, table.columns, ColumnIndices(table.primary_key_columns.begin(), table.primary_key_columns.begin() + key.size()));
+}
+
 template <typename DatabaseClient>
 string where_sql(DatabaseClient &client, const Table &table, const char *op1, const ColumnValues &key1, const char *op2, const ColumnValues &key2, const char *op3, const ColumnValues &key3, const string &extra_where_conditions = "") {
 	const char *prefix = " WHERE ";
@@ -113,21 +152,21 @@ string where_sql(DatabaseClient &client, const Table &table, const char *op1, co
 	string result;
 	if (!key1.empty()) {
 		result += prefix;
-		result += key_columns;
+		result += key_columns_tuple(client, table, key_columns, key1);
 		result += op1;
 		result += values_list(client, table, key1);
 		prefix = " AND ";
 	}
 	if (!key2.empty()) {
 		result += prefix;
-		result += key_columns;
+		result += key_columns_tuple(client, table, key_columns, key2);
 		result += op2;
 		result += values_list(client, table, key2);
 		prefix = " AND ";
 	}
 	if (!key3.empty()) {
 		result += prefix;
-		result += key_columns;
+		result += key_columns_tuple(client, table, key_columns, key3);
 		result += op3;
 		result += values_list(client, table, key3);
 		prefix = " AND ";
@@ -177,6 +216,106 @@ string retrieve_rows_sql(DatabaseClient &client, const Table &table, const Colum
 	return result;
 }
 
+// for row receivers that don't depend on the order of the rows, such as the commutative hash algorithms; this
+// leaves the database free to use whichever plan is fastest, including parallel scans
+template <typename DatabaseClient>
+string retrieve_rows_in_any_order_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+	string result("SELECT ");
+	result += select_columns_sql(client, table);
+	result += " FROM ";
+	result += client.quote_identifier(table.name);
+	result += where_sql(client, table, prev_key, last_key, table.where_conditions);
+	return result;
+}
+
+// as retrieve_rows_sql, but with an extra last column giving the number of the leaf each row falls in, where each leaf
+// covers the rows after the previous leaf's last key up to and including its own last key, so that we can hash all the
+// leaves of a hash tree level in one pass over the range.  the order is only needed by the non-commutative hashes.
+template <typename DatabaseClient>
+string retrieve_rows_in_leaves_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const vector<ColumnValues> &leaf_last_keys, bool ordered) {
+	string key_columns(columns_tuple(client, table.columns, table.primary_key_columns));
+	string result("SELECT ");
+	result += select_columns_sql(client, table);
+	if (leaf_last_keys.size() == 1) {
+		result += ", 0";
+	} else {
+		result += ", CASE";
+		for (size_t leaf = 0; leaf < leaf_last_keys.size() - 1; leaf++) {
+			result += " WHEN ";
+			result += key_columns_tuple(client, table, key_columns, leaf_last_keys[leaf]);
+			result += " <= ";
+			result += values_list(client, table, leaf_last_keys[leaf]);
+			result += " THEN " + to_string(leaf);
+		}
+		result += " ELSE " + to_string(leaf_last_keys.size() - 1) + " END";
+	}
+	result += " FROM ";
+	result += client.quote_identifier(table.name);
+	result += where_sql(client, table, prev_key, leaf_last_keys.back(), table.where_conditions);
+	if (ordered) result += column_orders_list(client, table);
+	return result;
+}
+
+template <typename DatabaseClient>
+string retrieve_rows_by_keys_sql(DatabaseClient &client, const Table &table, const vector<ColumnValues> &keys) {
+	string result("SELECT ");
+	result += select_columns_sql(client, table);
+	result += " FROM ";
+	result += client.quote_identifier(table.name);
+	result += " WHERE ((";
+	for (size_t k = 0; k < keys.size(); k++) {
+		// as in UniqueKeyClearer, we use AND/OR repetition rather than WHERE (key columns) IN (tuples) since older
+		// versions of MySQL don't use the index for the latter
+		if (k > 0) {
+			result += ")\nOR (";
+		}
+		for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+			if (n > 0) {
+				result += " AND ";
+			}
+			const Column &column(table.columns[table.primary_key_columns[n]]);
+			result += client.quote_identifier(column.name);
+			result += '=';
+			sql_encode_and_append_packed_value_to(result, client, column, keys[k][n]);
+		}
+	}
+	result += "))";
+	if (!table.where_conditions.empty()) {
+		result += " AND (";
+		result += table.where_conditions;
+		result += ")";
+	}
+	result += column_orders_list(client, table);
+	return result;
+}
+
+// returns the number of rows, a digest of the rows, and the approximate size of the rows in the range, computed by
+// the database server itself using aggregate functions provided by the database client; see --hash-in-database
+template <typename DatabaseClient>
+string hash_rows_in_database_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+	string row_text(client.row_text_sql(table, "ks_hashed_rows"));
+	string result("SELECT COUNT(*), COALESCE(");
+	result += client.aggregate_hash_sql(table, row_text);
+	result += ", ''), COALESCE(SUM(LENGTH(";
+	result += row_text;
+	result += ")), 0) FROM (";
+	result += retrieve_rows_sql(client, table, prev_key, last_key, row_count);
+	result += ") AS ks_hashed_rows";
+	return result;
+}
+
+template <typename DatabaseClient>
+string select_key_at_offset_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t offset) {
+	string result("SELECT ");
+	result += columns_list(client, table.columns, table.primary_key_columns);
+	result += " FROM ";
+	result += client.quote_identifier(table.name);
+	result += where_sql(client, table, prev_key, last_key, table.where_conditions);
+	result += column_orders_list(client, table);
+	result += " LIMIT 1 OFFSET " + to_string(offset);
+	return result;
+}
+
 template <typename DatabaseClient>
 string count_rows_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
 	string result("SELECT COUNT(*) FROM ");
@@ -0,0 +1,54 @@
+#ifndef STATEMENT_PARAMETERS_H
+#define STATEMENT_PARAMETERS_H
+
+#include <string>
+#include <vector>
+
+// holds the values for the parameters of a statement, so that they can be sent to the database separately from
+// the statement text and don't need to be escaped and then parsed again.  the values are all kept in one buffer
+// to avoid allocating each one separately.  text-format values are null-terminated, as client libraries expect.
+struct StatementParameters {
+	enum { TEXT_FORMAT = 0, BINARY_FORMAT = 1 }; // as used by libpq
+
+	inline void add_null() {
+		offsets.push_back(std::string::npos);
+		lengths.push_back(0);
+		formats.push_back(TEXT_FORMAT);
+	}
+
+	// call after appending the value to data, passing the size of data beforehand
+	inline void add_text_from(size_t offset) {
+		offsets.push_back(offset);
+		lengths.push_back(data.size() - offset);
+		formats.push_back(TEXT_FORMAT);
+		data += '\0';
+	}
+
+	inline void add_binary_from(size_t offset) {
+		offsets.push_back(offset);
+		lengths.push_back(data.size() - offset);
+		formats.push_back(BINARY_FORMAT);
+	}
+
+	inline const char *value(size_t n) const {
+		return (offsets[n] == std::string::npos ? nullptr : data.data() + offsets[n]);
+	}
+
+	inline size_t size() const {
+		return offsets.size();
+	}
+
+	inline void clear() {
+		data.clear();
+		offsets.clear();
+		lengths.clear();
+		formats.clear();
+	}
+
+	std::string data;
+	std::vector<size_t> offsets;
+	std::vector<int> lengths;
+	std::vector<int> formats;
+};
+
+#endif
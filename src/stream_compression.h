@@ -0,0 +1,153 @@
+#ifndef STREAM_COMPRESSION_H
+#define STREAM_COMPRESSION_H
+
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include "compression_algorithm.h"
+
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
+
+struct compression_error: public std::runtime_error {
+	compression_error(const std::string &error): runtime_error(error) {}
+};
+
+// the compressors are deliberately stream-oriented rather than block-oriented: the writing end
+// compresses everything it is given as one continuous stream, and forces out a decodable block
+// only when the protocol layer flushes at the end of each command (or response), so that the
+// reading end never has to wait for data that the writing end isn't going to send yet.
+struct StreamCompressor {
+	virtual ~StreamCompressor() {}
+
+	// compresses as much of the input as possible into the output buffer, advancing src and
+	// reducing bytes by the amount of input consumed, and returns the number of bytes of output
+	// produced.  if flush is true, also writes out everything buffered internally.  needs to be
+	// called again with the remaining input (if any) until done() returns true.
+	virtual size_t compress(const uint8_t *&src, size_t &bytes, bool flush, uint8_t *dest, size_t dest_size) = 0;
+	virtual bool done() const = 0;
+};
+
+struct StreamDecompressor {
+	virtual ~StreamDecompressor() {}
+
+	// decompresses as much of the input as possible into the output buffer, advancing src and
+	// reducing bytes by the amount of input consumed, and returns the number of bytes of output
+	// produced; 0 means more input is needed.
+	virtual size_t decompress(const uint8_t *&src, size_t &bytes, uint8_t *dest, size_t dest_size) = 0;
+
+	// returns true if the last call filled the output buffer, in which case there may be more
+	// output available even without further input.
+	virtual bool output_pending() const = 0;
+};
+
+#ifdef HAVE_ZSTD
+struct ZstdCompressor: StreamCompressor {
+	ZstdCompressor(int level): context(ZSTD_createCCtx()), finished(true) {
+		if (!context) throw compression_error("Couldn't allocate a zstd compression context");
+		ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+	}
+
+	~ZstdCompressor() {
+		ZSTD_freeCCtx(context);
+	}
+
+	virtual size_t compress(const uint8_t *&src, size_t &bytes, bool flush, uint8_t *dest, size_t dest_size) {
+		ZSTD_inBuffer input = { src, bytes, 0 };
+		ZSTD_outBuffer output = { dest, dest_size, 0 };
+		size_t result = ZSTD_compressStream2(context, &output, &input, flush ? ZSTD_e_flush : ZSTD_e_continue);
+		if (ZSTD_isError(result)) throw compression_error("Couldn't compress data: " + std::string(ZSTD_getErrorName(result)));
+		src += input.pos;
+		bytes -= input.pos;
+		finished = (bytes == 0 && (!flush || result == 0));
+		return output.pos;
+	}
+
+	virtual bool done() const {
+		return finished;
+	}
+
+	ZSTD_CCtx *context;
+	bool finished;
+};
+
+struct ZstdDecompressor: StreamDecompressor {
+	ZstdDecompressor(): context(ZSTD_createDCtx()), pending(false) {
+		if (!context) throw compression_error("Couldn't allocate a zstd decompression context");
+	}
+
+	~ZstdDecompressor() {
+		ZSTD_freeDCtx(context);
+	}
+
+	virtual size_t decompress(const uint8_t *&src, size_t &bytes, uint8_t *dest, size_t dest_size) {
+		ZSTD_inBuffer input = { src, bytes, 0 };
+		ZSTD_outBuffer output = { dest, dest_size, 0 };
+		size_t result = ZSTD_decompressStream(context, &output, &input);
+		if (ZSTD_isError(result)) throw compression_error("Couldn't decompress data: " + std::string(ZSTD_getErrorName(result)));
+		src += input.pos;
+		bytes -= input.pos;
+		pending = (output.pos == output.size);
+		return output.pos;
+	}
+
+	virtual bool output_pending() const {
+		return pending;
+	}
+
+	ZSTD_DCtx *context;
+	bool pending;
+};
+#endif
+
+inline bool compression_algorithm_supported(CompressionAlgorithm compression_algorithm) {
+	switch (compression_algorithm) {
+		case CompressionAlgorithm::none:
+			return true;
+
+#ifdef HAVE_ZSTD
+		case CompressionAlgorithm::zstd:
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+inline std::unique_ptr<StreamCompressor> create_stream_compressor(CompressionAlgorithm compression_algorithm, int compression_level) {
+#ifndef HAVE_ZSTD
+	(void)compression_level; // only used by the zstd compressor
+#endif
+
+	switch (compression_algorithm) {
+		case CompressionAlgorithm::none:
+			return nullptr;
+
+#ifdef HAVE_ZSTD
+		case CompressionAlgorithm::zstd:
+			return std::unique_ptr<StreamCompressor>(new ZstdCompressor(compression_level));
+#endif
+
+		default:
+			throw compression_error("Compression algorithm " + std::to_string(static_cast<int>(compression_algorithm)) + " isn't supported by this build");
+	}
+}
+
+inline std::unique_ptr<StreamDecompressor> create_stream_decompressor(CompressionAlgorithm compression_algorithm) {
+	switch (compression_algorithm) {
+		case CompressionAlgorithm::none:
+			return nullptr;
+
+#ifdef HAVE_ZSTD
+		case CompressionAlgorithm::zstd:
+			return std::unique_ptr<StreamDecompressor>(new ZstdDecompressor());
+#endif
+
+		default:
+			throw compression_error("Compression algorithm " + std::to_string(static_cast<int>(compression_algorithm)) + " isn't supported by this build");
+	}
+}
+
+#endif
@@ -1,34 +1,49 @@
 #include "subdivision.h"
 #include "message_pack/copy_packed.h"
 #include "basic_uint128_t.h"
+#include <cerrno>
+
+inline bool column_interpolatable(const Column &column) {
+	switch (column.column_type) {
+		case ColumnType::text:
+		case ColumnType::text_varchar:
+		case ColumnType::text_fixed:
+		case ColumnType::uuid:
+			return true;
+
+		default:
+			return (column.column_type >= ColumnType::integer_min && column.column_type <= ColumnType::integer_max);
+	}
+}
 
 bool primary_key_subdividable(const Table &table) {
-	if (table.primary_key_columns.size() != 1) return false;
-	const Column &column(table.columns[table.primary_key_columns[0]]);
-	return (column.column_type == ColumnType::uuid || (column.column_type >= ColumnType::integer_min && column.column_type <= ColumnType::integer_max));
+	// we interpolate on the first column that differs between the ends of the range, which for composite keys is
+	// usually the leading column (say a tenant ID), so that's the one that needs to be a type we can interpolate
+	if (table.primary_key_columns.empty()) return false;
+	return column_interpolatable(table.columns[table.primary_key_columns[0]]);
 }
 
 template <typename T>
-inline T read_single_value(const ColumnValues &values) {
-	PackedValueReadStream stream(values[0]);
+inline T read_value(const PackedValue &value) {
+	PackedValueReadStream stream(value);
 	Unpacker<PackedValueReadStream> unpacker(stream);
 	return unpacker.template next<T>();
 }
 
 template <typename T>
-inline ColumnValues pack_single_value(const T &value) {
-	ColumnValues result(1);
-	Packer<PackedValue> packer(result[0]);
+inline PackedValue pack_value(const T &value) {
+	PackedValue result;
+	Packer<PackedValue> packer(result);
 	packer << value;
 	return result;
 }
 
 template <typename IntegerType>
-inline ColumnValues subdivide_integer_range(const ColumnValues &prev_key, const ColumnValues &last_key) {
-	IntegerType prev = read_single_value<IntegerType>(prev_key);
-	IntegerType last = read_single_value<IntegerType>(last_key);
+inline PackedValue interpolate_integer(const PackedValue &prev_value, const PackedValue &last_value) {
+	IntegerType prev = read_value<IntegerType>(prev_value);
+	IntegerType last = read_value<IntegerType>(last_value);
 	IntegerType midpoint = last > prev ? prev + (last - prev)/2 : prev; // remember that overflow is undefined for signed integers in C & C++!
-	return pack_single_value(midpoint);
+	return pack_value(midpoint);
 }
 
 inline bool parse_uint64_t(const string &str, uint64_t &out) {
@@ -62,48 +77,118 @@ inline string format_uuid(basic_uint128_t u) {
 	return result;
 }
 
-inline ColumnValues subdivide_uuid_range(const ColumnValues &prev_key, const ColumnValues &last_key) {
-	string prev = read_single_value<string>(prev_key);
-	string last = read_single_value<string>(last_key);
+inline PackedValue interpolate_uuid(const PackedValue &prev_value, const PackedValue &last_value) {
+	string prev = read_value<string>(prev_value);
+	string last = read_value<string>(last_value);
 
 	basic_uint128_t uprev, ulast;
 
 	if (!parse_uuid(prev, uprev) || !parse_uuid(last, ulast)) {
 		// shouldn't be possible with proper UUID types, but fail gracefully
-		return prev_key;
+		return prev_value;
 	} else {
 		basic_uint128_t umid(uprev + ((ulast - uprev) >> 1)); // (uprev + ulast) >> 1 would overflow
-		return pack_single_value(format_uuid(umid));
+		return pack_value(format_uuid(umid));
 	}
 }
 
-ColumnValues subdivide_primary_key_range(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
-	const Column &column(table.columns[table.primary_key_columns[0]]);
+inline bool utf8_continuation_byte(const string &str, size_t pos) {
+	return (pos < str.size() && ((unsigned char)str[pos] & 0xc0) == 0x80);
+}
+
+// interpolates lexicographically: after the prefix the two strings have in common, we treat the next 8 bytes of
+// each as a big-endian number and take the midpoint.  the database's collation may not order strings bytewise,
+// but the result is only an estimate that we then look up the next actual key for, so all that matters is that
+// it's usually somewhere in the middle.  we only emit printable ASCII characters after the common prefix so that
+// the result is always valid text in any encoding the database might use, and is never cut off at a NUL.
+inline PackedValue interpolate_string(const PackedValue &prev_value, const PackedValue &last_value) {
+	string prev = read_value<string>(prev_value);
+	string last = read_value<string>(last_value);
+
+	size_t common = 0;
+	while (common < prev.size() && common < last.size() && prev[common] == last[common]) common++;
+	while (common > 0 && (utf8_continuation_byte(prev, common) || utf8_continuation_byte(last, common))) common--; // don't split a character
+
+	uint64_t uprev = 0, ulast = 0;
+	for (size_t pos = common; pos < common + sizeof(uint64_t); pos++) {
+		uprev = (uprev << 8) | (pos < prev.size() ? (unsigned char)prev[pos] : 0);
+		ulast = (ulast << 8) | (pos < last.size() ? (unsigned char)last[pos] : 0);
+	}
+	if (ulast <= uprev) return prev_value; // ordered differently by the collation, so we have nothing better to go on
+
+	uint64_t umid = uprev + (ulast - uprev)/2;
+	string result(last, 0, common);
+	for (int shift = 56; shift >= 0; shift -= 8) {
+		char c = (umid >> shift) & 0xff;
+		if (c < 0x20 || c > 0x7e) break;
+		result += c;
+	}
+	return pack_value(result);
+}
 
+inline PackedValue interpolate_value(const Column &column, const PackedValue &prev_value, const PackedValue &last_value) {
 	switch (column.column_type) {
 		case ColumnType::sint_8bit:
 		case ColumnType::sint_16bit:
 		case ColumnType::sint_24bit:
 		case ColumnType::sint_32bit:
-			return subdivide_integer_range<int32_t>(prev_key, last_key);
+			return interpolate_integer<int32_t>(prev_value, last_value);
 
 		case ColumnType::sint_64bit:
-			return subdivide_integer_range<int64_t>(prev_key, last_key);
+			return interpolate_integer<int64_t>(prev_value, last_value);
 
 		case ColumnType::uint_8bit:
 		case ColumnType::uint_16bit:
 		case ColumnType::uint_24bit:
 		case ColumnType::uint_32bit:
-			return subdivide_integer_range<uint32_t>(prev_key, last_key);
+			return interpolate_integer<uint32_t>(prev_value, last_value);
 
 		case ColumnType::uint_64bit:
-			return subdivide_integer_range<uint64_t>(prev_key, last_key);
+			return interpolate_integer<uint64_t>(prev_value, last_value);
 
 		case ColumnType::uuid:
-			return subdivide_uuid_range(prev_key, last_key);
+			return interpolate_uuid(prev_value, last_value);
+
+		case ColumnType::text:
+		case ColumnType::text_varchar:
+		case ColumnType::text_fixed:
+			return interpolate_string(prev_value, last_value);
 
 		default:
-			// don't know how to subdivide this key type
-			return prev_key;
+			// don't know how to interpolate this type
+			return prev_value;
 	}
 }
+
+ColumnValues subdivide_primary_key_range(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+	// for composite keys, the columns before the first one that differs are the same for every key in the range,
+	// so we keep those and interpolate that column.  the columns after it are left off, giving a partial key that
+	// first_key_not_earlier_than compares with just the leading primary key columns.
+	size_t column = 0;
+	while (column < prev_key.size() - 1 && prev_key[column] == last_key[column]) column++;
+
+	ColumnValues result(prev_key.begin(), prev_key.begin() + column);
+	result.push_back(interpolate_value(table.columns[table.primary_key_columns[column]], prev_key[column], last_key[column]));
+	return result;
+}
+
+ColumnValues partial_key_from_text(const Table &table, const string &value) {
+	const Column &column(table.columns[table.primary_key_columns[0]]);
+	ColumnValues result;
+
+	if (column.column_type >= ColumnType::integer_min && column.column_type <= ColumnType::integer_max) {
+		char *end;
+		errno = 0;
+		if (column.column_type >= ColumnType::uint_8bit) {
+			uint64_t integer = strtoull(value.c_str(), &end, 10);
+			if (!errno && end != value.c_str() && !*end) result.push_back(pack_value(integer));
+		} else {
+			int64_t integer = strtoll(value.c_str(), &end, 10);
+			if (!errno && end != value.c_str() && !*end) result.push_back(pack_value(integer));
+		}
+	} else if (column_interpolatable(column)) {
+		result.push_back(pack_value(value));
+	}
+
+	return result;
+}
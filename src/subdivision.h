@@ -6,6 +6,7 @@
 
 bool primary_key_subdividable(const Table &table);
 ColumnValues subdivide_primary_key_range(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key);
+ColumnValues partial_key_from_text(const Table &table, const string &value);
 
 template <typename DatabaseClient>
 ColumnValues first_key_not_earlier_than(DatabaseClient &client, const Table &table, const ColumnValues &key, const ColumnValues &prev_key, const ColumnValues &last_key) {
@@ -18,4 +19,26 @@ ColumnValues first_key_not_earlier_than(DatabaseClient &client, const Table &tab
 	}
 }
 
+// finds up to parts - 1 actual keys that split the table up to last_key into ranges with roughly equal numbers of
+// rows, using the database's histogram for the leading primary key column.  this gives a much better split than
+// interpolating when the keys are skewed or sparse.  returns fewer keys, or none, if there's no usable histogram.
+template <typename DatabaseClient>
+vector<ColumnValues> equal_population_split_keys(DatabaseClient &client, const Table &table, size_t parts, const ColumnValues &last_key) {
+	vector<ColumnValues> result;
+	if (parts < 2) return result;
+
+	vector<string> bounds(client.histogram_bounds(table, table.columns[table.primary_key_columns[0]]));
+	if (bounds.size() < 2) return result;
+
+	for (size_t part = 1; part < parts; part++) {
+		ColumnValues key(partial_key_from_text(table, bounds[part*(bounds.size() - 1)/parts]));
+		if (key.empty()) continue;
+
+		ColumnValues prev_key(result.empty() ? ColumnValues() : result.back());
+		ColumnValues split_key(first_key_not_earlier_than(client, table, key, prev_key, last_key));
+		if (split_key != prev_key && split_key != last_key) result.push_back(move(split_key));
+	}
+	return result;
+}
+
 #endif
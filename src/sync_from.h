@@ -1,3 +1,7 @@
+#include <atomic>
+#include <csignal>
+#include <sys/wait.h>
+
 #include "defaults.h"
 #include "protocol_versions.h"
 #include "command.h"
@@ -9,21 +13,31 @@
 #include "filters.h"
 #include "query_functions.h"
 #include "hash_algorithm.h"
+#include "hash_tree.h"
+#include "pipelined_row_hasher.h"
+#include "columnar_rows.h"
+#include "row_fingerprints.h"
+#include "hash_cache.h"
 #include "sync_error.h"
 #include "substitute_primary_key.h"
+#include "multiplexer.h"
+#include "tcp_socket.h"
 
 template<class DatabaseClient>
 struct SyncFromWorker {
 	SyncFromWorker(
 		const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
-		const string &set_variables,
+		const string &set_variables, const string &hash_cache_directory,
 		int read_from_descriptor, int write_to_descriptor, char *status_area, size_t status_size):
-			client(database_host, database_port, database_name, database_username, database_password, set_variables),
 			input_stream(read_from_descriptor),
 			input(input_stream),
 			output_stream(write_to_descriptor),
 			output(output_stream),
+			client(database_host, database_port, database_name, database_username, database_password, set_variables),
+			database_identity(database_host + ":" + database_port + "/" + database_name),
 			hash_algorithm(DEFAULT_HASH_ALGORITHM), // until advised to use a different hash algorithm by the 'to' end
+			hash_in_database(false),
+			hash_cache(hash_cache_directory),
 			status_area(status_area),
 			status_size(status_size) {
 	}
@@ -54,10 +68,26 @@ struct SyncFromWorker {
 					handle_hash_command();
 					break;
 
+				case Commands::HASH_MULTI:
+					handle_hash_multi_command();
+					break;
+
+				case Commands::HASH_TREE:
+					handle_hash_tree_command();
+					break;
+
 				case Commands::ROWS:
 					handle_rows_command();
 					break;
 
+				case Commands::ROW_HASHES:
+					handle_row_hashes_command();
+					break;
+
+				case Commands::ROWS_BY_KEYS:
+					handle_rows_by_keys_command();
+					break;
+
 				case Commands::IDLE:
 					handle_idle_command();
 					break;
@@ -98,8 +128,21 @@ struct SyncFromWorker {
 					handle_types_command();
 					break;
 
+				case Commands::COMPRESSION:
+					handle_compression_command();
+					break;
+
+				case Commands::HASH_IN_DATABASE:
+					handle_hash_in_database_command();
+					break;
+
+				case Commands::TABLE_SIZES:
+					handle_table_sizes_command();
+					break;
+
 				case Commands::QUIT:
 					read_all_arguments(input);
+					save_hash_cache();
 					return;
 
 				default:
@@ -150,14 +193,19 @@ struct SyncFromWorker {
 
 	void handle_export_snapshot_command() {
 		read_all_arguments(input);
-		send_command(output, Commands::EXPORT_SNAPSHOT, client.export_snapshot());
+		read_table_modification_markers();
+		string snapshot(client.export_snapshot());
+		check_table_modification_markers();
+		send_command(output, Commands::EXPORT_SNAPSHOT, snapshot);
 		populate_database_schema();
 	}
 
 	void handle_import_snapshot_command() {
 		string snapshot;
 		read_all_arguments(input, snapshot);
+		read_table_modification_markers();
 		client.import_snapshot(snapshot);
+		check_table_modification_markers();
 		send_command(output, Commands::IMPORT_SNAPSHOT); // just to indicate that we have completed the command
 		populate_database_schema();
 	}
@@ -170,11 +218,38 @@ struct SyncFromWorker {
 
 	void handle_without_snapshot_command() {
 		read_all_arguments(input);
+		read_table_modification_markers();
 		client.start_read_transaction();
+		check_table_modification_markers();
 		send_command(output, Commands::WITHOUT_SNAPSHOT); // just to indicate that we have completed the command
 		populate_database_schema();
 	}
 
+	void read_table_modification_markers() {
+		// must be done before we start our transaction, see HashCache::set_table_markers
+		if (hash_cache.enabled()) {
+			hash_cache.set_table_markers(client.table_modification_markers());
+		}
+	}
+
+	void check_table_modification_markers() {
+		// and again once we have, to find the tables that were changed in between
+		if (hash_cache.enabled()) {
+			hash_cache.check_table_markers(client.table_modification_markers());
+		}
+	}
+
+	void save_hash_cache() {
+		if (hash_cache.enabled()) {
+			try {
+				hash_cache.save(client.table_modification_markers());
+			} catch (const exception &e) {
+				// the sync itself has completed, so don't fail it
+				cerr << "Couldn't save the hash cache: " << e.what() << endl;
+			}
+		}
+	}
+
 	void populate_database_schema() {
 		if (output_stream.protocol_version <= LAST_LEGACY_SCHEMA_FORMAT_VERSION) {
 			accepted_types = LegacySupportedColumnTypes;
@@ -219,10 +294,86 @@ struct SyncFromWorker {
 		read_all_arguments(input, table_name, prev_key, last_key, rows_to_hash);
 		show_status("syncing " + table_name);
 
-		RowHasher hasher(hash_algorithm);
-		size_t row_count = retrieve_rows(client, hasher, *tables_by_name.at(table_name), prev_key, last_key, rows_to_hash);
+		const Table &table(*tables_by_name.at(table_name));
+		size_t row_count;
+		string hash;
+		hash_range(table, prev_key, last_key, rows_to_hash, row_count, hash);
+		send_command(output, Commands::HASH, table_name, prev_key, last_key, rows_to_hash, row_count, hash);
+	}
+
+	void handle_hash_multi_command() {
+		// the first array gives the table name, which is followed by one array for each range to hash
+		string table_name;
+		read_array(input, table_name);
+		show_status("syncing " + table_name);
+
+		vector<tuple<ColumnValues, ColumnValues, size_t>> ranges;
+		while (size_t array_length = input.next_array_length()) {
+			if (array_length != 3) throw command_error("Expected 3 arguments, got " + to_string(array_length));
+			ColumnValues prev_key, last_key;
+			size_t rows_to_hash;
+			read_values(input, prev_key, last_key, rows_to_hash);
+			ranges.emplace_back(move(prev_key), move(last_key), rows_to_hash);
+		}
+
+		const Table &table(*tables_by_name.at(table_name));
+		send_command_begin(output, Commands::HASH_MULTI, table_name);
+		for (const tuple<ColumnValues, ColumnValues, size_t> &range : ranges) {
+			size_t row_count;
+			string hash;
+			hash_range(table, get<0>(range), get<1>(range), get<2>(range), row_count, hash);
+			send_array(output, get<0>(range), get<1>(range), get<2>(range), row_count, hash);
+		}
+		send_command_end(output);
+	}
+
+	void hash_range(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows_to_hash, size_t &row_count, string &hash) {
+		TableHashCache *table_hash_cache = hash_cache.for_table(table, hash_cache_identity(table));
+		HashCacheEntry cached;
+		if (table_hash_cache && table_hash_cache->lookup(HashCacheKey(prev_key, last_key, rows_to_hash), cached)) {
+			row_count = cached.row_count;
+			hash = move(cached.hash);
+			return;
+		}
+
+		if (hash_in_database) {
+			DatabaseHashCollector hasher(hash_rows_in_database(client, table, prev_key, last_key, rows_to_hash));
+			row_count = hasher.row_count;
+			hash = move(hasher.hash);
+		} else {
+			PipelinedRowHasher hasher(hash_algorithm);
+			row_count = retrieve_rows(client, hasher, table, prev_key, last_key, rows_to_hash);
+			hash = hasher.finish().to_string();
+		}
+
+		if (table_hash_cache) {
+			table_hash_cache->store(HashCacheKey(prev_key, last_key, rows_to_hash), HashCacheEntry{row_count, hash});
+		}
+	}
+
+	string hash_cache_identity(const Table &table) {
+		if (!hash_cache.enabled()) return string();
 
-		send_command(output, Commands::HASH, table_name, prev_key, last_key, rows_to_hash, row_count, hasher.finish());
+		// everything other than the contents of the table that affects the hashes we send
+		return database_identity + "\n" +
+			to_string(output_stream.protocol_version) + " " + to_string(static_cast<int>(hash_algorithm)) + (hash_in_database ? " in database" : "") + "\n" +
+			retrieve_rows_sql(client, table, ColumnValues(), ColumnValues());
+	}
+
+	void handle_hash_tree_command() {
+		string table_name;
+		ColumnValues prev_key, last_key;
+		size_t bytes_per_leaf;
+		read_all_arguments(input, table_name, prev_key, last_key, bytes_per_leaf);
+		show_status("syncing " + table_name);
+
+		// hash the whole range in one pass, sending an array for each leaf as we go
+		const Table &table(*tables_by_name.at(table_name));
+		send_command_begin(output, Commands::HASH_TREE, table_name, prev_key, last_key, bytes_per_leaf);
+		HashTreeLeafPacker<VersionedFDWriteStream> leaf_packer(output, hash_algorithm, table.primary_key_columns, bytes_per_leaf);
+		retrieve_rows(client, leaf_packer, table, prev_key, last_key);
+		leaf_packer.finish(last_key);
+		send_command_end(output);
 	}
 
 	void handle_rows_command() {
@@ -231,16 +382,65 @@ struct SyncFromWorker {
 		read_all_arguments(input, table_name, prev_key, last_key);
 		show_status("syncing " + table_name);
 
+		const Table &table(*tables_by_name.at(table_name));
 		send_command_begin(output, Commands::ROWS, table_name, prev_key, last_key);
-		send_rows(*tables_by_name.at(table_name), prev_key, last_key);
+		if (output_stream.protocol_version > LAST_ROW_ORIENTED_PROTOCOL_VERSION) {
+			ColumnarRowPackerAndLastKey<VersionedFDWriteStream> row_packer(output, table.primary_key_columns);
+			send_rows(row_packer, table, prev_key, last_key);
+			row_packer.flush();
+		} else {
+			RowPackerAndLastKey<VersionedFDWriteStream> row_packer(output, table.primary_key_columns);
+			send_rows(row_packer, table, prev_key, last_key);
+		}
 		send_command_end(output);
 	}
 
-	void send_rows(const Table &table, ColumnValues prev_key, const ColumnValues &last_key) {
+	void handle_row_hashes_command() {
+		string table_name;
+		ColumnValues prev_key, last_key;
+		read_all_arguments(input, table_name, prev_key, last_key);
+		show_status("syncing " + table_name);
+
+		// send the key and fingerprint of each row in the range; the range is already known to be small, so we don't need to batch the query
+		const Table &table(*tables_by_name.at(table_name));
+		send_command_begin(output, Commands::ROW_HASHES, table_name, prev_key, last_key);
+		RowFingerprintPacker<VersionedFDWriteStream> fingerprint_packer(output, table.primary_key_columns);
+		retrieve_rows(client, fingerprint_packer, table, prev_key, last_key);
+		send_command_end(output);
+	}
+
+	void handle_rows_by_keys_command() {
+		// the first array gives the table name, which is followed by one array for each key to retrieve
+		string table_name;
+		read_array(input, table_name);
+		show_status("syncing " + table_name);
+
+		vector<ColumnValues> keys;
+		while (size_t array_length = input.next_array_length()) {
+			keys.emplace_back(array_length);
+			for (PackedValue &value : keys.back()) {
+				input >> value;
+			}
+		}
+
+		// the rows are sent in columnar batches, since this command is only used in later protocol versions
+		const Table &table(*tables_by_name.at(table_name));
+		if (keys.empty()) throw command_error("No keys given to retrieve from " + table_name);
+		for (const ColumnValues &key : keys) {
+			if (key.size() != table.primary_key_columns.size()) throw command_error("Expected " + to_string(table.primary_key_columns.size()) + " key values, got " + to_string(key.size()));
+		}
+		send_command_begin(output, Commands::ROWS_BY_KEYS, table_name);
+		ColumnarRowPacker<VersionedFDWriteStream> row_packer(output);
+		retrieve_rows_by_keys(client, row_packer, table, keys);
+		row_packer.flush();
+		send_command_end(output);
+	}
+
+	template <typename RowReceiver>
+	void send_rows(RowReceiver &row_packer, const Table &table, ColumnValues prev_key, const ColumnValues &last_key) {
 		// we limit individual queries to an arbitrary limit of 10000 rows, to reduce annoying slow
 		// queries that would otherwise be logged on the server and reduce buffering.
 		const int BATCH_SIZE = 10000;
-		RowPackerAndLastKey<VersionedFDWriteStream> row_packer(output, table.primary_key_columns);
 
 		while (true) {
 			size_t row_count = retrieve_rows(client, row_packer, table, prev_key, last_key, BATCH_SIZE);
@@ -258,13 +458,45 @@ struct SyncFromWorker {
 		HashAlgorithm requested_hash_algorithm;
 		read_all_arguments(input, requested_hash_algorithm);
 
-		if (hash_algorithm == HashAlgorithm::md5 || hash_algorithm == HashAlgorithm::xxh64) {
+		// if we don't support the requested algorithm, we tell the other end we're sticking with the current one
+		if (hash_algorithm_supported(requested_hash_algorithm)) {
 			hash_algorithm = requested_hash_algorithm;
 		}
 
 		send_command(output, Commands::HASH_ALGORITHM, static_cast<int>(hash_algorithm));
 	}
 
+	void handle_hash_in_database_command() {
+		string dialect;
+		read_all_arguments(input, dialect);
+
+		// the aggregate queries give different results on different types of database, so only agree if the other end uses the same type
+		hash_in_database = (dialect == client.aggregate_hash_dialect());
+
+		send_command(output, Commands::HASH_IN_DATABASE, hash_in_database);
+	}
+
+	void handle_table_sizes_command() {
+		read_all_arguments(input);
+		send_command(output, Commands::TABLE_SIZES, client.table_size_estimates());
+	}
+
+	void handle_compression_command() {
+		CompressionAlgorithm compression_algorithm;
+		int compression_level;
+		read_all_arguments(input, compression_algorithm, compression_level);
+
+		if (!compression_algorithm_supported(compression_algorithm)) {
+			compression_algorithm = CompressionAlgorithm::none;
+		}
+
+		send_command(output, Commands::COMPRESSION, static_cast<int>(compression_algorithm));
+
+		// the 'to' end won't send anything more until it has read our response, so we can switch over now
+		output_stream.start_compression(compression_algorithm, compression_level);
+		input_stream.start_decompression(compression_algorithm);
+	}
+
 	// deprecated as actually not relevant under current protocol versions, but still supported for backwards compatibility
 	void handle_target_block_size_command() {
 		size_t target_minimum_block_size;
@@ -277,14 +509,19 @@ struct SyncFromWorker {
 		status_area[status_size] = 0;
 	}
 
-	DatabaseClient client;
-	Database database;
-	map<string, Table*> tables_by_name;
+	// the streams are declared before the client so that they take ownership of (and will close)
+	// the descriptors even if we fail to connect to the database
 	VersionedFDReadStream input_stream;
 	Unpacker<VersionedFDReadStream> input;
 	VersionedFDWriteStream output_stream;
 	Packer<VersionedFDWriteStream> output;
+	DatabaseClient client;
+	string database_identity;
+	Database database;
+	map<string, Table*> tables_by_name;
 	HashAlgorithm hash_algorithm;
+	bool hash_in_database;
+	HashCache hash_cache;
 	TableFilters table_filters;
 	ColumnTypeList accepted_types;
 	char *status_area;
@@ -296,3 +533,115 @@ void sync_from(const Options &...options) {
 	SyncFromWorker<DatabaseClient> worker(options...);
 	worker();
 }
+
+template<class DatabaseClient>
+void sync_from_multiplexed(
+	int num_workers,
+	const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
+	const string &set_variables, const string &hash_cache_directory, char *status_area, size_t status_size) {
+	// all the workers' conversations are carried over our stdin and stdout, so set up a pair of pipes for each
+	vector<MultiplexedChannel> channels;
+	vector<pair<int, int>> worker_descriptors;
+	for (int worker = 0; worker < num_workers; worker++) {
+		int to_worker[2], from_worker[2];
+		if (pipe(to_worker) < 0 || pipe(from_worker) < 0) {
+			throw runtime_error("Couldn't create a pipe: " + string(strerror(errno)));
+		}
+		channels.push_back(MultiplexedChannel(from_worker[0], to_worker[1]));
+		worker_descriptors.push_back(make_pair(to_worker[0], from_worker[1]));
+	}
+
+	Multiplexer multiplexer(STDIN_FILENO, STDOUT_FILENO, channels);
+
+	// each worker gets its own slice of the status area
+	size_t status_slice = status_size/num_workers;
+	atomic<bool> failed(false);
+	vector<std::thread> threads;
+	for (int worker = 0; worker < num_workers; worker++) {
+		threads.push_back(std::thread([&, worker]() {
+			try {
+				sync_from<DatabaseClient>(database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory,
+					worker_descriptors[worker].first, worker_descriptors[worker].second, status_area + worker*status_slice, status_slice ? status_slice - 1 : 0);
+			} catch (const sync_error &e) {
+				// the worker has already output the error to cerr
+				failed = true;
+			} catch (const exception &e) {
+				cerr << e.what() << endl;
+				failed = true;
+			}
+		}));
+	}
+
+	for (std::thread &thread : threads) thread.join();
+	multiplexer.wait();
+
+	if (failed) throw sync_error();
+}
+
+template<class DatabaseClient>
+void sync_from_listening(
+	const string &address,
+	const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
+	const string &set_variables, const string &hash_cache_directory, char *status_area, size_t status_size) {
+	int listener = TCPSocket::listen(address);
+
+	// each connection is handled by a separate process, just as if ks had started it; we don't need
+	// to wait for them (any errors are output to cerr by the worker itself)
+	signal(SIGCHLD, SIG_IGN);
+
+	while (true) {
+		int fd = TCPSocket::accept(listener);
+
+		pid_t child = fork();
+		if (child < 0) {
+			throw runtime_error("Couldn't fork to handle connection: " + string(strerror(errno)));
+		} else if (child == 0) {
+			::close(listener);
+			sync_from<DatabaseClient>(database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, fd, dup(fd), status_area, status_size);
+			return;
+		}
+
+		::close(fd);
+	}
+}
+
+template<class DatabaseClient>
+void sync_from_connecting(
+	const string &address, int num_workers,
+	const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
+	const string &set_variables, const string &hash_cache_directory, char *status_area, size_t status_size) {
+	if (num_workers < 1) throw runtime_error("Must have at least one worker");
+
+	// make all the connections before starting any workers, so that we fail cleanly if we can't
+	vector<int> descriptors;
+	for (int worker = 0; worker < num_workers; worker++) {
+		descriptors.push_back(TCPSocket::connect(address));
+	}
+
+	// as when started by ks, each worker runs in a separate process
+	vector<pid_t> children;
+	for (int fd : descriptors) {
+		pid_t child = fork();
+		if (child < 0) {
+			throw runtime_error("Couldn't fork to start worker: " + string(strerror(errno)));
+		} else if (child == 0) {
+			for (int other_fd : descriptors) {
+				if (other_fd != fd) ::close(other_fd);
+			}
+			sync_from<DatabaseClient>(database_host, database_port, database_name, database_username, database_password, set_variables, hash_cache_directory, fd, dup(fd), status_area, status_size);
+			return;
+		}
+		children.push_back(child);
+	}
+
+	for (int fd : descriptors) ::close(fd);
+
+	bool failed = false;
+	for (pid_t child : children) {
+		int status;
+		while (waitpid(child, &status, 0) < 0 && errno == EINTR) ;
+		failed |= !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	if (failed) throw sync_error();
+}
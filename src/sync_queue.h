@@ -5,23 +5,28 @@
 #include <list>
 #include <set>
 #include <memory>
+#include <algorithm>
+#include <chrono>
 
 #include "abortable_barrier.h"
+#include "defaults.h"
 #include "schema.h"
 #include "subdivision.h"
+#include "table_statistics.h"
 
 using namespace std;
 
 typedef tuple<ColumnValues, ColumnValues> KeyRange;
 struct KeyRangeToCheck {
-	KeyRangeToCheck(const ColumnValues &prev_key, const ColumnValues &last_key, size_t estimated_rows_in_range, size_t rows_to_hash, size_t priority):
-		key_range(prev_key, last_key), estimated_rows_in_range(estimated_rows_in_range), rows_to_hash(rows_to_hash), priority(priority) {
+	KeyRangeToCheck(const ColumnValues &prev_key, const ColumnValues &last_key, size_t estimated_rows_in_range, size_t rows_to_hash, size_t priority, size_t bytes_per_leaf = 0):
+		key_range(prev_key, last_key), estimated_rows_in_range(estimated_rows_in_range), rows_to_hash(rows_to_hash), priority(priority), bytes_per_leaf(bytes_per_leaf) {
 	}
 
 	KeyRange key_range;
 	size_t estimated_rows_in_range;
 	size_t rows_to_hash;
 	size_t priority;
+	size_t bytes_per_leaf; // if non-zero, the range is checked using a HASH_TREE command with leaves of this size rather than a HASH command
 };
 const size_t UNKNOWN_ROW_COUNT = numeric_limits<size_t>::max();
 
@@ -31,13 +36,28 @@ struct lower_priority {
 	}
 };
 
+// normally only the worker that starts a table (the writer) changes it, and other workers only help with checking
+// ranges.  rows in different key ranges can be applied by different workers at once, but only if the table has no
+// other unique keys, since otherwise a row applied in one range may need to clear a row in another worker's range;
+// each worker's transaction holds its row locks until it commits, usually at the end of the whole sync, so the
+// workers would wait for each other forever.
+inline bool concurrent_writers_possible(const Table &table) {
+	if (table.primary_key_type != PrimaryKeyType::explicit_primary_key) return false;
+	for (const Key &key : table.keys) {
+		if (key.unique()) return false;
+	}
+	return true;
+}
+
 struct TableJob {
-	TableJob(const Table &table): table(table), subdividable(primary_key_subdividable(table)), notify_when_work_could_be_shared(false), time_started(0), time_finished(0), hash_commands(0), hash_commands_completed(0), rows_commands(0) {}
+	TableJob(const Table &table, const TableStatistics &previous_statistics): table(table), subdividable(primary_key_subdividable(table)), concurrent_writers_allowed(concurrent_writers_possible(table)), previous_statistics(previous_statistics), notify_when_work_could_be_shared(false), written_concurrently(false), time_started(0), time_finished(0), hash_commands(0), hash_commands_completed(0), rows_commands(0), borrowed_rows_commands(0), borrowed_rows_commands_completed(0), rows_changed_by_borrowers(0), seconds_taken(0), hash_tree_fanout(DEFAULT_HASH_TREE_FANOUT), rows_scanned(0), bytes_scanned(0), rows_mismatched(0), rows_per_block(0) {}
 
-	inline bool have_work_to_share() { return (!ranges_to_check.empty()); }
+	inline bool have_work_to_share() { return (!ranges_to_check.empty() || (concurrent_writers_allowed && !ranges_to_retrieve.empty())); }
 
 	const Table &table;
 	const bool subdividable;
+	const bool concurrent_writers_allowed;
+	const TableStatistics previous_statistics; // from the last run, if we're keeping them
 
 	std::mutex mutex;
 	std::condition_variable borrowed_task_completed;
@@ -45,25 +65,63 @@ struct TableJob {
 	list<KeyRange> ranges_to_retrieve;
 	priority_queue<KeyRangeToCheck, deque<KeyRangeToCheck>, lower_priority> ranges_to_check;
 	bool notify_when_work_could_be_shared;
+	bool written_concurrently;
 
 	time_t time_started;
 	time_t time_finished;
+	std::chrono::steady_clock::time_point started_at;
 
 	size_t hash_commands;
 	size_t hash_commands_completed;
 	size_t rows_commands;
+	size_t borrowed_rows_commands; // ranges to retrieve taken by workers other than the writer
+	size_t borrowed_rows_commands_completed; // only counted once the rows have been applied
+	size_t rows_changed_by_borrowers;
+	double seconds_taken; // measured on the steady clock, since time_started and time_finished are only to the second
+	size_t hash_tree_fanout; // set before any ranges are queued
+
+	// collected for the next run's statistics; the rows scanned are those hashed at the top level, which cover each row once
+	size_t rows_scanned;
+	size_t bytes_scanned;
+	size_t rows_mismatched;
+	size_t rows_per_block;
+
+	TableStatistics statistics() const {
+		// if we didn't hash anything (say because our table was empty), what we knew before is still the best guess
+		TableStatistics result(previous_statistics);
+		result.seconds = seconds_taken;
+		if (!rows_scanned) return result;
+
+		result.rows = rows_scanned;
+		result.mismatch_density = (double)min(rows_mismatched, rows_scanned)/rows_scanned;
+		result.average_row_size = bytes_scanned/rows_scanned;
+		result.rows_per_block = (rows_per_block ? rows_per_block : previous_statistics.rows_per_block); // not reached when using hash trees
+		return result;
+	}
 };
 
 template <typename DatabaseClient>
 struct SyncQueue: public AbortableBarrier {
-	SyncQueue(size_t workers): AbortableBarrier(workers), sharing_work(false) {}
+	SyncQueue(size_t workers): AbortableBarrier(workers), sequences_to_reset_after_commit(false), sharing_work(false) {}
 
-	void enqueue_tables_to_process(const Tables &tables) {
+	void enqueue_tables_to_process(const Tables &tables, const TableSizes &from_sizes, const TableSizes &to_sizes) {
 		unique_lock<std::mutex> lock(mutex);
 
 		for (const Table &from_table : tables) {
-			tables_to_process.push_back(make_shared<TableJob>(from_table));
+			auto statistics_it = previous_statistics.find(from_table.name);
+			tables_to_process.push_back(make_shared<TableJob>(from_table, statistics_it == previous_statistics.end() ? TableStatistics() : statistics_it->second));
 		}
+
+		// start the tables we expect to take longest first.  the schema is already listed in descending order of size
+		// at the 'from' end, so we keep that order when we have nothing better to go on.
+		TableWorkEstimator estimator(previous_statistics, from_sizes, to_sizes);
+		map<string, double> estimated_work;
+		for (const Table &from_table : tables) {
+			estimated_work[from_table.name] = estimator(from_table.name);
+		}
+		tables_to_process.sort([&](const shared_ptr<TableJob> &l, const shared_ptr<TableJob> &r) {
+			return estimated_work[l->table.name] > estimated_work[r->table.name];
+		});
 	}
 
 	shared_ptr<TableJob> find_table_job() {
@@ -88,6 +146,7 @@ struct SyncQueue: public AbortableBarrier {
 
 		tables_with_work_to_share.erase(table_job);
 		tables_being_processed.erase(table_job);
+		statistics[table_job->table.name] = table_job->statistics();
 
 		if (finished()) {
 			// unblock workers waiting in borrow_work()
@@ -118,6 +177,11 @@ struct SyncQueue: public AbortableBarrier {
 
 	string snapshot;
 
+	StatisticsByTable previous_statistics; // loaded before the workers start
+	StatisticsByTable statistics; // for the tables completed in this run
+
+	bool sequences_to_reset_after_commit; // only changed before the workers finish, so can be read without locking after
+
 private:
 	inline bool finished() {
 		return (tables_to_process.empty() && tables_being_processed.empty());
@@ -23,7 +23,8 @@ struct SyncToWorker {
 		const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
 		const string &set_variables, const string &filter_file, const set<string> &ignore_tables, const set<string> &only_tables,
 		int verbose, bool progress, bool snapshot, bool alter, CommitLevel commit_level,
-		HashAlgorithm hash_algorithm, size_t target_minimum_block_size, size_t target_maximum_block_size,
+		HashAlgorithm hash_algorithm, CompressionAlgorithm compression_algorithm, int compression_level, bool hash_tree, bool hash_in_database,
+		size_t target_minimum_block_size, size_t target_maximum_block_size, size_t maximum_commands_to_pipeline,
 		bool structure_only):
 			database(database),
 			sync_queue(sync_queue),
@@ -43,8 +44,13 @@ struct SyncToWorker {
 			alter(alter),
 			commit_level(commit_level),
 			hash_algorithm(hash_algorithm),
+			compression_algorithm(compression_algorithm),
+			compression_level(compression_level),
+			hash_tree(hash_tree),
+			hash_in_database(hash_in_database),
 			target_minimum_block_size(target_minimum_block_size),
 			target_maximum_block_size(target_maximum_block_size),
+			maximum_commands_to_pipeline(maximum_commands_to_pipeline),
 			structure_only(structure_only),
 			worker_thread(std::ref(*this)) {
 	}
@@ -70,6 +76,8 @@ struct SyncToWorker {
 		try {
 			negotiate_protocol_version();
 			negotiate_hash_algorithm();
+			if (output_stream.protocol_version > LAST_UNCOMPRESSED_PROTOCOL_VERSION) negotiate_compression();
+			negotiate_hash_in_database();
 			if (output_stream.protocol_version > LAST_FILTERS_AFTER_SNAPSHOT_PROTOCOL_VERSION) send_filters(); // send early so they can be factored into substitute PK decisions
 			negotiate_types();
 			share_snapshot();
@@ -104,6 +112,7 @@ struct SyncToWorker {
 			client.enable_referential_integrity();
 			if (commit_level >= CommitLevel::success) {
 				commit();
+				if (sync_queue.sequences_to_reset_after_commit) reset_sequences_after_commit();
 			} else {
 				rollback();
 			}
@@ -138,11 +147,40 @@ struct SyncToWorker {
 	void negotiate_hash_algorithm() {
 		send_command(output, Commands::HASH_ALGORITHM, static_cast<int>(hash_algorithm));
 		read_expected_command(input, Commands::HASH_ALGORITHM, hash_algorithm);
-		if (hash_algorithm != HashAlgorithm::md5 && hash_algorithm != HashAlgorithm::xxh64) {
+		if (!hash_algorithm_supported(hash_algorithm)) {
 			throw runtime_error("Couldn't find a compatible hash algorithm");
 		}
 	}
 
+	void negotiate_hash_in_database() {
+		if (!hash_in_database) return;
+
+		// the aggregate queries used give different results on different types of database, so we can only use them
+		// if the other end is the same type as ours; otherwise we quietly fall back to hashing the rows ourselves
+		if (output_stream.protocol_version <= LAST_NO_HASH_IN_DATABASE_PROTOCOL_VERSION) {
+			hash_in_database = false;
+		} else {
+			send_command(output, Commands::HASH_IN_DATABASE, client.aggregate_hash_dialect());
+			read_expected_command(input, Commands::HASH_IN_DATABASE, hash_in_database);
+		}
+
+		if (!hash_in_database && verbose && leader) {
+			cout << "the other end can't use the same hash queries, hashing rows in the endpoints instead" << endl;
+		}
+	}
+
+	void negotiate_compression() {
+		if (compression_algorithm == CompressionAlgorithm::none) return;
+
+		send_command(output, Commands::COMPRESSION, static_cast<int>(compression_algorithm), compression_level);
+		read_expected_command(input, Commands::COMPRESSION, compression_algorithm);
+
+		// the other end switches its streams over as soon as it has sent its response, and won't
+		// send anything else until we send our next command, so we can safely switch ours now
+		output_stream.start_compression(compression_algorithm, compression_level);
+		input_stream.start_decompression(compression_algorithm);
+	}
+
 	void share_snapshot() {
 		if (sync_queue.workers > 1 && snapshot) {
 			// although some databases (such as postgresql) can share & adopt snapshots with no penalty
@@ -188,6 +226,12 @@ struct SyncToWorker {
 			client.convert_unsupported_database_schema(database);
 			restrict_tables(database.tables);
 			check_tables_usable();
+
+			// used to decide which tables to start first
+			if (output_stream.protocol_version > LAST_NO_TABLE_SIZES_PROTOCOL_VERSION) {
+				send_command(output, Commands::TABLE_SIZES);
+				read_expected_command(input, Commands::TABLE_SIZES, from_table_sizes);
+			}
 		}
 	}
 
@@ -287,7 +331,7 @@ struct SyncToWorker {
 	void enqueue_tables() {
 		// queue up all the tables
 		if (leader) {
-			sync_queue.enqueue_tables_to_process(database.tables);
+			sync_queue.enqueue_tables_to_process(database.tables, from_table_sizes, client.table_size_estimates());
 		}
 
 		// wait for the leader to do that (a barrier here is slightly excessive as we don't care if the other
@@ -303,6 +347,19 @@ struct SyncToWorker {
 		sync_queue.wait_at_barrier();
 	}
 
+	void reset_sequences_after_commit() {
+		// tables that had rows applied by several workers at once can only have their sequences reset once all of
+		// those workers have committed, since until then we can't see their rows
+		sync_queue.wait_at_barrier();
+		if (tables_to_reset_sequences_after_commit.empty()) return;
+
+		client.start_write_transaction();
+		for (const Table *table : tables_to_reset_sequences_after_commit) {
+			ResetTableSequences<DatabaseClient>::execute(client, *table);
+		}
+		client.commit_transaction();
+	}
+
 	void commit() {
 		time_t started = time(nullptr);
 
@@ -356,17 +413,28 @@ struct SyncToWorker {
 	bool structure_only;
 
 	HashAlgorithm hash_algorithm;
+	CompressionAlgorithm compression_algorithm;
+	int compression_level;
+	bool hash_tree;
+	bool hash_in_database;
 	size_t target_minimum_block_size;
 	size_t target_maximum_block_size;
+	size_t maximum_commands_to_pipeline;
+	vector<const Table*> tables_to_reset_sequences_after_commit;
+	TableSizes from_table_sizes; // only retrieved by the leader
 	std::thread worker_thread;
 };
 
 template <typename DatabaseClient, typename... Options>
-void sync_to(int num_workers, int startfd, const Options &...options) {
+void sync_to(int num_workers, int startfd, const string &statistics_file, const Options &...options) {
 	Database database;
 	SyncQueue<DatabaseClient> sync_queue(num_workers);
 	vector<SyncToWorker<DatabaseClient>*> workers;
 
+	if (!statistics_file.empty()) {
+		sync_queue.previous_statistics = load_statistics(statistics_file);
+	}
+
 	workers.resize(num_workers);
 
 	for (int worker = 0; worker < num_workers; worker++) {
@@ -379,4 +447,13 @@ void sync_to(int num_workers, int startfd, const Options &...options) {
 	for (SyncToWorker<DatabaseClient>* worker : workers) delete worker;
 
 	if (sync_queue.aborted) throw sync_error();
+
+	if (!statistics_file.empty()) {
+		// keep the statistics for any tables we didn't sync this time, such as those given to --ignore
+		StatisticsByTable statistics(move(sync_queue.previous_statistics));
+		for (auto &it : sync_queue.statistics) {
+			statistics[it.first] = it.second;
+		}
+		save_statistics(statistics_file, statistics);
+	}
 }
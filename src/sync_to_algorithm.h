@@ -1,4 +1,9 @@
 #include "timestamp.h"
+#include "hash_tree.h"
+#include "pipelined_row_hasher.h"
+#include "pipeline_depth.h"
+#include "async_row_applier.h"
+#include "row_fingerprints.h"
 
 struct HashResult {
 	HashResult(const ColumnValues &prev_key, const ColumnValues &last_key, size_t estimated_rows_in_range, size_t priority, size_t our_row_count, size_t our_size, string our_hash, const ColumnValues &our_last_key, const ColumnValues &next_midpoint):
@@ -26,7 +31,8 @@ struct SyncToAlgorithm {
 		output(worker.output),
 		hash_algorithm(worker.hash_algorithm),
 		target_minimum_block_size(worker.target_minimum_block_size),
-		target_maximum_block_size(worker.target_maximum_block_size) {
+		target_maximum_block_size(worker.target_maximum_block_size),
+		pipeline_depth(worker.maximum_commands_to_pipeline) {
 	}
 
 	void sync_tables() {
@@ -38,8 +44,9 @@ struct SyncToAlgorithm {
 		}
 	}
 
-	void start_sync_table(const shared_ptr<TableJob> &table_job, RowReplacer<DatabaseClient> &row_replacer) {
+	void start_sync_table(const shared_ptr<TableJob> &table_job, AsyncRowApplier<DatabaseClient> &row_applier) {
 		table_job->time_started = time(nullptr);
+		table_job->started_at = std::chrono::steady_clock::now();
 
 		if (worker.verbose) {
 			unique_lock<mutex> lock(sync_queue.mutex);
@@ -52,18 +59,30 @@ struct SyncToAlgorithm {
 		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- range " << table_job->table.name << endl;
 		send_command(output, Commands::RANGE, table_job->table.name);
 		if (input.next<verb_t>() != Commands::RANGE) throw command_error("Didn't receive response to RANGE command");
-		handle_range_response(table_job, row_replacer);
+		handle_range_response(table_job, row_applier);
 	}
 
 	void finish_sync_table(const shared_ptr<TableJob> &table_job, size_t rows_changed) {
-		// reset sequences on those databases that don't automatically bump the high-water mark for inserts
-		ResetTableSequences<DatabaseClient>::execute(client, table_job->table);
+		// reset sequences on those databases that don't automatically bump the high-water mark for inserts.  if other
+		// workers applied some of the rows and haven't committed yet, we can't see them, so this has to wait until after
+		// everyone has committed.
+		if (table_job->written_concurrently && worker.commit_level < CommitLevel::tables) {
+			worker.tables_to_reset_sequences_after_commit.push_back(&table_job->table);
+			unique_lock<mutex> lock(sync_queue.mutex);
+			sync_queue.sequences_to_reset_after_commit = true;
+		} else {
+			ResetTableSequences<DatabaseClient>::execute(client, table_job->table);
+		}
+		rows_changed += table_job->rows_changed_by_borrowers;
+		table_job->seconds_taken = std::chrono::duration<double>(std::chrono::steady_clock::now() - table_job->started_at).count();
 
 		if (worker.verbose) {
 			table_job->time_finished = time(nullptr);
 			unique_lock<mutex> lock(sync_queue.mutex);
 			if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << ' ';
-			cout << "finished " << table_job->table.name << " in " << (table_job->time_finished - table_job->time_started) << "s using " << table_job->hash_commands << " hash commands and " << table_job->rows_commands << " rows commands changing " << rows_changed << " rows" << endl << flush;
+			cout << "finished " << table_job->table.name << " in " << (table_job->time_finished - table_job->time_started) << "s using " << table_job->hash_commands << " hash commands and " << table_job->rows_commands << " rows commands changing " << rows_changed << " rows";
+			if (worker.verbose > 1) cout << " with pipeline depth " << pipeline_depth.depth;
+			cout << endl << flush;
 		}
 
 		if (worker.commit_level >= CommitLevel::tables) {
@@ -77,47 +96,94 @@ struct SyncToAlgorithm {
 		RowReplacer<DatabaseClient> row_replacer(client, table, worker.commit_level >= CommitLevel::often,
 			[&] { if (worker.progress) { cout << "." << flush; } });
 
-		// if the table hasn't been started, become the writer worker for it; otherwise just help out with range checks
+		AsyncRowApplier<DatabaseClient> row_applier(row_replacer, table);
+
+		// if the table hasn't been started, become the writer worker for it; otherwise just help out with range checks,
+		// and if the table allows it, retrieving rows
 		bool writer = !table_job->time_started;
-		if (writer) start_sync_table(table_job, row_replacer);
+		if (writer) start_sync_table(table_job, row_applier);
+		bool can_write = (writer || table_job->concurrent_writers_allowed);
+		size_t rows_commands_borrowed = 0;
 
-		size_t outstanding_commands = 0;
-		size_t max_outstanding_commands = DEFAULT_MAX_COMMANDS_TO_PIPELINE;
+		pipeline_depth.start_table(worker.output_stream.total_bytes_written, worker.input_stream.total_bytes_read);
 
 		list<HashResult> ranges_hashed;
+		list<KeyRangeToCheck> hash_trees_requested;
+
+		// each worker retrieves the keys found by its own ROW_HASHES commands, so these don't need to be shared in the table job
+		list<vector<ColumnValues>> keys_to_retrieve;
+		list<vector<ColumnValues>> keys_requested;
 
 		while (true) {
 			sync_queue.check_aborted(); // check each iteration, rather than wait until the end of the current table
 
 			std::unique_lock<std::mutex> lock(table_job->mutex);
 
-			if (writer && outstanding_commands < max_outstanding_commands && !table_job->ranges_to_retrieve.empty()) {
+			if (can_write && pipeline_depth.can_send() && !keys_to_retrieve.empty()) {
+				lock.unlock(); // don't hold the mutex while doing IO
+
+				double time_sent = PipelineDepthController::now();
+				send_rows_by_keys_command(table, keys_to_retrieve.front());
+				keys_requested.splice(keys_requested.end(), keys_to_retrieve, keys_to_retrieve.begin());
+				command_sent(time_sent);
+
+			} else if (can_write && pipeline_depth.can_send() && !table_job->ranges_to_retrieve.empty()) {
 				KeyRange range_to_retrieve(move(table_job->ranges_to_retrieve.front()));
 				table_job->ranges_to_retrieve.pop_front();
 				table_job->rows_commands++;
+				if (!writer) {
+					// the writer must wait for us to apply these rows before it finishes the table
+					table_job->borrowed_rows_commands++;
+					table_job->written_concurrently = true;
+					rows_commands_borrowed++;
+				}
 				lock.unlock(); // don't hold the mutex while doing IO
 
-				outstanding_commands++;
-				send_rows_command(table, range_to_retrieve);
-
-			} else if (outstanding_commands < max_outstanding_commands && !table_job->ranges_to_check.empty()) {
-				KeyRangeToCheck range_to_check(move(table_job->ranges_to_check.top()));
-				table_job->ranges_to_check.pop();
-				table_job->hash_commands++;
+				// if the other end supports it, first find out which rows in the range have changed, so we don't
+				// need to retrieve the rest; otherwise just retrieve the whole range
+				double time_sent = PipelineDepthController::now();
+				if (worker.output_stream.protocol_version > LAST_NO_ROW_HASHES_PROTOCOL_VERSION) {
+					send_row_hashes_command(table, range_to_retrieve);
+				} else {
+					send_rows_command(table, range_to_retrieve);
+				}
+				command_sent(time_sent);
+
+			} else if (pipeline_depth.can_send() && !table_job->ranges_to_check.empty()) {
+				// if the other end supports it, take a batch of ranges to check in one command, to save round trips
+				// when there are many ranges queued (typically when hunting errors); otherwise just take one.  hash
+				// tree ranges are always sent on their own since each needs its own command.
+				size_t max_ranges_to_check = (worker.output_stream.protocol_version > LAST_SINGLE_RANGE_HASH_PROTOCOL_VERSION ? DEFAULT_MAX_RANGES_TO_HASH_AT_ONCE : 1);
+				vector<KeyRangeToCheck> ranges_to_check;
+				while (ranges_to_check.size() < max_ranges_to_check && !table_job->ranges_to_check.empty() &&
+					(ranges_to_check.empty() || (!ranges_to_check.front().bytes_per_leaf && !table_job->ranges_to_check.top().bytes_per_leaf))) {
+					ranges_to_check.emplace_back(move(table_job->ranges_to_check.top()));
+					table_job->ranges_to_check.pop();
+					table_job->hash_commands++;
+				}
 				lock.unlock(); // don't hold the mutex while doing IO
 
-				outstanding_commands++;
-				send_hash_command(table_job, range_to_check, ranges_hashed);
+				// note that we hash our end of the range after sending the command, which counts towards the round trip
+				double time_sent = PipelineDepthController::now();
+				if (ranges_to_check.front().bytes_per_leaf) {
+					send_hash_tree_command(table_job->table, ranges_to_check.front(), hash_trees_requested);
+				} else if (ranges_to_check.size() == 1) {
+					send_hash_command(table_job, ranges_to_check.front(), ranges_hashed, row_applier);
+				} else {
+					send_hash_multi_command(table_job, ranges_to_check, ranges_hashed, row_applier);
+				}
+				command_sent(time_sent);
 
-			} else if (outstanding_commands > 0) {
+			} else if (pipeline_depth.outstanding() > 0) {
 				lock.unlock(); // don't hold the mutex while doing IO; note we still had to lock the mutex in order to check the emptiness of those lists
-				handle_response(table_job, ranges_hashed, row_replacer);
-				outstanding_commands--;
+				handle_response(table_job, ranges_hashed, hash_trees_requested, keys_to_retrieve, keys_requested, row_applier);
+				response_received(table);
 
-			} else if (writer && table_job->hash_commands_completed < table_job->hash_commands) {
+			} else if (writer && (table_job->hash_commands_completed < table_job->hash_commands || table_job->borrowed_rows_commands_completed < table_job->borrowed_rows_commands)) {
 				// wait for the other worker(s) to complete their task, then wake up to see if there is anything for us to do
-				// note that they have to send back any mutation tasks (ie. ranges_to_retrieve) since only one database
-				// connection may mutate a table, to avoid fighting for locks; we can also compete for ranges_to_check ourselves
+				// note that unless the table allows concurrent writers, they have to send back any mutation tasks (ie.
+				// ranges_to_retrieve) since only one database connection may mutate a table, to avoid fighting for locks;
+				// we can also compete for ranges_to_check ourselves
 				table_job->borrowed_task_completed.wait(lock);
 
 			} else if (writer) {
@@ -125,6 +191,7 @@ struct SyncToAlgorithm {
 				lock.unlock(); // don't hold the mutex while doing IO
 
 				// make sure all pending updates have been applied
+				row_applier.wait();
 				row_replacer.apply();
 
 				// wrap up, log it, and potentially commit it
@@ -137,6 +204,7 @@ struct SyncToAlgorithm {
 			} else {
 				// nothing left to help with on this table at the moment, look for other tables with work to share
 				lock.unlock(); // don't hold the mutex while doing IO
+				if (rows_commands_borrowed) finish_borrowed_rows_commands(table_job, row_applier, row_replacer, rows_commands_borrowed);
 				send_idle_command(); // clear the status at the other end so admins aren't confused
 				return;
 			}
@@ -147,26 +215,129 @@ struct SyncToAlgorithm {
 		}
 	}
 
+	void finish_borrowed_rows_commands(const shared_ptr<TableJob> &table_job, AsyncRowApplier<DatabaseClient> &row_applier, RowReplacer<DatabaseClient> &row_replacer, size_t rows_commands_borrowed) {
+		// make sure all our updates have been applied, and if committing per table, committed, before the writer
+		// finishes the table
+		row_applier.wait();
+		row_replacer.apply();
+
+		if (worker.commit_level >= CommitLevel::tables) {
+			worker.commit();
+			client.start_write_transaction();
+		}
+
+		std::unique_lock<std::mutex> lock(table_job->mutex);
+		table_job->borrowed_rows_commands_completed += rows_commands_borrowed;
+		table_job->rows_changed_by_borrowers += row_replacer.rows_changed;
+		table_job->borrowed_task_completed.notify_all();
+	}
+
+	inline void command_sent(double time_sent) {
+		pipeline_depth.command_sent(time_sent, worker.output_stream.total_bytes_written);
+	}
+
+	inline void response_received(const Table &table) {
+		if (pipeline_depth.response_received(PipelineDepthController::now(), worker.input_stream.total_bytes_read) && worker.verbose > 1) {
+			cout << timestamp() << " worker " << worker.worker_number << " pipeline depth " << pipeline_depth.depth << " for " << table.name
+			     << " (round trip " << pipeline_depth.smoothed_rtt*1000 << "ms, base " << pipeline_depth.base_rtt*1000 << "ms, "
+			     << pipeline_depth.smoothed_bytes_per_second/1024 << "KB/s, bandwidth-delay product " << pipeline_depth.bandwidth_delay_product()/1024 << "KB)" << endl;
+		}
+	}
+
 	inline void send_rows_command(const Table &table, const KeyRange &range_to_retrieve) {
 		const ColumnValues &prev_key(get<0>(range_to_retrieve));
 		const ColumnValues &last_key(get<1>(range_to_retrieve));
-		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- rows " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << endl;
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- rows " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << endl;
 		send_command(output, Commands::ROWS, table.name, prev_key, last_key);
 	}
 
-	inline void send_hash_command(const shared_ptr<TableJob> &table_job, const KeyRangeToCheck &range_to_check, list<HashResult> &ranges_hashed) {
+	inline void send_row_hashes_command(const Table &table, const KeyRange &range_to_retrieve) {
+		const ColumnValues &prev_key(get<0>(range_to_retrieve));
+		const ColumnValues &last_key(get<1>(range_to_retrieve));
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- row hashes " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << endl;
+		send_command(output, Commands::ROW_HASHES, table.name, prev_key, last_key);
+	}
+
+	inline void send_rows_by_keys_command(const Table &table, const vector<ColumnValues> &keys) {
+		// the first array gives the table name, followed by one array for each key
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- rows by keys " << table.name << ' ' << keys.size() << " keys" << endl;
+		send_command_begin(output, Commands::ROWS_BY_KEYS, table.name);
+		for (const ColumnValues &key : keys) {
+			output << key;
+		}
+		send_command_end(output);
+	}
+
+	inline void send_hash_command(const shared_ptr<TableJob> &table_job, const KeyRangeToCheck &range_to_check, list<HashResult> &ranges_hashed, AsyncRowApplier<DatabaseClient> &row_applier) {
 		const Table &table(table_job->table);
 		const ColumnValues &prev_key(get<0>(range_to_check.key_range));
 		const ColumnValues &last_key(get<1>(range_to_check.key_range));
 		if (range_to_check.rows_to_hash == 0) throw logic_error("Can't hash 0 rows");
 
 		// tell the other end to hash this range
-		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- hash " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << ' ' << range_to_check.rows_to_hash << endl;
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- hash " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << range_to_check.rows_to_hash << endl;
 		send_command(output, Commands::HASH, table.name, prev_key, last_key, range_to_check.rows_to_hash);
 
-		// while that end is working, do the same at our end
-		RowHasherAndLastKey hasher(hash_algorithm, table.primary_key_columns);
-		size_t row_count = retrieve_rows(client, hasher, table, prev_key, last_key, range_to_check.rows_to_hash);
+		// while that end is working, do the same at our end, once any rows we've received have been applied
+		row_applier.wait();
+		hash_range(table_job, range_to_check, ranges_hashed);
+	}
+
+	inline void send_hash_multi_command(const shared_ptr<TableJob> &table_job, const vector<KeyRangeToCheck> &ranges_to_check, list<HashResult> &ranges_hashed, AsyncRowApplier<DatabaseClient> &row_applier) {
+		const Table &table(table_job->table);
+
+		// tell the other end to hash all these ranges; the first array gives the table name, followed by one array for each range
+		send_command_begin(output, Commands::HASH_MULTI, table.name);
+		for (const KeyRangeToCheck &range_to_check : ranges_to_check) {
+			const ColumnValues &prev_key(get<0>(range_to_check.key_range));
+			const ColumnValues &last_key(get<1>(range_to_check.key_range));
+			if (range_to_check.rows_to_hash == 0) throw logic_error("Can't hash 0 rows");
+			if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- hash " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << range_to_check.rows_to_hash << endl;
+			send_array(output, prev_key, last_key, range_to_check.rows_to_hash);
+		}
+		send_command_end(output);
+
+		// while that end is working, do the same at our end; the results come back in the same order
+		row_applier.wait();
+		for (const KeyRangeToCheck &range_to_check : ranges_to_check) {
+			hash_range(table_job, range_to_check, ranges_hashed);
+		}
+	}
+
+	inline void send_hash_tree_command(const Table &table, const KeyRangeToCheck &range_to_check, list<KeyRangeToCheck> &hash_trees_requested) {
+		const ColumnValues &prev_key(get<0>(range_to_check.key_range));
+		const ColumnValues &last_key(get<1>(range_to_check.key_range));
+
+		// tell the other end to hash the leaves of this range; unlike the other hash commands, we can't start on our
+		// own hashing until the response comes back, since it's the other end that decides where the leaves split
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " <- hash tree " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << range_to_check.bytes_per_leaf << endl;
+		send_command(output, Commands::HASH_TREE, table.name, prev_key, last_key, range_to_check.bytes_per_leaf);
+		hash_trees_requested.push_back(range_to_check);
+	}
+
+	inline void hash_range(const shared_ptr<TableJob> &table_job, const KeyRangeToCheck &range_to_check, list<HashResult> &ranges_hashed) {
+		const Table &table(table_job->table);
+		const ColumnValues &prev_key(get<0>(range_to_check.key_range));
+		const ColumnValues &last_key(get<1>(range_to_check.key_range));
+
+		size_t row_count, our_size;
+		string our_hash;
+		ColumnValues our_last_key;
+
+		if (worker.hash_in_database) {
+			// the database only gives us the digest, so we need another query to find the last key; only this end needs it
+			DatabaseHashCollector hasher(hash_rows_in_database(client, table, prev_key, last_key, range_to_check.rows_to_hash));
+			row_count = hasher.row_count;
+			our_size = hasher.size;
+			our_hash = move(hasher.hash);
+			if (row_count) our_last_key = key_at_offset(client, table, prev_key, last_key, row_count - 1);
+		} else {
+			PipelinedRowHasherAndLastKey hasher(hash_algorithm, table.primary_key_columns);
+			row_count = retrieve_rows(client, hasher, table, prev_key, last_key, range_to_check.rows_to_hash);
+			our_size = hasher.size;
+			our_hash = hasher.finish().to_string();
+			our_last_key = move(hasher.last_key);
+		}
 
 		// when the table has a subdividable primary key, we try to break the remaining range into two, so that if
 		// there's another worker free it can start checking the second half.  we don't actually queue either half
@@ -177,12 +348,12 @@ struct SyncToAlgorithm {
 		if (table_job->subdividable && // subdividable is immutable, don't need to lock to access it
 			range_to_check.estimated_rows_in_range == UNKNOWN_ROW_COUNT && // only subdivide when scanning forward, not recursing for errors
 			row_count == range_to_check.rows_to_hash && // don't subdivide if we're at the end of the table
-			hasher.last_key != last_key) { // don't subdivide if we're at the end of the table
+			our_last_key != last_key) { // don't subdivide if we're at the end of the table
 			// find the key about halfway through the range.  we could find the key more exactly using count queries
 			// and limit/offset queries, but this would be incredibly expensive for a large table, so we estimate by
 			// interpolating the actual key range values, and then do a query to find the next actual key.  finding
 			// an actual key is not required for correctness, but makes testing easier.
-			next_midpoint = std::move(first_key_not_earlier_than(client, table, subdivide_primary_key_range(table, hasher.last_key, last_key), hasher.last_key, last_key));
+			next_midpoint = std::move(first_key_not_earlier_than(client, table, subdivide_primary_key_range(table, our_last_key, last_key), our_last_key, last_key));
 		}
 
 		// and store the hash away temporarily for us to check when the corresponding response comes back
@@ -193,13 +364,13 @@ struct SyncToAlgorithm {
 			range_to_check.estimated_rows_in_range,
 			range_to_check.priority,
 			row_count,
-			hasher.size,
-			hasher.finish().to_string(),
-			hasher.last_key,
+			our_size,
+			our_hash,
+			our_last_key,
 			std::move(next_midpoint));
 	}
 
-	inline void handle_response(const shared_ptr<TableJob> &table_job, list<HashResult> &ranges_hashed, RowReplacer<DatabaseClient> &row_replacer) {
+	inline void handle_response(const shared_ptr<TableJob> &table_job, list<HashResult> &ranges_hashed, list<KeyRangeToCheck> &hash_trees_requested, list<vector<ColumnValues>> &keys_to_retrieve, list<vector<ColumnValues>> &keys_requested, AsyncRowApplier<DatabaseClient> &row_applier) {
 		verb_t verb;
 		input >> verb;
 
@@ -208,8 +379,24 @@ struct SyncToAlgorithm {
 				handle_hash_response(table_job, ranges_hashed);
 				break;
 
+			case Commands::HASH_MULTI:
+				handle_hash_multi_response(table_job, ranges_hashed);
+				break;
+
+			case Commands::HASH_TREE:
+				handle_hash_tree_response(table_job, hash_trees_requested, row_applier);
+				break;
+
 			case Commands::ROWS:
-				handle_rows_response(table_job->table, row_replacer);
+				handle_rows_response(table_job->table, row_applier);
+				break;
+
+			case Commands::ROW_HASHES:
+				handle_row_hashes_response(table_job->table, keys_to_retrieve, row_applier);
+				break;
+
+			case Commands::ROWS_BY_KEYS:
+				handle_rows_by_keys_response(table_job->table, keys_requested, row_applier);
 				break;
 
 			default:
@@ -217,26 +404,31 @@ struct SyncToAlgorithm {
 		}
 	}
 
-	void handle_range_response(const shared_ptr<TableJob> &table_job, RowReplacer<DatabaseClient> &row_replacer) {
+	void handle_range_response(const shared_ptr<TableJob> &table_job, AsyncRowApplier<DatabaseClient> &row_applier) {
 		string _table_name;
 		ColumnValues their_first_key, their_last_key;
 		read_all_arguments(input, _table_name, their_first_key, their_last_key);
-		if (worker.verbose > 1) cout << timestamp() << " -> range " << table_job->table.name << ' ' << values_list(client, table_job->table, their_first_key) << ' ' << values_list(client, table_job->table, their_last_key) << endl;
+		if (worker.verbose > 1) cout << timestamp() << " -> range " << table_job->table.name << ' ' << log_values_list(table_job->table, their_first_key) << ' ' << log_values_list(table_job->table, their_last_key) << endl;
 
 		if (their_first_key.empty()) {
 			client.execute("DELETE FROM " + client.quote_identifier(table_job->table.name));
 			return;
 		}
 
-		// we immediately know that we need to clear everything < their_first_key or > their_last_key; do that now
-		string key_columns(columns_list(client, table_job->table.columns, table_job->table.primary_key_columns));
-		string delete_from("DELETE FROM " + client.quote_identifier(table_job->table.name) + " WHERE (" + key_columns + ")");
-		client.execute(delete_from + " < " + values_list(client, table_job->table, their_first_key));
-		client.execute(delete_from + " > " + values_list(client, table_job->table, their_last_key));
-
-		// having done that, find our last key, which must now be no greater than their_last_key
+		// if our table is empty (say because it has just been created), we can skip straight to loading all the rows
 		ColumnValues our_last_key(last_key(client, table_job->table));
 
+		if (!our_last_key.empty()) {
+			// we immediately know that we need to clear everything < their_first_key or > their_last_key; do that now
+			string key_columns(columns_list(client, table_job->table.columns, table_job->table.primary_key_columns));
+			string delete_from("DELETE FROM " + client.quote_identifier(table_job->table.name) + " WHERE (" + key_columns + ")");
+			client.execute(delete_from + " < " + values_list(client, table_job->table, their_first_key));
+			client.execute(delete_from + " > " + values_list(client, table_job->table, their_last_key));
+
+			// having done that, find our last key again, which must now be no greater than their_last_key
+			our_last_key = last_key(client, table_job->table);
+		}
+
 		if (!our_last_key.empty()) {
 			// queue up a sync of everything up to our_last_key
 			queue_initial_ranges(table_job, our_last_key, their_first_key, their_last_key);
@@ -252,7 +444,7 @@ struct SyncToAlgorithm {
 		// to the later commands in the pipeline until we're finished with this one, whereas there is a chance that
 		// another worker could become free and process those other tasks in the meantime.
 		if (our_last_key != their_last_key) {
-			request_rows_without_pipelining(table_job, row_replacer, KeyRange(our_last_key, their_last_key));
+			request_rows_without_pipelining(table_job, row_applier, KeyRange(our_last_key, their_last_key), our_last_key.empty());
 		}
 	}
 
@@ -261,43 +453,94 @@ struct SyncToAlgorithm {
 
 		// the way we have defined key ranges to work, we have no way to express start-inclusive ranges to the sync
 		// methods, so we queue a sync from the start (empty key value) up to the last key - but this results in no
-		// actual inefficiency because they'd see the same rows anyway.  we attempt to  do one subdivision straight
-		// away, to facilitate parallelism; if we can't subdivide, \midpoint stays empty so we only queue one range.
-		ColumnValues midpoint;
+		// actual inefficiency because they'd see the same rows anyway.  we attempt to subdivide straight away, to
+		// facilitate parallelism: if there's more than one worker and the database has a histogram for the key, into
+		// one range per worker, otherwise into two; if we can't subdivide, \split_keys stays empty so we only queue one range.
+		vector<ColumnValues> split_keys;
 		if (table_job->subdividable) {
-			midpoint = move(first_key_not_earlier_than(client, table_job->table, subdivide_primary_key_range(table_job->table, their_first_key /* ideally for consistency we'd use this value minus one, but it doesn't actually matter */, their_last_key /* our_last_key would be better but might be < their_first_key and that is unsupported */), ColumnValues(), our_last_key));
+			split_keys = equal_population_split_keys(client, table_job->table, sync_queue.workers, our_last_key);
+			if (split_keys.empty()) {
+				ColumnValues midpoint(first_key_not_earlier_than(client, table_job->table, subdivide_primary_key_range(table_job->table, their_first_key /* ideally for consistency we'd use this value minus one, but it doesn't actually matter */, their_last_key /* our_last_key would be better but might be < their_first_key and that is unsupported */), ColumnValues(), our_last_key));
+				if (!midpoint.empty()) split_keys.push_back(move(midpoint));
+			} else if (worker.verbose > 1) {
+				cout << timestamp() << " worker " << worker.worker_number << " splitting " << table_job->table.name << " into " << split_keys.size() + 1 << " ranges using the database's histogram" << endl;
+			}
 		}
-		if (!midpoint.empty()) {
-			table_job->ranges_to_check.emplace(ColumnValues(), midpoint, UNKNOWN_ROW_COUNT, 1 /* start with 1 row and build up */, 0);
+
+		// when using hash trees, each range is hashed in one pass at each end with leaves of up to the maximum block size,
+		// and we then descend into the leaves that don't match; otherwise we scan forward, starting with 1 row and building
+		// up.  if we have statistics from the last run, we can start from the sizes that suited the table then instead.
+		const TableStatistics &previous_statistics(table_job->previous_statistics);
+		size_t bytes_per_leaf = 0, rows_to_hash = 1;
+		if (worker.hash_tree && worker.output_stream.protocol_version > LAST_NO_HASH_TREE_PROTOCOL_VERSION) {
+			table_job->hash_tree_fanout = previous_statistics.hash_tree_fanout(DEFAULT_HASH_TREE_FANOUT, target_maximum_block_size);
+			bytes_per_leaf = previous_statistics.initial_bytes_per_leaf(target_minimum_block_size, target_maximum_block_size, table_job->hash_tree_fanout);
+		} else {
+			rows_to_hash = previous_statistics.initial_rows_to_hash(target_maximum_block_size);
 		}
-		if (midpoint != our_last_key) {
-			table_job->ranges_to_check.emplace(midpoint, our_last_key, UNKNOWN_ROW_COUNT, 1 /* start with 1 row and build up */, 0);
+		if (worker.verbose > 1 && previous_statistics.rows) cout << timestamp() << " worker " << worker.worker_number << " starting " << table_job->table.name << " with " << (bytes_per_leaf ? to_string(bytes_per_leaf) + " bytes per leaf and fan-out " + to_string(table_job->hash_tree_fanout) : to_string(rows_to_hash) + " rows") << " from the previous run's statistics" << endl;
+
+		ColumnValues prev_key;
+		for (ColumnValues &split_key : split_keys) {
+			table_job->ranges_to_check.emplace(prev_key, split_key, UNKNOWN_ROW_COUNT, rows_to_hash, 0, bytes_per_leaf);
+			prev_key = move(split_key);
+		}
+		if (prev_key != our_last_key) {
+			table_job->ranges_to_check.emplace(prev_key, our_last_key, UNKNOWN_ROW_COUNT, rows_to_hash, 0, bytes_per_leaf);
 		}
 	}
 
-	void request_rows_without_pipelining(const shared_ptr<TableJob> &table_job, RowReplacer<DatabaseClient> &row_replacer, const KeyRange &range_to_retrieve) {
+	void request_rows_without_pipelining(const shared_ptr<TableJob> &table_job, AsyncRowApplier<DatabaseClient> &row_applier, const KeyRange &range_to_retrieve, bool into_empty_table) {
 		send_rows_command(table_job->table, range_to_retrieve);
 		if (input.next<verb_t>() != Commands::ROWS) throw command_error("Didn't receive response to ROWS command");
-		handle_rows_response(table_job->table, row_replacer, true);
+		handle_rows_response(table_job->table, row_applier, true, into_empty_table);
 
 		std::unique_lock<std::mutex> lock(table_job->mutex);
 		table_job->rows_commands++;
 	}
 
-	void handle_rows_response(const Table &table, RowReplacer<DatabaseClient> &row_replacer, bool final_rows = false) {
-		// we're being sent a range of rows; apply them to our end.  we do this in-context to
-		// provide flow control - if we buffered and used a separate apply thread, we would
-		// bloat up if this end couldn't write to disk as quickly as the other end sent data.
+	void handle_rows_response(const Table &table, AsyncRowApplier<DatabaseClient> &row_applier, bool final_rows = false, bool into_empty_table = false) {
+		// we're being sent a range of rows; apply them to our end.  this is done on the apply thread
+		// so we can decode the next rows while the database works, but the queue to it is bounded
+		// to provide flow control - otherwise we would bloat up if this end couldn't write to disk
+		// as quickly as the other end sent data.
 		string table_name;
 		ColumnValues prev_key, last_key;
 		read_array(input, table_name, prev_key, last_key); // the first array gives the range arguments, which is followed by one array for each row
-		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> rows " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << endl;
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> rows " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << endl;
 
-		if (final_rows) {
-			RowInserter<DatabaseClient>(row_replacer, table).stream_from_input(input);
-		} else {
-			RowRangeApplier<DatabaseClient>(row_replacer, table, prev_key, last_key).stream_from_input(input);
-		}
+		row_applier.stream_from_input(input, prev_key, last_key, final_rows, into_empty_table, worker.input_stream.protocol_version > LAST_ROW_ORIENTED_PROTOCOL_VERSION);
+	}
+
+	void handle_row_hashes_response(const Table &table, list<vector<ColumnValues>> &keys_to_retrieve, AsyncRowApplier<DatabaseClient> &row_applier) {
+		// the first array gives the range arguments, which is followed by one array for each row
+		string table_name;
+		ColumnValues prev_key, last_key;
+		read_array(input, table_name, prev_key, last_key);
+		vector<RowFingerprint> their_fingerprints;
+		read_row_fingerprints(input, their_fingerprints);
+		if (table_name != table.name) throw command_error("Didn't issue row hashes command for " + table_name);
+
+		// compare them to the same rows at our end, once any rows we've received have been applied
+		row_applier.wait();
+		RowFingerprintCollector our_fingerprints(table.primary_key_columns);
+		retrieve_rows(client, our_fingerprints, table, prev_key, last_key);
+		vector<ColumnValues> keys(keys_of_changed_rows(our_fingerprints.fingerprints, their_fingerprints));
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> row hashes " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << keys.size() << " of " << max(our_fingerprints.fingerprints.size(), their_fingerprints.size()) << " rows changed" << endl;
+
+		// queue them to be retrieved, in moderately-sized batches
+		batch_keys_to_retrieve(move(keys), keys_to_retrieve);
+	}
+
+	void handle_rows_by_keys_response(const Table &table, list<vector<ColumnValues>> &keys_requested, AsyncRowApplier<DatabaseClient> &row_applier) {
+		// the first array gives the table name, which is followed by the rows, as for handle_rows_response
+		string table_name;
+		read_array(input, table_name);
+		if (keys_requested.empty() || table_name != table.name) throw command_error("Didn't issue rows by keys command for " + table_name);
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> rows by keys " << table.name << ' ' << keys_requested.front().size() << " keys" << endl;
+
+		row_applier.stream_from_input(input, move(keys_requested.front()));
+		keys_requested.pop_front();
 	}
 
 	void handle_hash_response(const shared_ptr<TableJob> &table_job, list<HashResult> &ranges_hashed) {
@@ -306,15 +549,122 @@ struct SyncToAlgorithm {
 		string table_name;
 		ColumnValues prev_key, last_key;
 		read_all_arguments(input, table_name, prev_key, last_key, rows_to_hash, their_row_count, their_hash);
+		handle_hash_result(table_job, ranges_hashed, table_name, prev_key, last_key, rows_to_hash, their_row_count, their_hash);
+	}
+
+	void handle_hash_multi_response(const shared_ptr<TableJob> &table_job, list<HashResult> &ranges_hashed) {
+		// the first array gives the table name, which is followed by one array for each range hashed
+		string table_name;
+		read_array(input, table_name);
+
+		while (size_t array_length = input.next_array_length()) {
+			if (array_length != 5) throw command_error("Expected 5 arguments, got " + to_string(array_length));
+			size_t rows_to_hash, their_row_count;
+			string their_hash;
+			ColumnValues prev_key, last_key;
+			read_values(input, prev_key, last_key, rows_to_hash, their_row_count, their_hash);
+			handle_hash_result(table_job, ranges_hashed, table_name, prev_key, last_key, rows_to_hash, their_row_count, their_hash);
+		}
+	}
+
+	void handle_hash_tree_response(const shared_ptr<TableJob> &table_job, list<KeyRangeToCheck> &hash_trees_requested, AsyncRowApplier<DatabaseClient> &row_applier) {
+		// the first array gives the range arguments, which is followed by one array for each leaf
+		string table_name;
+		ColumnValues prev_key, last_key;
+		size_t bytes_per_leaf;
+		read_array(input, table_name, prev_key, last_key, bytes_per_leaf);
+
+		vector<HashTreeLeaf> their_leaves;
+		while (size_t array_length = input.next_array_length()) {
+			if (array_length != 3) throw command_error("Expected 3 arguments, got " + to_string(array_length));
+			their_leaves.emplace_back();
+			read_values(input, their_leaves.back().last_key, their_leaves.back().row_count, their_leaves.back().hash);
+		}
 
 		const Table &table(table_job->table);
-		if (ranges_hashed.empty()) throw command_error("Haven't issued a hash command for " + table.name + ", received " + values_list(client, table, prev_key) + " " + values_list(client, table, last_key));
+		if (hash_trees_requested.empty()) throw command_error("Haven't issued a hash tree command for " + table.name + ", received " + log_values_list(table, prev_key) + " " + log_values_list(table, last_key));
+		KeyRangeToCheck range_checked(move(hash_trees_requested.front()));
+		hash_trees_requested.pop_front();
+		if (table_name != table.name || prev_key != get<0>(range_checked.key_range) || last_key != get<1>(range_checked.key_range)) throw command_error("Didn't issue hash tree command for " + table.name + " " + log_values_list(table, prev_key) + " " + log_values_list(table, last_key));
+		if (their_leaves.empty() || their_leaves.back().last_key != last_key) throw command_error("Hash tree for " + table.name + " " + log_values_list(table, prev_key) + " " + log_values_list(table, last_key) + " doesn't cover the whole range");
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> hash tree " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << their_leaves.size() << " leaves" << endl;
+
+		// hash the same leaves at our end in one pass over the range, and queue up the ones that don't match to be
+		// descended into
+		row_applier.wait();
+		vector<ColumnValues> leaf_last_keys;
+		for (const HashTreeLeaf &their_leaf : their_leaves) {
+			leaf_last_keys.push_back(their_leaf.last_key);
+		}
+		HashTreeLeafHashers our_leaves(hash_algorithm, their_leaves.size());
+		retrieve_rows_in_leaves(client, our_leaves, table, prev_key, leaf_last_keys, !hash_algorithm_commutative(hash_algorithm));
+
+		vector<KeyRangeToCheck> ranges_to_check;
+		vector<KeyRange> ranges_to_retrieve;
+		size_t rows_scanned = 0, bytes_scanned = 0, rows_mismatched = 0;
+		ColumnValues leaf_prev_key(prev_key);
+		for (size_t leaf = 0; leaf < their_leaves.size(); leaf++) {
+			const HashTreeLeaf &their_leaf(their_leaves[leaf]);
+			RowHasher &hasher(*our_leaves.hashers[leaf]);
+			size_t our_row_count = our_leaves.row_counts[leaf];
+
+			if (hasher.finish() != their_leaf.hash || our_row_count != their_leaf.row_count) {
+				size_t rows_in_leaf = max(our_row_count, their_leaf.row_count);
+
+				if (hasher.size/table_job->hash_tree_fanout > target_minimum_block_size && rows_in_leaf > table_job->hash_tree_fanout) {
+					// still big enough to be worth checking as another level of the tree
+					ranges_to_check.emplace_back(leaf_prev_key, their_leaf.last_key, rows_in_leaf, rows_in_leaf, range_checked.priority + 1, hasher.size/table_job->hash_tree_fanout);
+				} else if (our_row_count > 1 && hasher.size > target_minimum_block_size) {
+					// small enough that the normal search is better, checking half the rows at a time
+					ranges_to_check.emplace_back(leaf_prev_key, their_leaf.last_key, rows_in_leaf, rows_in_leaf/2, range_checked.priority + 1);
+				} else {
+					// not worth reducing the affected row range any further, queue it to be retrieved
+					ranges_to_retrieve.emplace_back(leaf_prev_key, their_leaf.last_key);
+					rows_mismatched += max<size_t>(rows_in_leaf, 1);
+				}
+			}
+
+			if (range_checked.estimated_rows_in_range == UNKNOWN_ROW_COUNT) {
+				// the leaves of the top-level trees cover each row once
+				rows_scanned += our_row_count;
+				bytes_scanned += hasher.size;
+			}
+
+			leaf_prev_key = their_leaf.last_key;
+		}
+
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << "         " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << " has " << (ranges_to_check.size() + ranges_to_retrieve.size()) << " leaves that don't match" << endl;
+
+		std::unique_lock<std::mutex> lock(table_job->mutex);
+
+		for (KeyRangeToCheck &range_to_check : ranges_to_check) {
+			table_job->ranges_to_check.push(move(range_to_check));
+		}
+		for (KeyRange &range_to_retrieve : ranges_to_retrieve) {
+			table_job->ranges_to_retrieve.push_back(move(range_to_retrieve));
+		}
+		table_job->rows_scanned += rows_scanned;
+		table_job->bytes_scanned += bytes_scanned;
+		table_job->rows_mismatched += rows_mismatched;
+
+		table_job->hash_commands_completed++;
+
+		if (table_job->notify_when_work_could_be_shared) {
+			table_job->borrowed_task_completed.notify_all(); // as for handle_hash_result
+			lock.unlock();
+			sync_queue.have_work_to_share(table_job);
+		}
+	}
+
+	void handle_hash_result(const shared_ptr<TableJob> &table_job, list<HashResult> &ranges_hashed, const string &table_name, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows_to_hash, size_t their_row_count, const string &their_hash) {
+		const Table &table(table_job->table);
+		if (ranges_hashed.empty()) throw command_error("Haven't issued a hash command for " + table.name + ", received " + log_values_list(table, prev_key) + " " + log_values_list(table, last_key));
 		HashResult hash_result(move(ranges_hashed.front()));
 		ranges_hashed.pop_front();
-		if (table_name != table.name || prev_key != hash_result.prev_key || last_key != hash_result.last_key) throw command_error("Didn't issue hash command for " + table.name + " " + values_list(client, table, prev_key) + " " + values_list(client, table, last_key));
+		if (table_name != table.name || prev_key != hash_result.prev_key || last_key != hash_result.last_key) throw command_error("Didn't issue hash command for " + table.name + " " + log_values_list(table, prev_key) + " " + log_values_list(table, last_key));
 
 		bool match = (hash_result.our_hash == their_hash && hash_result.our_row_count == their_row_count);
-		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> hash " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << ' ' << their_row_count << (match ? " matches" : " doesn't match") << endl;
+		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << " -> hash " << table.name << ' ' << log_values_list(table, prev_key) << ' ' << log_values_list(table, last_key) << ' ' << their_row_count << (match ? " matches" : " doesn't match") << endl;
 
 		std::unique_lock<std::mutex> lock(table_job->mutex);
 
@@ -324,6 +674,7 @@ struct SyncToAlgorithm {
 			// the rest of the table); queue it to be scanned
 			if (hash_result.estimated_rows_in_range == UNKNOWN_ROW_COUNT) {
 				// we're scanning forward, do that last
+				if (match) table_job->rows_per_block = max(table_job->rows_per_block, rows_to_hash);
 				size_t rows_to_hash_next = rows_to_scan_forward_next(rows_to_hash, match, hash_result.our_row_count, hash_result.our_size);
 
 				// as discussed in send_hash_command, when the table has a subdividable primary key, we
@@ -362,9 +713,16 @@ struct SyncToAlgorithm {
 			} else {
 				// not worth reducing the affected row range any further, queue it to be retrieved
 				table_job->ranges_to_retrieve.emplace_back(prev_key, hash_result.our_last_key);
+				table_job->rows_mismatched += max<size_t>(max(hash_result.our_row_count, their_row_count), 1);
 			}
 		}
 
+		if (hash_result.estimated_rows_in_range == UNKNOWN_ROW_COUNT) {
+			// the forward scan covers each row once
+			table_job->rows_scanned += hash_result.our_row_count;
+			table_job->bytes_scanned += hash_result.our_size;
+		}
+
 		table_job->hash_commands_completed++;
 
 		if (worker.verbose > 1) cout << timestamp() << " worker " << worker.worker_number << "         " << table.name << " has " << table_job->ranges_to_check.size() << " range(s) to check and " << table_job->ranges_to_retrieve.size() << " to retrieve, " << string(table_job->notify_when_work_could_be_shared ? "sharing wanted" : "sharing not needed") << endl;
@@ -409,4 +767,5 @@ struct SyncToAlgorithm {
 	HashAlgorithm hash_algorithm;
 	size_t target_minimum_block_size;
 	size_t target_maximum_block_size;
+	PipelineDepthController pipeline_depth; // kept for the life of the worker, so each table starts from what we learnt on the last
 };
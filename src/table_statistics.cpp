@@ -0,0 +1,92 @@
+#include "table_statistics.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include "yaml-cpp/yaml.h"
+
+using namespace std;
+
+StatisticsByTable load_statistics(const string &statistics_file) {
+	StatisticsByTable statistics;
+
+	// the file won't exist until the first run has finished
+	ifstream input(statistics_file);
+	if (!input) return statistics;
+
+	try {
+		YAML::Node config(YAML::Load(input));
+
+		for (YAML::const_iterator table_it = config.begin(); table_it != config.end(); ++table_it) {
+			string table_name(table_it->first.as<string>());
+			TableStatistics &table_statistics(statistics[table_name]);
+			const YAML::Node &node(table_it->second);
+
+			if (node["rows"])             table_statistics.rows             = node["rows"].as<size_t>();
+			if (node["mismatch_density"]) table_statistics.mismatch_density = node["mismatch_density"].as<double>();
+			if (node["average_row_size"]) table_statistics.average_row_size = node["average_row_size"].as<size_t>();
+			if (node["rows_per_block"])   table_statistics.rows_per_block   = node["rows_per_block"].as<size_t>();
+			if (node["seconds"])          table_statistics.seconds          = node["seconds"].as<double>();
+		}
+	} catch (const YAML::Exception &e) {
+		throw statistics_file_error("Couldn't read statistics file " + statistics_file + ": " + e.what());
+	}
+
+	return statistics;
+}
+
+void save_statistics(const string &statistics_file, const StatisticsByTable &statistics) {
+	YAML::Emitter emitter;
+	emitter << YAML::BeginMap;
+	for (auto const &it : statistics) {
+		const TableStatistics &table_statistics(it.second);
+		emitter << YAML::Key << it.first << YAML::Value << YAML::BeginMap;
+		emitter << YAML::Key << "rows"             << YAML::Value << table_statistics.rows;
+		emitter << YAML::Key << "mismatch_density" << YAML::Value << table_statistics.mismatch_density;
+		emitter << YAML::Key << "average_row_size" << YAML::Value << table_statistics.average_row_size;
+		emitter << YAML::Key << "rows_per_block"   << YAML::Value << table_statistics.rows_per_block;
+		emitter << YAML::Key << "seconds"          << YAML::Value << table_statistics.seconds;
+		emitter << YAML::EndMap;
+	}
+	emitter << YAML::EndMap;
+
+	// write the new file alongside and then move it into place, so we never leave a partial file behind
+	string temporary_file(statistics_file + ".new");
+	{
+		ofstream output(temporary_file);
+		output << emitter.c_str() << endl;
+		if (!output) throw statistics_file_error("Couldn't write statistics file " + temporary_file + ": " + strerror(errno));
+	}
+	if (rename(temporary_file.c_str(), statistics_file.c_str()) < 0) {
+		throw statistics_file_error("Couldn't replace statistics file " + statistics_file + ": " + strerror(errno));
+	}
+}
+
+TableWorkEstimator::TableWorkEstimator(const StatisticsByTable &previous_statistics, const TableSizes &from_sizes, const TableSizes &to_sizes): previous_statistics(previous_statistics), from_sizes(from_sizes), to_sizes(to_sizes), seconds_per_byte(0) {
+	double total_seconds = 0;
+	size_t total_bytes = 0;
+	for (auto const &it : previous_statistics) {
+		size_t bytes = size_of(it.first);
+		if (it.second.seconds > 0 && bytes > 0) {
+			total_seconds += it.second.seconds;
+			total_bytes += bytes;
+		}
+	}
+	if (total_bytes) seconds_per_byte = total_seconds/total_bytes;
+}
+
+double TableWorkEstimator::operator()(const string &table_name) const {
+	if (seconds_per_byte > 0) {
+		auto it = previous_statistics.find(table_name);
+		if (it != previous_statistics.end() && it->second.seconds > 0) return it->second.seconds/seconds_per_byte;
+	}
+	return size_of(table_name);
+}
+
+size_t TableWorkEstimator::size_of(const string &table_name) const {
+	auto from_it = from_sizes.find(table_name);
+	auto to_it = to_sizes.find(table_name);
+	return max(from_it == from_sizes.end() ? 0 : from_it->second, to_it == to_sizes.end() ? 0 : to_it->second);
+}
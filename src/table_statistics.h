@@ -0,0 +1,83 @@
+#ifndef TABLE_STATISTICS_H
+#define TABLE_STATISTICS_H
+
+#include <string>
+#include <map>
+#include <stdexcept>
+
+using namespace std;
+
+// optionally, the 'to' end records what it found in each table so that the next run can start from there, rather
+// than scanning forward from a single row and doubling up to the maximum block size for every table again.
+struct TableStatistics {
+	TableStatistics(): rows(0), mismatch_density(0), average_row_size(0), rows_per_block(0), seconds(0) {}
+
+	size_t rows;
+	double mismatch_density; // the fraction of rows that were retrieved because their hashes didn't match
+	size_t average_row_size; // in bytes, as hashed
+	size_t rows_per_block;   // the largest block the forward scan reached, or zero if the table was checked using hash trees
+	double seconds;          // from starting the table until all its rows were applied
+
+	// the number of rows to hash in the first block when scanning forward.  we can go straight to the size we
+	// reached last time, unless the maximum block size has changed, or the changes last time were so dense that
+	// we'd expect to find one in the first block (in which case we'd only have to go back and hash it again).
+	size_t initial_rows_to_hash(size_t target_maximum_block_size) const {
+		if (!rows_per_block) return 1;
+		size_t result = rows_per_block;
+		if (average_row_size && result > target_maximum_block_size/average_row_size) {
+			result = target_maximum_block_size/average_row_size;
+		}
+		if (mismatch_density > 0 && result > 1/mismatch_density) {
+			result = 1/mismatch_density;
+		}
+		return max<size_t>(result, 1);
+	}
+
+	// the leaf size to start hash trees at.  normally this is the maximum block size, but if changes were dense
+	// last time then most leaves that size would not match, and the first level would tell us nothing.
+	size_t initial_bytes_per_leaf(size_t target_minimum_block_size, size_t target_maximum_block_size, size_t fanout) const {
+		if (mismatch_density <= 0 || !average_row_size || average_row_size/mismatch_density >= target_maximum_block_size) {
+			return target_maximum_block_size;
+		}
+		return max<size_t>(average_row_size/mismatch_density, min(target_minimum_block_size*fanout, target_maximum_block_size));
+	}
+
+	// the number of smaller leaves to break each mismatching hash tree leaf into.  when the changes were isolated
+	// last time, each mismatching leaf typically has only one change in it, so we use a wider fan-out to get down
+	// to it in fewer round trips; when they're dense, most leaves at each level need checking anyway.
+	size_t hash_tree_fanout(size_t default_fanout, size_t target_maximum_block_size) const {
+		if (!rows || !average_row_size || mismatch_density*target_maximum_block_size/average_row_size > 1) {
+			return default_fanout;
+		}
+		return default_fanout*4;
+	}
+};
+
+typedef map<string, TableStatistics> StatisticsByTable;
+
+typedef map<string, size_t> TableSizes; // in bytes, as estimated by the database's own statistics
+
+// estimates how much work each table will be, so that the biggest tables can be started first rather than becoming
+// the long tail that one worker finishes alone while the others sit idle.  without any history we go by the larger
+// of the two ends' table sizes.  once we have the time each table took last run, we use that instead, converted back
+// into bytes at the overall rate we saw, so that the tables we know about and the tables we don't can be compared.
+struct TableWorkEstimator {
+	TableWorkEstimator(const StatisticsByTable &previous_statistics, const TableSizes &from_sizes, const TableSizes &to_sizes);
+
+	double operator()(const string &table_name) const;
+	size_t size_of(const string &table_name) const;
+
+	const StatisticsByTable &previous_statistics;
+	const TableSizes &from_sizes;
+	const TableSizes &to_sizes;
+	double seconds_per_byte;
+};
+
+struct statistics_file_error: public runtime_error {
+	statistics_file_error(const string &error): runtime_error(error) { }
+};
+
+StatisticsByTable load_statistics(const string &statistics_file);
+void save_statistics(const string &statistics_file, const StatisticsByTable &statistics);
+
+#endif
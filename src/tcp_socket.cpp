@@ -0,0 +1,131 @@
+#include "tcp_socket.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static void split_address(const string &address, string &host, string &port) {
+	size_t colon = address.rfind(':');
+	if (colon == string::npos) {
+		host = "";
+		port = address;
+	} else {
+		host = address.substr(0, colon);
+		port = address.substr(colon + 1);
+	}
+	if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+		host = host.substr(1, host.size() - 2);
+	}
+	if (port.empty()) {
+		throw runtime_error("No port given in address " + address);
+	}
+}
+
+static struct addrinfo *resolve(const string &address, bool passive) {
+	string host, port;
+	split_address(address, host, port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (passive) hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo *result;
+	int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+	if (error) {
+		throw runtime_error("Couldn't resolve " + address + ": " + gai_strerror(error));
+	}
+	return result;
+}
+
+static void set_no_delay(int fd) {
+	// we always flush complete commands and responses, so there's nothing to gain by delaying them
+	int value = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+}
+
+int TCPSocket::listen(const string &address) {
+	struct addrinfo *addresses = resolve(address, true);
+	int error = 0;
+
+	for (struct addrinfo *ai = addresses; ai; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+
+		int value = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+
+		if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+			freeaddrinfo(addresses);
+			return fd;
+		}
+
+		error = errno;
+		close(fd);
+	}
+
+	freeaddrinfo(addresses);
+	throw runtime_error("Couldn't listen on " + address + ": " + string(strerror(error)));
+}
+
+int TCPSocket::accept(int listener) {
+	while (true) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		if (fd >= 0) {
+			set_no_delay(fd);
+			return fd;
+		}
+		if (errno != EINTR && errno != ECONNABORTED) {
+			throw runtime_error("Couldn't accept connection: " + string(strerror(errno)));
+		}
+	}
+}
+
+int TCPSocket::connect(const string &address) {
+	struct addrinfo *addresses = resolve(address, false);
+	int error = 0;
+
+	for (struct addrinfo *ai = addresses; ai; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+
+		int result;
+		do { result = ::connect(fd, ai->ai_addr, ai->ai_addrlen); } while (result < 0 && errno == EINTR);
+		if (result == 0) {
+			freeaddrinfo(addresses);
+			set_no_delay(fd);
+			return fd;
+		}
+
+		error = errno;
+		close(fd);
+	}
+
+	freeaddrinfo(addresses);
+	throw runtime_error("Couldn't connect to " + address + ": " + string(strerror(error)));
+}
+
+int TCPSocket::local_port(int fd) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+		throw runtime_error("Couldn't get socket address: " + string(strerror(errno)));
+	}
+	if (addr.ss_family == AF_INET6) {
+		return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+	} else {
+		return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+	}
+}
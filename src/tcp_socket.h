@@ -0,0 +1,19 @@
+#ifndef TCP_SOCKET_H
+#define TCP_SOCKET_H
+
+#include <string>
+
+using namespace std;
+
+// plain, unencrypted TCP connections for use on trusted networks, as an alternative to SSH.
+// addresses are given as host:port (or [host]:port for IPv6 addresses); when listening the
+// host may be omitted to listen on all interfaces.
+class TCPSocket {
+public:
+	static int listen(const string &address);
+	static int accept(int listener);
+	static int connect(const string &address);
+	static int local_port(int fd);
+};
+
+#endif
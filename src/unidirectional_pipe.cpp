@@ -5,6 +5,7 @@
 #include <cerrno>
 #include <cstring>
 #include <unistd.h>
+#include <fcntl.h>
 
 using namespace std;
 
@@ -52,3 +53,21 @@ void UnidirectionalPipe::close_write() {
 		pipe_handles[1] = 0;
 	}
 }
+
+static int detach(int &handle, int min_fd) {
+	int result = fcntl(handle, F_DUPFD, min_fd);
+	if (result < 0) {
+		throw runtime_error("Couldn't move descriptor: " + string(strerror(errno)));
+	}
+	close(handle);
+	handle = 0;
+	return result;
+}
+
+int UnidirectionalPipe::detach_read(int min_fd) {
+	return detach(pipe_handles[0], min_fd);
+}
+
+int UnidirectionalPipe::detach_write(int min_fd) {
+	return detach(pipe_handles[1], min_fd);
+}
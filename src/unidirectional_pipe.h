@@ -14,6 +14,10 @@ public:
 	void close_read();
 	void close_write();
 
+	// moves our end to a new descriptor numbered at least min_fd, which the caller then owns
+	int detach_read(int min_fd);
+	int detach_write(int min_fd);
+
 private:
 	int pipe_handles[2];
 
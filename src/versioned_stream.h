@@ -2,15 +2,82 @@
 #define VERSIONED_STREAM_H
 
 #include "fdstream.h"
+#include "stream_compression.h"
 
 struct VersionedFDWriteStream: FDWriteStream {
 	VersionedFDWriteStream(int fd): FDWriteStream(fd), protocol_version(0) {}
+
+	// all data written after this call will be compressed using the given algorithm; anything
+	// written before is flushed out uncompressed first.
+	void start_compression(CompressionAlgorithm compression_algorithm, int compression_level) {
+		flush();
+		compressor = create_stream_compressor(compression_algorithm, compression_level);
+	}
+
+	virtual void flush() {
+		empty_buf();
+		if (compressor) compress(nullptr, 0, true);
+	}
+
 	int protocol_version;
+
+protected:
+	virtual void write_buf(const uint8_t* ptr, size_t bytes) {
+		if (compressor) {
+			compress(ptr, bytes, false);
+		} else {
+			FDWriteStream::write_buf(ptr, bytes);
+		}
+	}
+
+	void compress(const uint8_t* ptr, size_t bytes, bool flush) {
+		do {
+			size_t compressed_bytes = compressor->compress(ptr, bytes, flush, compressed_buf, sizeof(compressed_buf));
+			if (compressed_bytes) FDWriteStream::write_buf(compressed_buf, compressed_bytes);
+		} while (!compressor->done());
+	}
+
+	std::unique_ptr<StreamCompressor> compressor;
+	uint8_t compressed_buf[16384];
 };
 
 struct VersionedFDReadStream: FDReadStream {
-	VersionedFDReadStream(int fd): FDReadStream(fd), protocol_version(0) {}
+	VersionedFDReadStream(int fd): FDReadStream(fd), protocol_version(0), compressed_pos(0), compressed_avail(0) {}
+
+	// all data read after this call will be decompressed using the given algorithm.  the other end
+	// must not send anything more until it knows we have made this call, since we may already have
+	// read and buffered it otherwise.
+	void start_decompression(CompressionAlgorithm compression_algorithm) {
+		if (buf_avail) throw stream_error("Received unexpected data before switching to compressed stream");
+		decompressor = create_stream_decompressor(compression_algorithm);
+	}
+
 	int protocol_version;
+
+protected:
+	virtual void populate_buf() {
+		if (!decompressor) {
+			FDReadStream::populate_buf();
+			return;
+		}
+
+		buf_pos = buf_avail = 0;
+		while (true) {
+			if (!compressed_avail && !decompressor->output_pending()) {
+				compressed_pos = 0;
+				compressed_avail = read_fd(compressed_buf, sizeof(compressed_buf));
+			}
+
+			const uint8_t *src = compressed_buf + compressed_pos;
+			buf_avail = decompressor->decompress(src, compressed_avail, buf, sizeof(buf));
+			compressed_pos = src - compressed_buf;
+			if (buf_avail) break;
+		}
+	}
+
+	std::unique_ptr<StreamDecompressor> decompressor;
+	size_t compressed_pos, compressed_avail;
+	uint8_t compressed_buf[16384];
 };
 
 #endif
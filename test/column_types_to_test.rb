@@ -24,9 +24,9 @@ class ColumnTypesToTest < KitchenSync::EndpointTestCase
     # check that it can handle the various data types without crashing
     expect_command Commands::ROWS,
                    ["misctbl", @keys[0], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["misctbl", @keys[0], @keys[-1]],
-                   *@rows[1..-1]
+                   @rows[1..-1]
     expect_command Commands::HASH,
                    ["misctbl", [], @keys[0], 1]
     send_results   Commands::HASH,
@@ -0,0 +1,137 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/columnar_rows.h"
+
+struct StringStream {
+	StringStream(): pos(0) {}
+
+	inline void write(const uint8_t *buf, size_t bytes) { data.append((const char *)buf, bytes); }
+	inline void flush() {}
+
+	inline void read(uint8_t *buf, size_t bytes) {
+		if (data.size() - pos < bytes) throw runtime_error("read past the end of the stream");
+		memcpy(buf, data.data() + pos, bytes);
+		pos += bytes;
+	}
+
+	inline void skip(size_t bytes) {
+		pos += bytes;
+	}
+
+	string data;
+	size_t pos;
+};
+
+template <typename T>
+PackedValue packed(const T &value) {
+	PackedValue result;
+	result << value;
+	return result;
+}
+
+vector<ColumnEncoding> encodings_used(StringStream &stream) {
+	StringStream copy(stream);
+	Unpacker<StringStream> unpacker(copy);
+	size_t columns = unpacker.next_array_length() - 1;
+	unpacker.next<size_t>();
+
+	vector<ColumnEncoding> result;
+	while (columns--) {
+		size_t values = unpacker.next_array_length() - 1;
+		result.push_back(static_cast<ColumnEncoding>(unpacker.next<int>()));
+		while (values--) unpacker.skip();
+	}
+	return result;
+}
+
+vector<PackedRow> round_trip(const vector<PackedRow> &rows, StringStream &stream) {
+	Packer<StringStream> packer(stream);
+	pack_columnar_batch(packer, rows);
+	pack_array_length(packer, 0);
+
+	StringStream copy(stream);
+	Unpacker<StringStream> unpacker(copy);
+	RowStreamReader<StringStream> reader(unpacker, true);
+	vector<PackedRow> result;
+	PackedRow row;
+	while (reader.next(row)) {
+		result.push_back(row);
+	}
+	REQUIRE(copy.pos == copy.data.size());
+	return result;
+}
+
+TEST_CASE("columnar batches", "[columnar_rows]") {
+	StringStream stream;
+
+	SECTION("sequential integers are delta-encoded, with nulls listed separately") {
+		vector<PackedRow> rows;
+		for (long long i = 0; i < 100; i++) {
+			rows.push_back(PackedRow{packed(1000000 + i), i % 7 ? packed(-5000000000LL + 3*i) : packed(nullptr)});
+		}
+
+		REQUIRE(round_trip(rows, stream) == rows);
+		REQUIRE(encodings_used(stream) == (vector<ColumnEncoding>{ColumnEncoding::delta, ColumnEncoding::delta}));
+	}
+
+	SECTION("repeated values are dictionary-encoded, unless they're already as small as the indices would be") {
+		vector<PackedRow> rows;
+		for (long long i = 0; i < 100; i++) {
+			rows.push_back(PackedRow{packed(string(i % 3 ? "active" : "suspended")), i % 2 ? packed(nullptr) : packed(1.5), packed(i % 4 == 0)});
+		}
+
+		REQUIRE(round_trip(rows, stream) == rows);
+		REQUIRE(encodings_used(stream) == (vector<ColumnEncoding>{ColumnEncoding::dictionary, ColumnEncoding::dictionary, ColumnEncoding::plain}));
+	}
+
+	SECTION("other values are sent as they are") {
+		vector<PackedRow> rows;
+		for (long long i = 0; i < 100; i++) {
+			rows.push_back(PackedRow{packed("value " + to_string(i*i)), packed(18446744073709551615ULL - i), packed((i % 2 ? 1 : -1)*(i << 40))});
+		}
+
+		REQUIRE(round_trip(rows, stream) == rows);
+		REQUIRE(encodings_used(stream) == (vector<ColumnEncoding>{ColumnEncoding::plain, ColumnEncoding::plain, ColumnEncoding::plain}));
+	}
+
+	SECTION("single rows") {
+		vector<PackedRow> rows{PackedRow{packed(42), packed(nullptr), packed(string("x"))}};
+
+		REQUIRE(round_trip(rows, stream) == rows);
+	}
+}
+
+struct FakeDatabaseRow {
+	template <typename Packer>
+	void pack_row_into(Packer &packer) const {
+		pack_array_length(packer, 2);
+		packer << id;
+		packer << name;
+	}
+
+	long long id;
+	string name;
+};
+
+TEST_CASE("columnar row stream", "[columnar_rows]") {
+	StringStream stream;
+	Packer<StringStream> packer(stream);
+	ColumnarRowPacker<StringStream> row_packer(packer);
+
+	size_t rows_to_send = COLUMNAR_BATCH_MAX_ROWS*2 + 10;
+	for (size_t i = 0; i < rows_to_send; i++) {
+		row_packer(FakeDatabaseRow{(long long)i, "row " + to_string(i % 10)});
+	}
+	row_packer.flush();
+	pack_array_length(packer, 0);
+
+	Unpacker<StringStream> unpacker(stream);
+	RowStreamReader<StringStream> reader(unpacker, true);
+	PackedRow row;
+	for (size_t i = 0; i < rows_to_send; i++) {
+		REQUIRE(reader.next(row));
+		REQUIRE(row == (PackedRow{packed((long long)i), packed("row " + to_string(i % 10))}));
+	}
+	REQUIRE(!reader.next(row));
+	REQUIRE(stream.pos == stream.data.size());
+}
@@ -0,0 +1,113 @@
+#include "../../catch2/catch.hpp"
+
+#include <cstdlib>
+#include "../src/hash_cache.h"
+#include "../src/message_pack/copy_packed.h"
+
+struct TemporaryDirectory {
+	TemporaryDirectory() {
+		char path_template[] = "/tmp/ks_hash_cache_test.XXXXXX";
+		if (!mkdtemp(path_template)) throw runtime_error("Couldn't create temporary directory");
+		path = path_template;
+	}
+
+	~TemporaryDirectory() {
+		if (system(("rm -rf " + path).c_str())) { /* ignore */ }
+	}
+
+	string path;
+};
+
+static ColumnValues key_of(long long id) {
+	PackedValue value;
+	value << id;
+	return ColumnValues{value};
+}
+
+TEST_CASE("hash cache", "[hash_cache]") {
+	TemporaryDirectory directory;
+	string path(directory.path + "/footbl.hashes");
+	HashCacheKey first_range(key_of(0), key_of(10), 1), second_range(key_of(10), key_of(20), 1000);
+	HashCacheEntry entry;
+
+	{
+		TableHashCache cache(path, "identity", "marker 1");
+		REQUIRE(!cache.lookup(first_range, entry));
+		cache.store(first_range, HashCacheEntry{1, "first hash"});
+		REQUIRE(cache.lookup(first_range, entry));
+		cache.save();
+	}
+
+	SECTION("hashes are kept for later runs while the marker is unchanged") {
+		TableHashCache cache(path, "identity", "marker 1");
+		REQUIRE(cache.lookup(first_range, entry));
+		REQUIRE(entry.row_count == 1);
+		REQUIRE(entry.hash == "first hash");
+		REQUIRE(!cache.lookup(second_range, entry));
+	}
+
+	SECTION("hashes saved by different workers are combined") {
+		TableHashCache worker1(path, "identity", "marker 1");
+		TableHashCache worker2(path, "identity", "marker 1");
+		worker1.store(second_range, HashCacheEntry{5, "second hash"});
+		worker2.store(HashCacheKey(key_of(20), key_of(30), 1000), HashCacheEntry{7, "third hash"});
+		worker1.save();
+		worker2.save();
+
+		TableHashCache cache(path, "identity", "marker 1");
+		REQUIRE(cache.lookup(first_range, entry));
+		REQUIRE(cache.lookup(second_range, entry));
+		REQUIRE(entry.hash == "second hash");
+		REQUIRE(cache.lookup(HashCacheKey(key_of(20), key_of(30), 1000), entry));
+		REQUIRE(entry.row_count == 7);
+	}
+
+	SECTION("hashes are discarded when the marker changes") {
+		TableHashCache cache(path, "identity", "marker 2");
+		REQUIRE(!cache.lookup(first_range, entry));
+		cache.store(second_range, HashCacheEntry{5, "second hash"});
+		cache.save();
+
+		TableHashCache old_marker(path, "identity", "marker 1");
+		REQUIRE(!old_marker.lookup(first_range, entry));
+		REQUIRE(!old_marker.lookup(second_range, entry));
+
+		TableHashCache new_marker(path, "identity", "marker 2");
+		REQUIRE(!new_marker.lookup(first_range, entry));
+		REQUIRE(new_marker.lookup(second_range, entry));
+	}
+
+	SECTION("hashes aren't used for a different identity") {
+		TableHashCache cache(path, "other identity", "marker 1");
+		REQUIRE(!cache.lookup(first_range, entry));
+	}
+
+	SECTION("incomplete files are ignored") {
+		REQUIRE(truncate(path.c_str(), 5) == 0);
+		TableHashCache cache(path, "identity", "marker 1");
+		REQUIRE(!cache.lookup(first_range, entry));
+		cache.store(second_range, HashCacheEntry{5, "second hash"});
+		cache.save();
+
+		TableHashCache reloaded(path, "identity", "marker 1");
+		REQUIRE(reloaded.lookup(second_range, entry));
+	}
+}
+
+TEST_CASE("hash cache table markers", "[hash_cache]") {
+	TemporaryDirectory directory;
+	HashCache hash_cache(directory.path);
+	Table footbl("footbl"), secondtbl("secondtbl"), thirdtbl("thirdtbl"), fourthtbl("fourthtbl");
+	hash_cache.set_table_markers(map<string, string>{{"footbl", "marker 1"}, {"secondtbl", "marker 1"}, {"thirdtbl", ""}, {"fourthtbl", "marker 1"}});
+	hash_cache.check_table_markers(map<string, string>{{"footbl", "marker 1"}, {"secondtbl", "marker 2"}, {"thirdtbl", ""}});
+
+	SECTION("tables whose markers were the same before and after the transaction started are cached") {
+		REQUIRE(hash_cache.for_table(footbl, "footbl identity") != nullptr);
+	}
+
+	SECTION("tables whose markers changed in between, or that have no marker, aren't cached") {
+		REQUIRE(hash_cache.for_table(secondtbl, "secondtbl identity") == nullptr);
+		REQUIRE(hash_cache.for_table(thirdtbl, "thirdtbl identity") == nullptr);
+		REQUIRE(hash_cache.for_table(fourthtbl, "fourthtbl identity") == nullptr);
+	}
+}
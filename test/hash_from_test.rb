@@ -56,6 +56,64 @@ class HashFromTest < KitchenSync::EndpointTestCase
     expect_command Commands::HASH, ["footbl", [], @keys[1], 1, 1, hash_of(@rows[0..0])]
   end
 
+  test_each "hashes ranges using aggregate queries in the database if asked to and the other end uses the same type of database" do
+    setup_with_footbl(protocol_version: LATEST_PROTOCOL_VERSION_SUPPORTED)
+
+    send_command   Commands::HASH_IN_DATABASE, ["other"]
+    expect_command Commands::HASH_IN_DATABASE, [false]
+
+    send_command   Commands::HASH_IN_DATABASE, [@database_server]
+    expect_command Commands::HASH_IN_DATABASE, [true]
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[4], 2]
+    verb, (table_name, prev_key, last_key, rows_to_hash, row_count, hash) = read_command
+    assert_equal   Commands::HASH, verb
+    assert_equal   ["footbl", @keys[1], @keys[4], 2, 2], [table_name, prev_key, last_key, rows_to_hash, row_count]
+    assert         !hash.empty?
+
+    # the digest depends only on the rows hashed
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[3], 1000]
+    expect_command Commands::HASH, ["footbl", @keys[1], @keys[3], 1000, 2, hash]
+
+    send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 1000]
+    verb, (_, _, _, _, row_count, different_hash) = read_command
+    assert_equal   2, row_count
+    assert         hash != different_hash
+  end
+
+  test_each "hashes each of the ranges given in a HASH_MULTI command, and returns the results for each in order" do
+    setup_with_footbl
+
+    send_command   Commands::HASH_MULTI, ["footbl"], [@keys[0], @keys[1], 1000], [@keys[1], @keys[4], 2], [[], @keys[0], 1000]
+    expect_command Commands::HASH_MULTI, ["footbl"],
+                   [@keys[0], @keys[1], 1000, 1, hash_of(@rows[1..1])],
+                   [@keys[1], @keys[4],    2, 2, hash_of(@rows[2..3])],
+                   [      [], @keys[0], 1000, 1, hash_of(@rows[0..0])]
+
+    send_command   Commands::HASH_MULTI, ["footbl"], [@keys[4], [101], 1000]
+    expect_command Commands::HASH_MULTI, ["footbl"],
+                   [@keys[4], [101], 1000, 0, hash_of([])]
+  end
+
+  test_each "hashes the range given in a HASH_TREE command in leaves of at least the given size, extending the last leaf to the end of the range" do
+    setup_with_footbl
+
+    send_command   Commands::HASH_TREE, ["footbl", [], @keys[4], 1000000]
+    expect_command Commands::HASH_TREE, ["footbl", [], @keys[4], 1000000],
+                   [@keys[4], 5, hash_of(@rows[0..4])]
+
+    send_command   Commands::HASH_TREE, ["footbl", @keys[0], @keys[3], 1]
+    expect_command Commands::HASH_TREE, ["footbl", @keys[0], @keys[3], 1],
+                   [@keys[1], 1, hash_of(@rows[1..1])],
+                   [@keys[2], 1, hash_of(@rows[2..2])],
+                   [@keys[3], 1, hash_of(@rows[3..3])]
+
+    send_command   Commands::HASH_TREE, ["footbl", @keys[3], [101], 1]
+    expect_command Commands::HASH_TREE, ["footbl", @keys[3], [101], 1],
+                   [@keys[4], 1, hash_of(@rows[4..4])],
+                   [   [101], 0, hash_of([])]
+  end
+
   test_each "supports composite keys" do
     clear_schema
     create_secondtbl
@@ -132,4 +190,53 @@ class HashFromTest < KitchenSync::EndpointTestCase
     send_command   Commands::HASH, ["footbl", [], @keys[1], 1]
     expect_command Commands::HASH, ["footbl", [], @keys[1], 1, 1, hash_of(@rows[0..0], HashAlgorithm::XXH64)]
   end
+
+  test_each "optionally supports BLAKE2b hashes" do
+    setup_with_footbl(target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::BLAKE2B)
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[3], 1000]
+    expect_command Commands::HASH, ["footbl", @keys[1], @keys[3], 1000, 2, hash_of(@rows[2..3], HashAlgorithm::BLAKE2B)]
+  end
+
+  test_each "optionally supports XXH3 128-bit hashes" do
+    setup_with_footbl(target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::XXH128)
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[3], 1000]
+    expect_command Commands::HASH, ["footbl", @keys[1], @keys[3], 1000, 2, hash_of(@rows[2..3], HashAlgorithm::XXH128)]
+
+    send_command   Commands::HASH, ["footbl", [], @keys[1], 1000]
+    expect_command Commands::HASH, ["footbl", [], @keys[1], 1000, 2, hash_of(@rows[0..1], HashAlgorithm::XXH128)]
+  end
+
+  test_each "optionally supports summed XXH3 128-bit hashes, which don't depend on the order of the rows" do
+    setup_with_footbl(target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::XXH128SUM)
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[3], 1000]
+    verb, (_, _, _, _, row_count, hash) = read_command
+    assert_equal   Commands::HASH, verb
+    assert_equal   2, row_count
+    assert_equal   hash_of(@rows[2..3], HashAlgorithm::XXH128SUM), hash
+    assert_equal   hash_of(@rows[2..3].reverse, HashAlgorithm::XXH128SUM), hash
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[2], 1000]
+    verb, (_, _, _, _, _, first_row_hash) = read_command
+    send_command   Commands::HASH, ["footbl", @keys[2], @keys[3], 1000]
+    verb, (_, _, _, _, _, second_row_hash) = read_command
+    assert_equal   hash, sum_of_hashes(first_row_hash, second_row_hash)
+  end
+
+  def sum_of_hashes(*hashes)
+    sum = hashes.inject(0) {|sum, hash| sum + hash.unpack("Q>Q>").inject {|high, low| (high << 64) + low}} % (1 << 128)
+    [sum >> 64, sum & 0xFFFFFFFFFFFFFFFF].pack("Q>Q>")
+  end
+
+  test_each "keeps using the current hash algorithm if asked to use one it doesn't support" do
+    setup_with_footbl(target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::XXH64)
+
+    send_command   Commands::HASH_ALGORITHM, [99]
+    expect_command Commands::HASH_ALGORITHM, [HashAlgorithm::XXH64]
+
+    send_command   Commands::HASH, ["footbl", @keys[1], @keys[3], 1000]
+    expect_command Commands::HASH, ["footbl", @keys[1], @keys[3], 1000, 2, hash_of(@rows[2..3], HashAlgorithm::XXH64)]
+  end
 end
@@ -1,8 +1,24 @@
 #include <iostream>
+#include <atomic>
 
 #include "../src/row_serialization.h"
 #include "../src/hash_algorithm.h"
 #include "../src/timestamp.h"
+#include "../src/stream_compression.h"
+#include "../src/columnar_rows.h"
+#include "../src/pipelined_row_hasher.h"
+#include "../src/row_range_applier.h"
+
+#ifdef __GLIBC__
+// count calls to malloc and realloc (including those made by operator new), so we can see how many allocations
+// are made per row.  the memory still comes from the normal allocator, so it's freed normally.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+static std::atomic<size_t> allocations(0);
+extern "C" void *malloc(size_t size) { allocations.fetch_add(1, std::memory_order_relaxed); return __libc_malloc(size); }
+extern "C" void *realloc(void *ptr, size_t size) { allocations.fetch_add(1, std::memory_order_relaxed); return __libc_realloc(ptr, size); }
+#define ALLOCATIONS_COUNTED
+#endif
 
 template <typename T>
 double benchmark_one(T value, size_t columns, size_t rows, HashAlgorithm hash_algorithm) {
@@ -15,6 +31,7 @@ double benchmark_one(T value, size_t columns, size_t rows, HashAlgorithm hash_al
 			for (size_t column = 0; column < columns; column++) {
 				hasher.row_packer << value;
 			}
+			hasher.finish_row();
 		}
 		Hash hash(hasher.finish());
 		total_bytes_hashed += hasher.size;
@@ -28,9 +45,275 @@ template <typename T>
 void benchmark(T value, size_t columns, size_t rows) {
 	cout << "MD5:      " << benchmark_one(value, columns, rows, HashAlgorithm::md5)   << "MB/s" << endl;
 	cout << "XXHASH64: " << benchmark_one(value, columns, rows, HashAlgorithm::xxh64) << "MB/s" << endl;
+	cout << "XXH3-128: " << benchmark_one(value, columns, rows, HashAlgorithm::xxh3_128) << "MB/s" << endl;
+	cout << "XXH128SUM: " << benchmark_one(value, columns, rows, HashAlgorithm::xxh3_128_sum) << "MB/s" << endl;
+	if (hash_algorithm_supported(HashAlgorithm::blake2b)) {
+		cout << "BLAKE2B:  " << benchmark_one(value, columns, rows, HashAlgorithm::blake2b) << "MB/s" << endl;
+	}
+	cout << endl;
+}
+
+struct MemoryStream {
+	MemoryStream(): pos(0) {}
+
+	inline void write(const uint8_t *buf, size_t bytes) { data.append((const char *)buf, bytes); }
+	inline void flush() {}
+
+	inline void read(uint8_t *buf, size_t bytes) { memcpy(buf, data.data() + pos, bytes); pos += bytes; }
+	inline void skip(size_t bytes) { pos += bytes; }
+
+	string data;
+	size_t pos;
+};
+
+string generate_rows(size_t rows) {
+	// vaguely like a typical table: a sequential id, a couple of low-cardinality columns, a timestamp, and a random token
+	MemoryStream stream;
+	Packer<MemoryStream> packer(stream);
+	uint64_t seed = 1;
+	for (size_t row = 0; row < rows; row++) {
+		seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+		pack_array_length(packer, 5);
+		packer << (int64_t)(row + 1);
+		packer << (int32_t)(seed >> 60);
+		packer << (row % 3 ? string("active") : string("suspended"));
+		packer << "2019-03-0" + to_string(1 + row % 9) + " 12:" + to_string(10 + row % 50) + ":00";
+		packer << to_string(seed >> 16);
+	}
+	return stream.data;
+}
+
+void benchmark_compression(const string &data, CompressionAlgorithm compression_algorithm, int compression_level) {
+	// flush every 256 KB, roughly as if each chunk were a separate response
+	const size_t bytes_per_flush = 256*1024;
+	uint8_t buf[16384];
+	string compressed;
+
+	double start_time = timestamp();
+	unique_ptr<StreamCompressor> compressor(create_stream_compressor(compression_algorithm, compression_level));
+	for (size_t offset = 0; offset < data.size(); offset += bytes_per_flush) {
+		const uint8_t *src = (const uint8_t *)data.data() + offset;
+		size_t bytes = min(bytes_per_flush, data.size() - offset);
+		do {
+			size_t compressed_bytes = compressor->compress(src, bytes, true, buf, sizeof(buf));
+			compressed.append((const char *)buf, compressed_bytes);
+		} while (!compressor->done());
+	}
+	double compressed_time = timestamp();
+
+	unique_ptr<StreamDecompressor> decompressor(create_stream_decompressor(compression_algorithm));
+	const uint8_t *src = (const uint8_t *)compressed.data();
+	size_t bytes = compressed.size(), decompressed_size = 0;
+	while (bytes || decompressor->output_pending()) {
+		decompressed_size += decompressor->decompress(src, bytes, buf, sizeof(buf));
+	}
+	double decompressed_time = timestamp();
+
+	if (decompressed_size != data.size()) throw runtime_error("decompressed to " + to_string(decompressed_size) + " bytes, expected " + to_string(data.size()));
+
+	cout << "level " << setw(2) << compression_level << ": "
+	     << "ratio " << setw(5) << fixed << setprecision(2) << (double)data.size()/compressed.size() << ", "
+	     << "compression " << setw(8) << data.size()/(compressed_time - start_time)/1024.0/1024.0 << "MB/s, "
+	     << "decompression " << setw(8) << data.size()/(decompressed_time - compressed_time)/1024.0/1024.0 << "MB/s" << endl;
+	cout.unsetf(ios_base::floatfield);
+}
+
+void benchmark_compression() {
+	string data(generate_rows(1000000));
+	cout << "uncompressed rows: " << data.size()/1024/1024 << " MB" << endl;
+
+	if (!compression_algorithm_supported(CompressionAlgorithm::zstd)) {
+		cout << "(not built with zstd support)" << endl;
+		return;
+	}
+	cout << "zstd:" << endl;
+	for (int compression_level : { 1, 3, 6, 9 }) {
+		benchmark_compression(data, CompressionAlgorithm::zstd, compression_level);
+	}
+	cout << endl;
+}
+
+void benchmark_columnar() {
+	const size_t rows = 1000000;
+	MemoryStream row_oriented;
+	row_oriented.data = generate_rows(rows);
+
+	// split the rows up into batches in advance, so we only time the encoding itself
+	Unpacker<MemoryStream> row_unpacker(row_oriented);
+	vector<vector<PackedRow>> batches((rows + COLUMNAR_BATCH_MAX_ROWS - 1)/COLUMNAR_BATCH_MAX_ROWS);
+	for (size_t row = 0; row < rows; row++) {
+		vector<PackedRow> &batch(batches[row/COLUMNAR_BATCH_MAX_ROWS]);
+		batch.resize(batch.size() + 1);
+		row_unpacker >> batch.back();
+	}
+
+	double start_time = timestamp();
+	MemoryStream columnar;
+	Packer<MemoryStream> packer(columnar);
+	for (const vector<PackedRow> &batch : batches) {
+		pack_columnar_batch(packer, batch);
+	}
+	pack_array_length(packer, 0);
+	double packed_time = timestamp();
+
+	Unpacker<MemoryStream> columnar_unpacker(columnar);
+	RowStreamReader<MemoryStream> reader(columnar_unpacker, true);
+	PackedRow row;
+	size_t rows_read = 0;
+	while (reader.next(row)) rows_read++;
+	double unpacked_time = timestamp();
+
+	if (rows_read != rows) throw runtime_error("read " + to_string(rows_read) + " rows, expected " + to_string(rows));
+
+	cout << "row-oriented: " << row_oriented.data.size()/1024 << " KB, columnar: " << columnar.data.size()/1024 << " KB" << endl;
+	cout << "packing " << row_oriented.data.size()/(packed_time - start_time)/1024.0/1024.0 << "MB/s, "
+	     << "unpacking " << row_oriented.data.size()/(unpacked_time - packed_time)/1024.0/1024.0 << "MB/s" << endl;
+	cout << endl;
+}
+
+// stands in for a database row, so that decoding the rows is part of the work being overlapped with hashing
+struct DecodedRow {
+	template <typename RowPacker>
+	void pack_row_into(RowPacker &packer) const {
+		pack_array_length(packer, values.size());
+		for (const PackedValue &value : values) {
+			packer << value;
+		}
+	}
+
+	PackedRow values;
+};
+
+template <typename Hasher>
+double benchmark_hashing_rows(const string &data, size_t rows, HashAlgorithm hash_algorithm, string &hash) {
+	double start_time = timestamp();
+	MemoryStream stream;
+	stream.data = data;
+	Unpacker<MemoryStream> unpacker(stream);
+	Hasher hasher(hash_algorithm);
+	DecodedRow row;
+	for (size_t n = 0; n < rows; n++) {
+		unpacker >> row.values;
+		hasher(row);
+	}
+	hash = hasher.finish().to_string();
+	double end_time = timestamp();
+	return hasher.size/(end_time - start_time)/1024.0/1024.0;
+}
+
+void benchmark_pipelined_hashing(HashAlgorithm hash_algorithm, const string &name) {
+	const size_t rows = 1000000;
+	string data(generate_rows(rows));
+	string hash, pipelined_hash;
+	double synchronous = benchmark_hashing_rows<RowHasher>(data, rows, hash_algorithm, hash);
+	double pipelined = benchmark_hashing_rows<PipelinedRowHasher>(data, rows, hash_algorithm, pipelined_hash);
+	if (hash != pipelined_hash) throw runtime_error("pipelined " + name + " hash doesn't match");
+	cout << name << " decoding and hashing rows: " << synchronous << "MB/s, pipelined: " << pipelined << "MB/s" << endl;
+}
+
+void benchmark_allocations() {
+#ifdef ALLOCATIONS_COUNTED
+	const size_t rows = 1000000;
+	MemoryStream stream;
+	stream.data = generate_rows(rows);
+	Unpacker<MemoryStream> unpacker(stream);
+	vector<PackedRow> decoded(rows);
+	vector<ColumnValues> keys(rows);
+
+	size_t allocations_before = allocations.load();
+	double start_time = timestamp();
+	for (size_t row = 0; row < rows; row++) {
+		unpacker >> decoded[row];
+	}
+	double decoded_time = timestamp();
+	size_t allocations_decoding = allocations.load() - allocations_before;
+
+	// the primary key is copied around as we track ranges and the last key seen
+	for (size_t row = 0; row < rows; row++) {
+		keys[row] = ColumnValues(decoded[row].begin(), decoded[row].begin() + 1);
+	}
+	double copied_time = timestamp();
+	size_t allocations_copying = allocations.load() - allocations_before - allocations_decoding;
+
+	cout << "decoding rows: " << (double)allocations_decoding/rows << " allocations per row, " << (size_t)(rows/(decoded_time - start_time)) << " rows/s" << endl;
+	cout << "copying keys: " << (double)allocations_copying/rows << " allocations per key, " << (size_t)(rows/(copied_time - decoded_time)) << " keys/s" << endl;
+#else
+	cout << "(allocation counting is only implemented for glibc)" << endl;
+#endif
 	cout << endl;
 }
 
+// just enough of a database client to run RowRangeApplier against rows held in memory.  the applier only queries
+// ranges of the primary key, which for the generated rows is an integer id that's also the row's index + 1.
+struct MemoryDatabaseClient {
+	typedef DecodedRow RowType;
+
+	inline string quote_identifier(const string &name) { return ::quote_identifier(name, '"'); }
+	inline bool supports_generated_as_identity() const { return false; }
+	string &append_quoted_column_value_to(string &result, const Column &column, const string &value) { return result += "'" + value + "'"; }
+	size_t execute(const string &sql) { statements++; return 0; }
+	void start_write_transaction() {}
+	void commit_transaction() {}
+
+	static size_t number_after(const string &sql, const string &before, size_t if_not_found) {
+		size_t pos = sql.find(before);
+		return (pos == string::npos ? if_not_found : strtoull(sql.c_str() + pos + before.size(), nullptr, 10));
+	}
+
+	template <typename RowFunction>
+	size_t query(const string &sql, RowFunction &row_handler) {
+		size_t prev_id = number_after(sql, " > (", 0);
+		size_t last_id = number_after(sql, " <= (", rows.size());
+		size_t limit = number_after(sql, " LIMIT ", rows.size());
+		size_t count = 0;
+		for (size_t n = prev_id; n < last_id && count < limit; n++, count++) {
+			row_handler(rows[n]);
+		}
+		return count;
+	}
+
+	vector<DecodedRow> rows;
+	size_t statements = 0;
+};
+
+void benchmark_row_range_applier(size_t every_nth_row_changed) {
+	const size_t rows = 1000000;
+	MemoryStream stream;
+	stream.data = generate_rows(rows);
+	Unpacker<MemoryStream> unpacker(stream);
+	vector<PackedRow> source_rows(rows);
+	MemoryDatabaseClient client;
+	client.rows.resize(rows);
+	for (size_t row = 0; row < rows; row++) {
+		unpacker >> source_rows[row];
+		client.rows[row].values = source_rows[row];
+		if (row % every_nth_row_changed == 0) client.rows[row].values[1] = PackedValue();
+	}
+
+	Table table("bench");
+	for (ColumnType column_type : {ColumnType::sint_64bit, ColumnType::sint_32bit, ColumnType::text, ColumnType::datetime, ColumnType::text}) {
+		Column column;
+		column.name = "column" + to_string(table.columns.size());
+		column.column_type = column_type;
+		table.columns.push_back(column);
+	}
+	table.primary_key_columns.push_back(0);
+	table.primary_key_type = PrimaryKeyType::explicit_primary_key;
+
+	double start_time = timestamp();
+	RowReplacer<MemoryDatabaseClient> replacer(client, table, false, nullptr);
+	RowRangeApplier<MemoryDatabaseClient> applier(replacer, table, ColumnValues(), ColumnValues());
+	for (const PackedRow &row : source_rows) {
+		applier.received_source_row(row);
+	}
+	applier.received_all_source_rows();
+	replacer.apply();
+	double end_time = timestamp();
+
+	if (replacer.rows_changed != (rows + every_nth_row_changed - 1)/every_nth_row_changed) throw runtime_error("changed " + to_string(replacer.rows_changed) + " rows");
+	cout << "applying rows with 1 in " << every_nth_row_changed << " changed: " << (size_t)(rows/(end_time - start_time)) << " rows/s" << endl;
+}
+
 int main(int argc, char *argv[]) {
 	try {
 		cout << "individual tiny rows (~10 B):" << endl;
@@ -55,6 +338,25 @@ int main(int argc, char *argv[]) {
 
 		cout << "very many medium rows (~2.4 MB):" << endl;
 		benchmark<string>("b104829e-3f9f-11e9-b6f7-f2189827a7e0", 6, 10000);
+
+		cout << endl;
+
+		// the effective throughput of a link when compressing is roughly its uncompressed bandwidth
+		// times the compression ratio, up to the compression speed
+		benchmark_compression();
+
+		benchmark_columnar();
+
+		benchmark_pipelined_hashing(HashAlgorithm::md5, "MD5");
+		benchmark_pipelined_hashing(HashAlgorithm::xxh64, "XXHASH64");
+		benchmark_pipelined_hashing(HashAlgorithm::xxh3_128_sum, "XXH128SUM");
+		cout << endl;
+
+		benchmark_allocations();
+
+		benchmark_row_range_applier(1000000);
+		benchmark_row_range_applier(100);
+		cout << endl;
 	} catch (const exception &e) {
 		cerr << e.what() << endl;
 	}
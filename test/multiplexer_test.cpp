@@ -0,0 +1,109 @@
+#include "../../catch2/catch.hpp"
+
+#include <unistd.h>
+#include "../src/multiplexer.h"
+
+using namespace std;
+
+struct TestPipe {
+	TestPipe() { REQUIRE(pipe(fds) == 0); }
+	int fds[2];
+};
+
+string read_until_closed(int fd) {
+	string result;
+	char buf[4096];
+	ssize_t bytes_read;
+	while ((bytes_read = ::read(fd, buf, sizeof(buf))) > 0) result.append(buf, bytes_read);
+	::close(fd);
+	return result;
+}
+
+void write_and_close(int fd, const string &data) {
+	const char *ptr = data.data();
+	size_t bytes = data.size();
+	while (bytes > 0) {
+		ssize_t bytes_written = ::write(fd, ptr, bytes);
+		if (bytes_written <= 0) break; // the test will fail when the data is compared
+		ptr += bytes_written;
+		bytes -= bytes_written;
+	}
+	::close(fd);
+}
+
+TEST_CASE("multiplexing channels over one transport", "[multiplexer]") {
+	const int channels = 3;
+
+	// the two multiplexers are joined by a pair of pipes, as if by an SSH session
+	TestPipe left_to_right, right_to_left;
+
+	// and each channel has a pair of pipes at each end, as if to a worker
+	TestPipe left_in[channels], left_out[channels], right_in[channels], right_out[channels];
+	vector<MultiplexedChannel> left_channels, right_channels;
+	for (int channel = 0; channel < channels; channel++) {
+		left_channels.push_back(MultiplexedChannel(left_in[channel].fds[0], left_out[channel].fds[1]));
+		right_channels.push_back(MultiplexedChannel(right_in[channel].fds[0], right_out[channel].fds[1]));
+	}
+
+	Multiplexer left(right_to_left.fds[0], left_to_right.fds[1], left_channels);
+	Multiplexer right(left_to_right.fds[0], right_to_left.fds[1], right_channels);
+
+	// send different amounts of data each way on each channel, some much more than will fit in the pipe buffers
+	vector<string> left_data, right_data;
+	vector<thread> writers;
+	for (int channel = 0; channel < channels; channel++) {
+		left_data.push_back(string(channel*300000 + 1, 'a' + channel));
+		right_data.push_back(string(channel*100000 + 1, 'A' + channel));
+		writers.push_back(thread(write_and_close, left_in[channel].fds[1], left_data[channel]));
+		writers.push_back(thread(write_and_close, right_in[channel].fds[1], right_data[channel]));
+	}
+
+	// read them back in the reverse order to check that one channel doesn't block the others
+	for (int channel = channels - 1; channel >= 0; channel--) {
+		CHECK(read_until_closed(right_out[channel].fds[0]) == left_data[channel]);
+		CHECK(read_until_closed(left_out[channel].fds[0]) == right_data[channel]);
+	}
+
+	for (thread &writer : writers) writer.join();
+
+	// once all channels are closed in both directions, both ends should finish, so this shouldn't hang
+	left.wait();
+	right.wait();
+}
+
+TEST_CASE("multiplexing channels whose workers aren't reading", "[multiplexer]") {
+	const int channels = 2;
+	const size_t window_size = 10000;
+
+	TestPipe left_to_right, right_to_left;
+	TestPipe left_in[channels], left_out[channels], right_in[channels], right_out[channels];
+	vector<MultiplexedChannel> left_channels, right_channels;
+	for (int channel = 0; channel < channels; channel++) {
+		left_channels.push_back(MultiplexedChannel(left_in[channel].fds[0], left_out[channel].fds[1]));
+		right_channels.push_back(MultiplexedChannel(right_in[channel].fds[0], right_out[channel].fds[1]));
+	}
+
+	Multiplexer left(right_to_left.fds[0], left_to_right.fds[1], left_channels, window_size);
+	Multiplexer right(left_to_right.fds[0], right_to_left.fds[1], right_channels, window_size);
+
+	// the first channel has far more data than its window and the pipe buffers can hold
+	string stalled_data(1000000, 'a');
+	string other_data(200000, 'b');
+	thread stalled_writer(write_and_close, left_in[0].fds[1], stalled_data);
+	thread other_writer(write_and_close, left_in[1].fds[1], other_data);
+
+	// nothing reads the first channel until all of the second has arrived, which would deadlock if the
+	// first channel's data stopped the other end reading from the transport
+	CHECK(read_until_closed(right_out[1].fds[0]) == other_data);
+	CHECK(read_until_closed(right_out[0].fds[0]) == stalled_data);
+
+	stalled_writer.join();
+	other_writer.join();
+	::close(right_in[0].fds[1]);
+	::close(right_in[1].fds[1]);
+	CHECK(read_until_closed(left_out[0].fds[0]) == "");
+	CHECK(read_until_closed(left_out[1].fds[0]) == "");
+
+	left.wait();
+	right.wait();
+}
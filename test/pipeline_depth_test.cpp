@@ -0,0 +1,86 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/pipeline_depth.h"
+
+using namespace std;
+
+// simulates a link with the given round trip latency to an end that takes the given time to process each command
+struct SimulatedLink {
+	SimulatedLink(double latency, double service_time): latency(latency), service_time(service_time), time(0), other_end_free(0), bytes_written(0), bytes_read(0) {}
+
+	void run(PipelineDepthController &controller, size_t commands_to_send, size_t command_bytes = 100, size_t response_bytes = 1000) {
+		deque<double> responses_arrive;
+		for (size_t commands_sent = 0; commands_sent < commands_to_send || controller.outstanding() > 0; ) {
+			if (commands_sent < commands_to_send && controller.can_send()) {
+				double starts = max(time + latency/2, other_end_free);
+				other_end_free = starts + service_time;
+				responses_arrive.push_back(other_end_free + latency/2);
+				bytes_written += command_bytes;
+				controller.command_sent(time, bytes_written);
+				commands_sent++;
+			} else {
+				time = max(time, responses_arrive.front());
+				responses_arrive.pop_front();
+				bytes_read += response_bytes;
+				controller.response_received(time, bytes_read);
+			}
+		}
+	}
+
+	double latency;
+	double service_time;
+	double time;
+	double other_end_free;
+	size_t bytes_written;
+	size_t bytes_read;
+};
+
+TEST_CASE("pipeline depth", "[pipeline_depth]") {
+	PipelineDepthController controller;
+	REQUIRE(controller.depth == DEFAULT_MIN_COMMANDS_TO_PIPELINE);
+
+	SECTION("grows to cover the round trip time on a slow link") {
+		SimulatedLink link(0.050, 0.005);
+		controller.start_table(link.bytes_written, link.bytes_read);
+		link.run(controller, 1000);
+
+		// 11 commands cover the round trip; we allow a few more to queue at the other end
+		REQUIRE(controller.depth >= 11);
+		REQUIRE(controller.depth <= 16);
+		REQUIRE(controller.bandwidth_delay_product() > 0);
+	}
+
+	SECTION("stays shallow on a fast link") {
+		SimulatedLink link(0.0001, 0.005);
+		controller.start_table(link.bytes_written, link.bytes_read);
+		link.run(controller, 1000);
+
+		REQUIRE(controller.depth <= 5);
+	}
+
+	SECTION("shrinks when the other end becomes the bottleneck") {
+		SimulatedLink link(0.050, 0.005);
+		controller.start_table(link.bytes_written, link.bytes_read);
+		link.run(controller, 1000);
+		size_t deep = controller.depth;
+
+		// for example, because we've moved on to a table with much bigger rows
+		link.service_time = 0.100;
+		controller.start_table(link.bytes_written, link.bytes_read);
+		link.run(controller, 1000);
+		REQUIRE(controller.depth < deep);
+		REQUIRE(controller.depth <= 5);
+	}
+
+	SECTION("limits the bytes of commands outstanding") {
+		SimulatedLink link(0.050, 0.005);
+		controller.start_table(link.bytes_written, link.bytes_read);
+		link.run(controller, 1000);
+		REQUIRE(controller.depth > DEFAULT_MIN_COMMANDS_TO_PIPELINE);
+
+		controller.command_sent(link.time, link.bytes_written += DEFAULT_MAX_COMMAND_BYTES_TO_PIPELINE);
+		REQUIRE(controller.can_send()); // always allowed to have the minimum outstanding
+		controller.command_sent(link.time, link.bytes_written += 100);
+		REQUIRE(!controller.can_send());
+	}
+}
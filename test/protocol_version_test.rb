@@ -22,4 +22,11 @@ class ProtocolVersionTest < KitchenSync::EndpointTestCase
     send_command   Commands::PROTOCOL, [EARLIEST_PROTOCOL_VERSION_SUPPORTED]
     expect_command Commands::PROTOCOL, [EARLIEST_PROTOCOL_VERSION_SUPPORTED]
   end if EARLIEST_PROTOCOL_VERSION_SUPPORTED < LATEST_PROTOCOL_VERSION_SUPPORTED
+
+  test_each "declines compression algorithms it doesn't support" do
+    clear_schema
+    send_protocol_command(LATEST_PROTOCOL_VERSION_SUPPORTED)
+    send_command   Commands::COMPRESSION, [99, 1]
+    expect_command Commands::COMPRESSION, [CompressionAlgorithm::NONE]
+  end
 end
@@ -0,0 +1,74 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/row_fingerprints.h"
+#include "../src/message_pack/copy_packed.h"
+
+ColumnValues key_of(long long value) {
+	ColumnValues result(1);
+	result[0] << value;
+	return result;
+}
+
+ColumnValues key_of(const string &value) {
+	ColumnValues result(1);
+	result[0] << value;
+	return result;
+}
+
+TEST_CASE("keys of changed rows", "[row_fingerprints]") {
+	vector<RowFingerprint> ours{{key_of(1), 100}, {key_of(2), 200}, {key_of(-1), 300}, {key_of(4), 400}};
+
+	SECTION("returns nothing if all the rows match") {
+		REQUIRE(keys_of_changed_rows(ours, ours).empty());
+	}
+
+	SECTION("returns the keys of rows that are different, missing from our end, or missing from their end") {
+		vector<RowFingerprint> theirs{{key_of(1), 100}, {key_of(2), 201}, {key_of(3), 300}, {key_of(4), 400}, {key_of(1000), 500}};
+
+		vector<ColumnValues> keys(keys_of_changed_rows(ours, theirs));
+		sort(keys.begin(), keys.end());
+		vector<ColumnValues> expected{key_of(2), key_of(-1), key_of(3), key_of(1000)};
+		sort(expected.begin(), expected.end());
+		REQUIRE(keys == expected);
+	}
+
+	SECTION("handles empty lists at either end") {
+		REQUIRE(keys_of_changed_rows(ours, vector<RowFingerprint>()).size() == ours.size());
+		REQUIRE(keys_of_changed_rows(vector<RowFingerprint>(), ours).size() == ours.size());
+	}
+}
+
+TEST_CASE("batches of keys to retrieve", "[row_fingerprints]") {
+	list<vector<ColumnValues>> batches;
+
+	SECTION("limits the number of keys in each batch") {
+		vector<ColumnValues> keys;
+		for (long long i = 0; i < 25; i++) keys.push_back(key_of(i));
+		batch_keys_to_retrieve(move(keys), batches, 10, 1000);
+		REQUIRE(batches.size() == 3);
+		REQUIRE(batches.front().size() == 10);
+		REQUIRE(batches.front().front() == key_of(0));
+		REQUIRE(batches.back().size() == 5);
+		REQUIRE(batches.back().back() == key_of(24));
+	}
+
+	SECTION("limits the encoded size of each batch") {
+		vector<ColumnValues> keys{key_of(string(40, 'a')), key_of(string(40, 'b')), key_of(string(40, 'c'))};
+		batch_keys_to_retrieve(move(keys), batches, 10, 100);
+		REQUIRE(batches.size() == 2);
+		REQUIRE(batches.front() == vector<ColumnValues>({key_of(string(40, 'a')), key_of(string(40, 'b'))}));
+		REQUIRE(batches.back() == vector<ColumnValues>({key_of(string(40, 'c'))}));
+	}
+
+	SECTION("sends keys bigger than the limit in batches by themselves") {
+		vector<ColumnValues> keys{key_of(1), key_of(string(200, 'a')), key_of(2)};
+		batch_keys_to_retrieve(move(keys), batches, 10, 100);
+		REQUIRE(batches.size() == 3);
+		REQUIRE(batches.front() == vector<ColumnValues>({key_of(1)}));
+	}
+
+	SECTION("returns no batches if there are no keys") {
+		batch_keys_to_retrieve(vector<ColumnValues>(), batches, 10, 100);
+		REQUIRE(batches.empty());
+	}
+}
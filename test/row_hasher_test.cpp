@@ -0,0 +1,108 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/pipelined_row_hasher.h"
+#include "../src/hash_tree.h"
+
+struct FakeDatabaseRow {
+	template <typename Packer>
+	void pack_row_into(Packer &packer) const {
+		pack_array_length(packer, 2);
+		packer << id;
+		packer << name;
+	}
+
+	long long id;
+	string name;
+};
+
+template <typename Hasher>
+string hash_rows(HashAlgorithm hash_algorithm, const vector<FakeDatabaseRow> &rows) {
+	Hasher hasher(hash_algorithm);
+	for (const FakeDatabaseRow &row : rows) {
+		hasher(row);
+	}
+	return hasher.finish().to_string();
+}
+
+vector<FakeDatabaseRow> rows_to_hash(size_t count) {
+	vector<FakeDatabaseRow> rows;
+	for (size_t i = 0; i < count; i++) {
+		rows.push_back(FakeDatabaseRow{(long long)i, "row " + to_string(i)});
+	}
+	return rows;
+}
+
+TEST_CASE("commutative hashes", "[row_hasher]") {
+	vector<FakeDatabaseRow> rows(rows_to_hash(100));
+	vector<FakeDatabaseRow> reversed(rows.rbegin(), rows.rend());
+
+	SECTION("don't depend on the order of the rows") {
+		REQUIRE(hash_rows<RowHasher>(HashAlgorithm::xxh3_128_sum, rows) == hash_rows<RowHasher>(HashAlgorithm::xxh3_128_sum, reversed));
+		REQUIRE(hash_rows<RowHasher>(HashAlgorithm::xxh3_128, rows) != hash_rows<RowHasher>(HashAlgorithm::xxh3_128, reversed));
+	}
+
+	SECTION("depend on the row boundaries") {
+		RowHasher hasher(HashAlgorithm::xxh3_128_sum);
+		for (const FakeDatabaseRow &row : rows) {
+			row.pack_row_into(hasher.row_packer);
+		}
+		hasher.finish_row();
+		REQUIRE(hasher.finish() != hash_rows<RowHasher>(HashAlgorithm::xxh3_128_sum, rows));
+	}
+
+	SECTION("change when any row changes") {
+		vector<FakeDatabaseRow> changed(rows);
+		changed[50].name = "changed";
+		REQUIRE(hash_rows<RowHasher>(HashAlgorithm::xxh3_128_sum, rows) != hash_rows<RowHasher>(HashAlgorithm::xxh3_128_sum, changed));
+	}
+}
+
+TEST_CASE("pipelined hashes", "[row_hasher]") {
+	// enough rows to fill several chunks and so start the hashing thread, and few enough to be hashed inline
+	for (size_t count : {10, 20000}) {
+		vector<FakeDatabaseRow> rows(rows_to_hash(count));
+		for (HashAlgorithm hash_algorithm : {HashAlgorithm::md5, HashAlgorithm::xxh64, HashAlgorithm::xxh3_128, HashAlgorithm::xxh3_128_sum}) {
+			REQUIRE(hash_rows<PipelinedRowHasher>(hash_algorithm, rows) == hash_rows<RowHasher>(hash_algorithm, rows));
+		}
+	}
+}
+
+struct FakeDatabaseRowInLeaf {
+	int n_columns() const { return 3; }
+	uint64_t uint_at(int column_number) const { return (column_number == 2 ? leaf : 0); }
+
+	template <typename Packer>
+	void pack_column_into(Packer &packer, int column_number) const {
+		switch (column_number) {
+			case 0: packer << row.id; break;
+			case 1: packer << row.name; break;
+			default: packer << leaf;
+		}
+	}
+
+	FakeDatabaseRow row;
+	size_t leaf;
+};
+
+TEST_CASE("hash tree leaf hashes", "[row_hasher]") {
+	vector<FakeDatabaseRow> rows(rows_to_hash(100));
+	HashTreeLeafHashers leaves(HashAlgorithm::xxh3_128, 3);
+	for (size_t i = 0; i < rows.size(); i++) {
+		size_t leaf = (i < 30 ? 0 : i < 90 ? 1 : 2);
+		leaves(FakeDatabaseRowInLeaf{rows[i], leaf});
+	}
+
+	SECTION("match hashing the rows in each leaf separately") {
+		REQUIRE(leaves.hashers[0]->finish().to_string() == hash_rows<RowHasher>(HashAlgorithm::xxh3_128, vector<FakeDatabaseRow>(rows.begin(), rows.begin() + 30)));
+		REQUIRE(leaves.hashers[1]->finish().to_string() == hash_rows<RowHasher>(HashAlgorithm::xxh3_128, vector<FakeDatabaseRow>(rows.begin() + 30, rows.begin() + 90)));
+		REQUIRE(leaves.hashers[2]->finish().to_string() == hash_rows<RowHasher>(HashAlgorithm::xxh3_128, vector<FakeDatabaseRow>(rows.begin() + 90, rows.end())));
+	}
+
+	SECTION("count the rows in each leaf") {
+		REQUIRE(leaves.row_counts == vector<size_t>({30, 60, 10}));
+	}
+
+	SECTION("reject rows outside the leaves") {
+		REQUIRE_THROWS_AS(leaves(FakeDatabaseRowInLeaf{rows[0], 3}), logic_error);
+	}
+}
@@ -0,0 +1,153 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/row_replacer.h"
+
+struct StatementRecordingClient {
+	inline string quote_identifier(const string &name) { return ::quote_identifier(name, '"'); }
+	inline bool supports_generated_as_identity() const { return false; }
+
+	string &append_quoted_column_value_to(string &result, const Column &, const string &value) {
+		return result += "'" + value + "'";
+	}
+
+	size_t execute(const string &sql) {
+		statements.push_back(sql);
+		return 0;
+	}
+
+	void start_write_transaction() {}
+	void commit_transaction() {}
+
+	vector<string> statements;
+};
+
+struct ReplaceStatementRecordingClient: public StatementRecordingClient, public SupportsReplace {
+	inline string quote_identifier(const string &name) { return ::quote_identifier(name, '`'); }
+};
+
+struct ParameterRecordingClient: public StatementRecordingClient, public SupportsStatementParameters {
+	using StatementRecordingClient::execute;
+
+	void append_statement_parameters_to(StatementParameters &parameters, const Columns &, const PackedRow &row) {
+		for (size_t n = 0; n < row.size(); n++) {
+			size_t offset = parameters.data.size();
+			parameters.data += "value";
+			parameters.add_text_from(offset);
+		}
+	}
+
+	string &append_parameter_placeholder_to(string &result, const Column &, size_t parameter_number) {
+		return result += "$" + to_string(parameter_number);
+	}
+
+	size_t execute(const string &sql, const StatementParameters &parameters, size_t first_parameter, size_t number_of_parameters, bool prepare) {
+		statements.push_back(sql.substr(0, sql.find('\n')));
+		parameters_sent.push_back(number_of_parameters);
+		prepared.push_back(prepare);
+		REQUIRE(first_parameter + number_of_parameters <= parameters.size());
+		return 0;
+	}
+
+	vector<size_t> parameters_sent;
+	vector<bool> prepared;
+};
+
+template <typename T>
+PackedValue packed_value(const T &value) {
+	PackedValue result;
+	Packer<PackedValue> packer(result);
+	packer << value;
+	return result;
+}
+
+PackedRow uniquetbl_row(int pri, int sec, const string &tri) {
+	return PackedRow{packed_value(pri), packed_value(sec), packed_value(tri)};
+}
+
+Table uniquetbl() {
+	Table table("uniquetbl");
+	for (const char *name : {"pri", "sec", "tri"}) {
+		Column column;
+		column.name = name;
+		column.column_type = (name[0] == 't' ? ColumnType::text : ColumnType::sint_32bit);
+		table.columns.push_back(column);
+	}
+	table.primary_key_columns.push_back(0);
+	table.primary_key_type = PrimaryKeyType::explicit_primary_key;
+	Key key("secidx", KeyType::unique_key);
+	key.columns.push_back(1);
+	table.keys.push_back(key);
+	return table;
+}
+
+TEST_CASE("row replacer upserts changed rows", "[row_replacer]") {
+	Table table(uniquetbl());
+
+	SECTION("updates rows in place, only clearing unique keys whose values have changed") {
+		StatementRecordingClient client;
+		RowReplacer<StatementRecordingClient> replacer(client, table, false, nullptr);
+		replacer.replace_row(uniquetbl_row(1, 10, "new"), uniquetbl_row(1, 10, "old"));
+		replacer.replace_row(uniquetbl_row(2, 30, "same"), uniquetbl_row(2, 20, "same"));
+		replacer.apply();
+
+		REQUIRE(client.statements == vector<string>({
+			"DELETE FROM \"uniquetbl\" WHERE (sec=30)",
+			"INSERT INTO \"uniquetbl\" (\"pri\", \"sec\", \"tri\") VALUES\n(1,10,'new'),\n(2,30,'same')\n"
+				"ON CONFLICT (\"pri\") DO UPDATE SET \"sec\" = EXCLUDED.\"sec\", \"tri\" = EXCLUDED.\"tri\"",
+		}));
+	}
+
+	SECTION("clears all the unique keys if the existing row isn't known") {
+		StatementRecordingClient client;
+		RowReplacer<StatementRecordingClient> replacer(client, table, false, nullptr);
+		replacer.replace_row(uniquetbl_row(1, 10, "new"));
+		replacer.apply();
+
+		REQUIRE(client.statements.size() == 2);
+		REQUIRE(client.statements[0] == "DELETE FROM \"uniquetbl\" WHERE (sec=10)");
+	}
+
+	SECTION("uses ON DUPLICATE KEY UPDATE on databases that use REPLACE to insert rows") {
+		ReplaceStatementRecordingClient client;
+		RowReplacer<ReplaceStatementRecordingClient> replacer(client, table, false, nullptr);
+		replacer.replace_row(uniquetbl_row(1, 10, "new"), uniquetbl_row(1, 10, "old"));
+		replacer.insert_row(uniquetbl_row(3, 30, "inserted"));
+		replacer.apply();
+
+		REQUIRE(client.statements == vector<string>({
+			"INSERT INTO `uniquetbl` (`pri`, `sec`, `tri`) VALUES\n(1,10,'new')\n"
+				"ON DUPLICATE KEY UPDATE `sec` = VALUES(`sec`), `tri` = VALUES(`tri`)",
+			"REPLACE INTO `uniquetbl` (`pri`, `sec`, `tri`) VALUES\n(3,30,'inserted')",
+		}));
+	}
+
+	SECTION("deletes and reinserts rows if there are no other columns to update") {
+		table.primary_key_columns = ColumnIndices{0, 1, 2};
+		StatementRecordingClient client;
+		RowReplacer<StatementRecordingClient> replacer(client, table, false, nullptr);
+		replacer.replace_row(uniquetbl_row(1, 10, "new"), uniquetbl_row(1, 10, "old"));
+		replacer.apply();
+
+		REQUIRE(client.statements.size() == 3);
+		REQUIRE(client.statements[0].substr(0, 11) == "DELETE FROM");
+		REQUIRE(client.statements[1].substr(0, 11) == "DELETE FROM");
+		REQUIRE(client.statements[2] == "INSERT INTO \"uniquetbl\" (\"pri\", \"sec\", \"tri\") VALUES\n(1,10,'new')");
+	}
+}
+
+TEST_CASE("row replacer sends values as statement parameters", "[row_replacer]") {
+	Table table(uniquetbl());
+	ParameterRecordingClient client;
+	RowReplacer<ParameterRecordingClient> replacer(client, table, false, nullptr);
+
+	for (int pri = 1; pri <= 2500; pri++) {
+		replacer.insert_row(uniquetbl_row(pri, pri, "new"));
+	}
+	replacer.apply();
+
+	REQUIRE(client.parameters_sent == vector<size_t>({3000, 3000, 1500}));
+	REQUIRE(client.prepared == vector<bool>({true, true, false}));
+	REQUIRE(client.statements.size() == 4); // the first is the DELETE from the unique key clearer
+	REQUIRE(client.statements[1] == "INSERT INTO \"uniquetbl\" (\"pri\", \"sec\", \"tri\") VALUES");
+	REQUIRE(replacer.bytes_to_insert() == 0);
+}
@@ -35,6 +35,55 @@ class RowsFromTest < KitchenSync::EndpointTestCase
                    ["secondtbl", ["aa", 0], ["ab", 0]]
   end
 
+  test_each "sends the rows in columnar batches in later protocol versions" do
+    create_some_tables
+    execute "INSERT INTO footbl VALUES (2, 10, 'test'), (4, NULL, 'foo'), (5, NULL, NULL), (8, -1, 'longer str'), (9, 10, 'test')"
+    @rows = [[2,  10,       "test"],
+             [4, nil,        "foo"],
+             [5, nil,          nil],
+             [8,  -1, "longer str"],
+             [9,  10,       "test"]]
+    send_handshake_commands(protocol_version: LATEST_PROTOCOL_VERSION_SUPPORTED)
+
+    send_command   Commands::ROWS, ["footbl", [], []]
+    verb, range, *batches = read_command
+    assert_equal   Commands::ROWS, verb
+    assert_equal   ["footbl", [], []], range
+    assert_equal   @rows, unpack_columnar_rows(batches)
+
+    send_command   Commands::ROWS, ["footbl", [9], []]
+    expect_command Commands::ROWS,
+                   ["footbl", [9], []]
+  end
+
+  test_each "returns the key and fingerprint of each row in the range, and retrieves rows by key" do
+    create_some_tables
+    execute "INSERT INTO footbl VALUES (2, 10, 'test'), (4, NULL, 'foo'), (5, NULL, NULL), (8, -1, 'longer str')"
+    @rows = [[2,  10,       "test"],
+             [4, nil,        "foo"],
+             [5, nil,          nil],
+             [8,  -1, "longer str"]]
+    send_handshake_commands(protocol_version: LATEST_PROTOCOL_VERSION_SUPPORTED)
+
+    send_command   Commands::ROW_HASHES, ["footbl", [1], [5]]
+    expect_command Commands::ROW_HASHES,
+                   ["footbl", [1], [5]],
+                   [[2], fingerprint_of(@rows[0])],
+                   [[4], fingerprint_of(@rows[1])],
+                   [[5], fingerprint_of(@rows[2])]
+
+    send_command   Commands::ROW_HASHES, ["footbl", [8], []]
+    expect_command Commands::ROW_HASHES,
+                   ["footbl", [8], []]
+
+    # keys that don't exist are simply omitted from the response, and the rows are returned in key order
+    send_command   Commands::ROWS_BY_KEYS, ["footbl"], [8], [3], [2]
+    verb, table, *batches = read_command
+    assert_equal   Commands::ROWS_BY_KEYS, verb
+    assert_equal   ["footbl"], table
+    assert_equal   [@rows[0], @rows[3]], unpack_columnar_rows(batches)
+  end
+
   test_each "returns all the rows whose key is greater than the first argument and not greater than the last argument" do
     create_some_tables
     execute "INSERT INTO footbl VALUES (2, 10, 'test'), (4, NULL, 'foo'), (5, NULL, NULL), (8, -1, 'longer str')"
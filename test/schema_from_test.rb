@@ -29,6 +29,19 @@ class SchemaFromTest < KitchenSync::EndpointTestCase
                    [{"tables" => [footbl_def, misctbl_def, secondtbl_def, texttbl_def]}]
   end
 
+  test_each "returns the estimated size of each table" do
+    clear_schema
+    create_footbl
+    create_secondtbl
+    send_handshake_commands(protocol_version: LATEST_PROTOCOL_VERSION_SUPPORTED)
+
+    send_command   Commands::TABLE_SIZES
+    command, arguments = read_command
+    assert_equal   Commands::TABLE_SIZES, command
+    assert_equal   %w(footbl secondtbl), arguments.first.keys.sort
+    assert         arguments.first.values.all? { |size| size.is_a?(Integer) }
+  end
+
   test_each "selects the first unique key with no nullable columns if there is no primary key" do # rejecting the case where there is no such table is handled at the 'to' end
     clear_schema
     create_noprimarytbl
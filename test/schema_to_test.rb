@@ -276,7 +276,7 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     create_secondtbl
 
     expect_stderr("Couldn't find a primary or non-nullable unique key on table noprimarytbl") do
-      expect_handshake_commands(schema: {"tables" => [noprimarytbl_def(create_suitable_keys: false), secondtbl_def]})
+      expect_handshake_commands(schema: {"tables" => [noprimarytbl_def(create_suitable_keys: false), secondtbl_def]}, table_sizes: nil)
       read_command rescue nil
     end
   end
@@ -1,5 +1,7 @@
 require File.expand_path(File.join(File.dirname(__FILE__), 'test_helper'))
 
+require 'tmpdir'
+
 class SnapshotFromTest < KitchenSync::EndpointTestCase
   include TestTableSchemas
 
@@ -54,4 +56,64 @@ class SnapshotFromTest < KitchenSync::EndpointTestCase
       extra_spawner.stop_binary
     end
   end
+
+  def start_extra_spawner
+    KitchenSyncSpawner.new(binary_path, program_args, program_env, :capture_stderr_in => captured_stderr_filename).tap(&:start_binary).tap do |extra_spawner|
+      extra_spawner.send_command Commands::PROTOCOL, [LATEST_PROTOCOL_VERSION_SUPPORTED]
+      assert_equal [Commands::PROTOCOL, [LATEST_PROTOCOL_VERSION_SUPPORTED]], extra_spawner.read_command
+      extra_spawner.send_command Commands::TYPES, [connection.supported_column_types]
+      assert_equal [Commands::TYPES], extra_spawner.read_command
+    end
+  end
+
+  test_each "doesn't cache hashes from an imported snapshot for tables changed after the snapshot was exported" do
+    omit "MySQL blocks commits until the snapshot is unheld" if @database_server == "mysql"
+    clear_schema
+    create_footbl
+    execute "INSERT INTO footbl VALUES (2, 10, 'test'), (4, NULL, 'foo')"
+    old_rows = [[2, 10, "test"], [4, nil, "foo"]]
+    new_rows = [[2, 10, "test"], [4, nil, "changed"]]
+
+    Dir.mktmpdir do |hash_cache_directory|
+      program_env['ENDPOINT_HASH_CACHE'] = hash_cache_directory
+
+      send_protocol_command(LATEST_PROTOCOL_VERSION_SUPPORTED)
+      send_types_command(connection.supported_column_types)
+      send_command Commands::EXPORT_SNAPSHOT
+      command, args = read_command
+      assert_equal Commands::EXPORT_SNAPSHOT, command
+      snapshot = args[0]
+
+      execute "UPDATE footbl SET col3 = 'changed' WHERE col1 = 4"
+
+      extra_spawner = start_extra_spawner
+      begin
+        extra_spawner.send_command Commands::IMPORT_SNAPSHOT, [snapshot]
+        assert_equal [Commands::IMPORT_SNAPSHOT], extra_spawner.read_command
+        send_command Commands::UNHOLD_SNAPSHOT
+        expect_command Commands::UNHOLD_SNAPSHOT
+
+        # the imported snapshot doesn't include the change, so we should see the old rows...
+        extra_spawner.send_command Commands::HASH, ["footbl", [], [], 1000]
+        assert_equal [Commands::HASH, ["footbl", [], [], 1000, 2, hash_of(old_rows)]], extra_spawner.read_command
+        extra_spawner.quit
+        extra_spawner.wait
+      ensure
+        extra_spawner.stop_binary
+      end
+      spawner.quit
+      spawner.wait
+
+      # ...but they mustn't be cached for the next run, which should see the new rows
+      extra_spawner = start_extra_spawner
+      begin
+        extra_spawner.send_command Commands::WITHOUT_SNAPSHOT
+        assert_equal [Commands::WITHOUT_SNAPSHOT], extra_spawner.read_command
+        extra_spawner.send_command Commands::HASH, ["footbl", [], [], 1000]
+        assert_equal [Commands::HASH, ["footbl", [], [], 1000, 2, hash_of(new_rows)]], extra_spawner.read_command
+      ensure
+        extra_spawner.stop_binary
+      end
+    end
+  end
 end
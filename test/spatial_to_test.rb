@@ -60,9 +60,9 @@ class SpatialToTest < KitchenSync::EndpointTestCase
     send_command   Commands::RANGE, ["spatialtbl", [1], [2]]
     expect_command Commands::ROWS,
                    ["spatialtbl", [], [2]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["spatialtbl", [], [2]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal [[1, 0, ["010100000000000000000024400000000000003440"].pack("H*"), 0, ["010100000000000000000034400000000000003E40"].pack("H*")],
@@ -79,9 +79,9 @@ class SpatialToTest < KitchenSync::EndpointTestCase
     send_command   Commands::RANGE, ["spatialtbl", [1], [2]]
     expect_command Commands::ROWS,
                    ["spatialtbl", [], [2]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["spatialtbl", [], [2]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal [[1, 4326, ["010100000000000000000024400000000000003440"].pack("H*"), 4326, ["010100000000000000000034400000000000003E40"].pack("H*")],
@@ -0,0 +1,72 @@
+#include "../../catch2/catch.hpp"
+
+#include <string>
+#include "../src/spsc_ring.h"
+
+using namespace std;
+
+TEST_CASE("SPSC ring", "[spsc_ring]") {
+	SECTION("holds up to its capacity, in order") {
+		SPSCRing<int, 4> ring;
+		int value;
+
+		REQUIRE(!ring.try_pop(value));
+		for (int i = 1; i <= 4; i++) {
+			value = i;
+			REQUIRE(ring.try_push(value));
+		}
+		value = 5;
+		REQUIRE(!ring.try_push(value));
+
+		for (int i = 1; i <= 4; i++) {
+			REQUIRE(ring.try_pop(value));
+			REQUIRE(value == i);
+		}
+		REQUIRE(!ring.try_pop(value));
+	}
+
+	SECTION("swaps values rather than copying them") {
+		SPSCRing<string, 2> ring;
+		string value("first");
+
+		REQUIRE(ring.try_push(value));
+		REQUIRE(value == "");
+		value = "second";
+		REQUIRE(ring.try_push(value));
+
+		string popped("spare");
+		REQUIRE(ring.try_pop(popped));
+		REQUIRE(popped == "first");
+		value = "third";
+		REQUIRE(ring.try_push(value));
+		REQUIRE(value == "spare");
+	}
+
+	SECTION("passes values between threads") {
+		SPSCRing<size_t, 16> ring;
+		const size_t values_to_send = 100000;
+
+		std::thread producer([&]() {
+			for (size_t i = 1; i <= values_to_send; i++) {
+				size_t value = i;
+				ring.push(value);
+			}
+		});
+
+		size_t expected = 1, value, attempts = 0;
+		bool in_order = true;
+		while (expected <= values_to_send) {
+			if (ring.try_pop(value)) {
+				in_order = in_order && value == expected;
+				expected++;
+				attempts = 0;
+			} else {
+				ring.wait_a_moment(attempts++);
+			}
+		}
+		producer.join();
+
+		REQUIRE(in_order);
+		REQUIRE(!ring.try_pop(value));
+	}
+}
@@ -1,6 +1,7 @@
 #include "../../catch2/catch.hpp"
 
 #include "../src/sql_functions.h"
+#include "../src/message_pack/copy_packed.h"
 
 TEST_CASE("quote_identifier", "[sql_functions]") {
 	REQUIRE(quote_identifier("foo", '`') == "`foo`");
@@ -19,3 +20,21 @@ TEST_CASE("quote_identifier", "[sql_functions]") {
 	REQUIRE(quote_identifier("\"foo_bar", '"') == "\"\"\"foo_bar\"");
 	REQUIRE(quote_identifier("foo_bar\"", '"') == "\"foo_bar\"\"\"");
 }
+
+TEST_CASE("log_values_list", "[sql_functions]") {
+	Table table("footbl");
+	table.columns.resize(3);
+	table.columns[0].column_type = ColumnType::sint_32bit;
+	table.columns[1].column_type = ColumnType::text;
+	table.columns[2].column_type = ColumnType::binary;
+	table.primary_key_columns = ColumnIndices{0, 1, 2};
+
+	ColumnValues values(3);
+	values[0] << 42;
+	values[1] << string("it's");
+	values[2] << string("\x01\xab", 2);
+
+	REQUIRE(log_values_list(table, values) == "(42,'it''s',X'01ab')");
+	REQUIRE(log_values_list(table, ColumnValues(values.begin(), values.begin() + 1)) == "(42)");
+	REQUIRE(log_values_list(table, ColumnValues()) == "(NULL)");
+}
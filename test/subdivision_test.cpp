@@ -0,0 +1,128 @@
+#include "../../catch2/catch.hpp"
+
+#include "../src/subdivision.h"
+#include "../src/message_pack/copy_packed.h"
+
+template <typename T>
+PackedValue packed(const T &value) {
+	PackedValue result;
+	Packer<PackedValue> packer(result);
+	packer << value;
+	return result;
+}
+
+template <typename T>
+T unpacked(const PackedValue &value) {
+	PackedValueReadStream stream(value);
+	Unpacker<PackedValueReadStream> unpacker(stream);
+	return unpacker.template next<T>();
+}
+
+void add_column(Table &table, const string &name, ColumnType column_type, bool primary_key = true) {
+	Column column;
+	column.name = name;
+	column.column_type = column_type;
+	if (primary_key) table.primary_key_columns.push_back(table.columns.size());
+	table.columns.push_back(column);
+}
+
+TEST_CASE("subdivide integer keys", "[subdivision]") {
+	Table table("footbl");
+	add_column(table, "id", ColumnType::sint_32bit);
+	REQUIRE(primary_key_subdividable(table));
+
+	ColumnValues midpoint(subdivide_primary_key_range(table, ColumnValues{packed(10)}, ColumnValues{packed(30)}));
+	REQUIRE(midpoint.size() == 1);
+	REQUIRE(unpacked<int32_t>(midpoint[0]) == 20);
+}
+
+TEST_CASE("subdivide composite keys", "[subdivision]") {
+	Table table("secondtbl");
+	add_column(table, "tenant_id", ColumnType::sint_64bit);
+	add_column(table, "id", ColumnType::sint_64bit);
+	add_column(table, "data", ColumnType::text, false);
+	REQUIRE(primary_key_subdividable(table));
+
+	SECTION("splits on the leading column, giving a partial key") {
+		ColumnValues midpoint(subdivide_primary_key_range(table, ColumnValues{packed(1), packed(900)}, ColumnValues{packed(9), packed(5)}));
+		REQUIRE(midpoint.size() == 1);
+		REQUIRE(unpacked<int64_t>(midpoint[0]) == 5);
+	}
+
+	SECTION("splits on the next column when the leading column is the same throughout the range") {
+		ColumnValues midpoint(subdivide_primary_key_range(table, ColumnValues{packed(3), packed(100)}, ColumnValues{packed(3), packed(200)}));
+		REQUIRE(midpoint.size() == 2);
+		REQUIRE(unpacked<int64_t>(midpoint[0]) == 3);
+		REQUIRE(unpacked<int64_t>(midpoint[1]) == 150);
+	}
+
+	SECTION("isn't possible when the leading column can't be interpolated") {
+		Table datetbl("datetbl");
+		add_column(datetbl, "day", ColumnType::date);
+		add_column(datetbl, "id", ColumnType::sint_64bit);
+		REQUIRE(!primary_key_subdividable(datetbl));
+	}
+}
+
+TEST_CASE("subdivide string keys", "[subdivision]") {
+	Table table("slugtbl");
+	add_column(table, "slug", ColumnType::text_varchar);
+	REQUIRE(primary_key_subdividable(table));
+
+	SECTION("interpolates lexicographically after the common prefix") {
+		string midpoint(unpacked<string>(subdivide_primary_key_range(table, ColumnValues{packed(string("product-a"))}, ColumnValues{packed(string("product-y"))})[0]));
+		REQUIRE(midpoint.substr(0, 8) == "product-");
+		REQUIRE(midpoint > "product-a");
+		REQUIRE(midpoint < "product-y");
+		REQUIRE(midpoint[8] == 'm');
+	}
+
+	SECTION("handles strings of different lengths") {
+		string midpoint(unpacked<string>(subdivide_primary_key_range(table, ColumnValues{packed(string("a"))}, ColumnValues{packed(string("zebra"))})[0]));
+		REQUIRE(midpoint > "a");
+		REQUIRE(midpoint < "zebra");
+	}
+
+	SECTION("only produces printable ASCII after the common prefix") {
+		string midpoint(unpacked<string>(subdivide_primary_key_range(table, ColumnValues{packed(string("caf\xC3\xA9" "a"))}, ColumnValues{packed(string("caf\xC3\xAA" "z"))})[0]));
+		REQUIRE(midpoint.substr(0, 3) == "caf");
+		for (size_t pos = 3; pos < midpoint.size(); pos++) {
+			REQUIRE(midpoint[pos] >= 0x20);
+			REQUIRE(midpoint[pos] <= 0x7e);
+		}
+	}
+
+	SECTION("falls back to the start of the range if the keys aren't in bytewise order") {
+		string midpoint(unpacked<string>(subdivide_primary_key_range(table, ColumnValues{packed(string("b"))}, ColumnValues{packed(string("B"))})[0]));
+		REQUIRE(midpoint == "b");
+	}
+}
+
+TEST_CASE("partial keys from histogram bounds", "[subdivision]") {
+	Table table("footbl");
+
+	SECTION("parses integers") {
+		add_column(table, "id", ColumnType::sint_32bit);
+		REQUIRE(unpacked<int64_t>(partial_key_from_text(table, "-42")[0]) == -42);
+		REQUIRE(partial_key_from_text(table, "4x").empty());
+		REQUIRE(partial_key_from_text(table, "").empty());
+	}
+
+	SECTION("parses unsigned integers") {
+		add_column(table, "id", ColumnType::uint_64bit);
+		REQUIRE(unpacked<uint64_t>(partial_key_from_text(table, "18446744073709551615")[0]) == 18446744073709551615ULL);
+	}
+
+	SECTION("uses strings as they are") {
+		add_column(table, "slug", ColumnType::text_varchar);
+		add_column(table, "id", ColumnType::sint_32bit);
+		ColumnValues key(partial_key_from_text(table, "product-m"));
+		REQUIRE(key.size() == 1);
+		REQUIRE(unpacked<string>(key[0]) == "product-m");
+	}
+
+	SECTION("doesn't use other types") {
+		add_column(table, "day", ColumnType::date);
+		REQUIRE(partial_key_from_text(table, "2020-01-01").empty());
+	}
+}
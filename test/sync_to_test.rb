@@ -1,5 +1,8 @@
 require File.expand_path(File.join(File.dirname(__FILE__), 'test_helper'))
 
+require 'tempfile'
+require 'yaml'
+
 class SyncToTest < KitchenSync::EndpointTestCase
   include TestTableSchemas
 
@@ -23,6 +26,30 @@ class SyncToTest < KitchenSync::EndpointTestCase
     @keys = @rows.collect {|row| [row[0]]}
   end
 
+  # hashes computed by aggregate queries are specific to the type of database, so we get the 'from' end to hash the
+  # ranges we expect to be asked about, for a 'to' end test of the same data.
+  def hashes_in_database_at_from_end(table_name, ranges)
+    from_spawner = KitchenSyncSpawner.new(binary_path, ["from"], program_env).tap(&:start_binary)
+    from_spawner.send_command Commands::PROTOCOL, [LATEST_PROTOCOL_VERSION_SUPPORTED]
+    from_spawner.read_command
+    from_spawner.send_command Commands::HASH_ALGORITHM, [HashAlgorithm::MD5]
+    from_spawner.read_command
+    from_spawner.send_command Commands::HASH_IN_DATABASE, [@database_server]
+    assert_equal [Commands::HASH_IN_DATABASE, [true]], from_spawner.read_command
+    from_spawner.send_command Commands::TYPES, [connection.supported_column_types]
+    from_spawner.read_command
+    from_spawner.send_command Commands::WITHOUT_SNAPSHOT
+    from_spawner.read_command
+
+    ranges.each_with_object({}) do |range, results|
+      from_spawner.send_command Commands::HASH, [table_name, *range]
+      _, (_, _, _, _, row_count, hash) = from_spawner.read_command
+      results[range] = [row_count, hash]
+    end
+  ensure
+    from_spawner.stop_binary if from_spawner
+  end
+
   test_each "it immediately requests the key range, and finishes without needing to make any changes if the table is empty at both ends" do
     clear_schema
     create_footbl
@@ -62,9 +89,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     send_command   Commands::RANGE, ["footbl", [2], [1001]]
     expect_command Commands::ROWS,
                    ["footbl", [], [1001]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["footbl", [], [1001]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -78,34 +105,76 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["footbl"]
     send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
 
-    # the range will be initially subdivided into two around the middle of the key range
+    # the range will be initially subdivided into two around the middle of the key range, and both halves checked at once
+    expect_hash_multi_command "footbl",
+                   [[], @keys[6], 1] => [1, hash_of(@rows[0..0])],
+                   [@keys[6], @keys[8], 1] => [1, hash_of(@rows[7..7])]
+
+    # we'll subdivide the remaining part of the first half again, and continue on with the second half.
+    # note that the subdivisions don't fall exactly halfway in the ranges, because the keys are not evenly distributed
+    expect_hash_multi_command "footbl",
+                   [@keys[0], @keys[4], 2] => [2, hash_of(@rows[1..2])],
+                   [@keys[4], @keys[6], 2] => [2, hash_of(@rows[5..6])],
+                   [@keys[7], @keys[8], 2] => [1, hash_of(@rows[8..8])]
+
+    # this is the continuation of the first of those ranges; one more subdivision will have been attempted, but it
+    # wouldn't have been able to as the keys are so unevenly spread that there were no rows after the midpoint.
+    # with only one range left to check, it's sent as a plain HASH command.
+    expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 4]
+    send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 4, 2, hash_of(@rows[3..4])]
+
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "checks one range per HASH command if the other end doesn't support HASH_MULTI" do
+    setup_with_footbl
+
+    expect_handshake_commands(protocol_version_supported: LAST_SINGLE_RANGE_HASH_PROTOCOL_VERSION, schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
     expect_command Commands::HASH, ["footbl", [], @keys[6], 1]
     send_command   Commands::HASH, ["footbl", [], @keys[6], 1, 1, hash_of(@rows[0..0])]
-
-    # carrying on with the second half of that first subdivision
     expect_command Commands::HASH, ["footbl", @keys[6], @keys[8], 1]
     send_command   Commands::HASH, ["footbl", @keys[6], @keys[8], 1, 1, hash_of(@rows[7..7])]
-
-    # we'll subdivide the remaining part of that range again, and will process the subdivisions first
-    # note that the subdivisions don't fall exactly halfway in the ranges, because the keys are not evenly distributed
     expect_command Commands::HASH, ["footbl", @keys[0], @keys[4], 2]
     send_command   Commands::HASH, ["footbl", @keys[0], @keys[4], 2, 2, hash_of(@rows[1..2])]
     expect_command Commands::HASH, ["footbl", @keys[4], @keys[6], 2]
     send_command   Commands::HASH, ["footbl", @keys[4], @keys[6], 2, 2, hash_of(@rows[5..6])]
-
-    # this is the continuation of the second-to-last range; one more subdivision will have been attempted, but it
-    # wouldn't have been able to as the keys are so unevenly spread that there were no rows after the midpoint
     expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 4]
     send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 4, 2, hash_of(@rows[3..4])]
-
-    # and again the keys are such that we don't see a further subdivision, although it would have been attempted
     expect_command Commands::HASH, ["footbl", @keys[7], @keys[8], 2]
     send_command   Commands::HASH, ["footbl", @keys[7], @keys[8], 2, 1, hash_of(@rows[8..8])]
-
     expect_quit_and_close
+  end
 
-    assert_equal @rows,
-                 query("SELECT * FROM footbl ORDER BY col1")
+  test_each "starts the forward scan from the block size in the statistics file, and records the table's statistics afterwards" do
+    setup_with_footbl
+    file = Tempfile.new('statistics')
+    file.write("footbl:\n  rows_per_block: 100\n")
+    file.close
+    program_env['ENDPOINT_STATISTICS_FILE'] = file.path
+
+    begin
+      expect_handshake_commands(schema: {"tables" => [footbl_def]})
+      expect_command Commands::RANGE, ["footbl"]
+      send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
+      expect_hash_multi_command "footbl",
+                     [[], @keys[6], 100] => [7, hash_of(@rows[0..6])],
+                     [@keys[6], @keys[8], 100] => [2, hash_of(@rows[7..8])]
+      expect_quit_and_close
+      spawner.wait # the file is written as the program exits
+
+      statistics = YAML.load_file(file.path)
+      assert_equal 9, statistics["footbl"]["rows"]
+      assert_equal 0, statistics["footbl"]["mismatch_density"]
+      assert_equal 100, statistics["footbl"]["rows_per_block"] # we didn't get to a bigger block
+      assert statistics["footbl"]["average_row_size"] > 0
+    ensure
+      file.unlink
+    end
   end
 
   test_each "requests and applies the row if we send a different hash for a single row, then moves onto the next row, resetting the number of rows to hash" do
@@ -115,32 +184,44 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands(schema: {"tables" => [footbl_def]})
     expect_command Commands::RANGE, ["footbl"]
     send_command   Commands::RANGE, ["footbl", @keys[0], @keys[-1]]
-    expect_command Commands::HASH, ["footbl", [], @keys[6], 1]
-    send_command   Commands::HASH, ["footbl", [], @keys[6], 1, 1, hash_of(@rows[0..0])]
-    expect_command Commands::HASH, ["footbl", @keys[6], @keys[8], 1]
-    send_command   Commands::HASH, ["footbl", @keys[6], @keys[8], 1, 1, hash_of(@rows[7..7])]
-    expect_command Commands::ROWS,
+    expect_hash_multi_command "footbl",
+                   [[], @keys[6], 1] => [1, hash_of(@rows[0..0])],
+                   [@keys[6], @keys[8], 1] => [1, hash_of(@rows[7..7])]
+
+    # the mismatched row is found by comparing row hashes, and then retrieved by key, while the next ranges are checked
+    expect_command Commands::ROW_HASHES,
                    ["footbl", [], @keys[0]]
-    send_results   Commands::ROWS,
+    send_results   Commands::ROW_HASHES,
                    ["footbl", [], @keys[0]],
-                   @rows[0]
-    expect_command Commands::HASH, ["footbl", @keys[0], @keys[4], 1]
-    send_command   Commands::HASH, ["footbl", @keys[0], @keys[4], 1, 1, hash_of(@rows[1..1])]
-    expect_command Commands::HASH, ["footbl", @keys[4], @keys[6], 1]
-    send_command   Commands::HASH, ["footbl", @keys[4], @keys[6], 1, 1, hash_of(@rows[5..5])]
-    expect_command Commands::ROWS,
+                   [@keys[0], fingerprint_of(@rows[0])]
+    expect_hash_multi_command "footbl",
+                   [@keys[0], @keys[4], 1] => [1, hash_of(@rows[1..1])],
+                   [@keys[4], @keys[6], 1] => [1, hash_of(@rows[5..5])],
+                   [@keys[7], @keys[8], 2] => [1, hash_of(@rows[8..8])]
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @keys[0]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[0..0]
+
+    expect_command Commands::ROW_HASHES,
                    ["footbl", @keys[0], @keys[1]]
-    send_results   Commands::ROWS,
+    send_results   Commands::ROW_HASHES,
                    ["footbl", @keys[0], @keys[1]],
-                   @rows[1]
-    expect_command Commands::HASH, ["footbl", @keys[1], @keys[4], 1]
-    send_command   Commands::HASH, ["footbl", @keys[1], @keys[4], 1, 1, hash_of(@rows[2..2])]
-    expect_command Commands::HASH, ["footbl", @keys[5], @keys[6], 2]
-    send_command   Commands::HASH, ["footbl", @keys[5], @keys[6], 2, 1, hash_of(@rows[6..6])]
+                   [@keys[1], fingerprint_of(@rows[1])]
+    expect_hash_multi_command "footbl",
+                   [@keys[1], @keys[4], 1] => [1, hash_of(@rows[2..2])],
+                   [@keys[5], @keys[6], 2] => [1, hash_of(@rows[6..6])]
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @keys[1]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[1..1]
+
     expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 2]
     send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 2, 2, hash_of(@rows[3..4])]
-    expect_command Commands::HASH, ["footbl", @keys[7], @keys[8], 2]
-    send_command   Commands::HASH, ["footbl", @keys[7], @keys[8], 2, 1, hash_of(@rows[8..8])]
     expect_quit_and_close
 
     assert_equal @rows,
@@ -155,34 +236,35 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["footbl"]
     send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
 
-    expect_command Commands::HASH, ["footbl", [], @keys[6], 1]
-    send_command   Commands::HASH, ["footbl", [], @keys[6], 1, 1, hash_of(@rows[0..0])]
-
-    # second half of the initial subdivision, which we'll come back to later
-    expect_command Commands::HASH, ["footbl", @keys[6], @keys[8], 1]
-    send_command   Commands::HASH, ["footbl", @keys[6], @keys[8], 1, 1, hash_of(@rows[7..7])]
+    expect_hash_multi_command "footbl",
+                   [[], @keys[6], 1] => [1, hash_of(@rows[0..0])],
+                   [@keys[6], @keys[8], 1] => [1, hash_of(@rows[7..7])]
 
-    # carrying on with the first half
-    expect_command Commands::HASH, ["footbl", @keys[0], @keys[4], 2]
-    send_command   Commands::HASH, ["footbl", @keys[0], @keys[4], 2, 2, hash_of(@rows[1..2])]
-    expect_command Commands::HASH, ["footbl", @keys[4], @keys[6], 2]
-    send_command   Commands::HASH, ["footbl", @keys[4], @keys[6], 2, 2, hash_of(@rows[5..6])]
+    expect_hash_multi_command "footbl",
+                   [@keys[0], @keys[4], 2] => [2, hash_of(@rows[1..2])],
+                   [@keys[4], @keys[6], 2] => [2, hash_of(@rows[5..6])],
+                   [@keys[7], @keys[8], 2] => [1, hash_of(@rows[8..8])]
 
     expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 4]
     send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 4, 2, hash_of(@rows[3..4])]
 
-    # order from here on is just an implementation detail, but we expect to see the following commands in some order
-    expect_command Commands::HASH, ["footbl", @keys[7], @keys[8], 2]
-    send_command   Commands::HASH, ["footbl", @keys[7], @keys[8], 2, 1, hash_of(@rows[8..8])]
+    # that didn't match, so we halve the number of rows and try again
     expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 1]
     send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 1, 1, hash_of(@rows[3..3])]
     expect_command Commands::HASH, ["footbl", @keys[3], @keys[4], 1]
     send_command   Commands::HASH, ["footbl", @keys[3], @keys[4], 1, 1, hash_of(@rows[4..4])]
-    expect_command Commands::ROWS,
+
+    expect_command Commands::ROW_HASHES,
                    ["footbl", @keys[3], @keys[4]]
-    send_results   Commands::ROWS,
+    send_results   Commands::ROW_HASHES,
                    ["footbl", @keys[3], @keys[4]],
-                   @rows[4]
+                   [@keys[4], fingerprint_of(@rows[4])]
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @keys[4]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[4..4]
     expect_quit_and_close
 
     assert_equal @rows,
@@ -203,9 +285,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["uniquetbl"]
     send_command   Commands::RANGE, ["uniquetbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["uniquetbl", [2], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["uniquetbl", [2], @keys[-1]],
-                   *@rows[1..-1]
+                   @rows[1..-1]
     expect_command Commands::HASH, ["uniquetbl", [], [2], 1]
     send_command   Commands::HASH, ["uniquetbl", [], [2], 1, 1, hash_of(@rows[0..0])]
     expect_command Commands::HASH, ["uniquetbl", [1], [2], 2]
@@ -224,10 +306,10 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["footbl"]
     send_command   Commands::RANGE, ["footbl", [2], [3]]
     expect_command Commands::ROWS, ["footbl", [], [3]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["footbl", [], [3]],
-                   [2, nil, nil],
-                   [3, nil,  "foo"]
+                   [[2, nil, nil],
+                    [3, nil,  "foo"]]
     expect_quit_and_close
 
     assert_equal [[2, nil,   nil],
@@ -247,10 +329,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands(schema: {"tables" => [texttbl_def]})
     expect_command Commands::RANGE, ["texttbl"]
     send_command   Commands::RANGE, ["texttbl", [0], [1]]
-    expect_command Commands::HASH, ["texttbl", [], @keys[0], 1]
-    send_command   Commands::HASH, ["texttbl", [], @keys[0], 1, 1, hash_of(@rows[0..0])]
-    expect_command Commands::HASH, ["texttbl", [0], @keys[-1], 1]
-    send_command   Commands::HASH, ["texttbl", [0], @keys[-1], 1, 1, hash_of(@rows[1..1])]
+    expect_hash_multi_command "texttbl",
+                   [[], @keys[0], 1] => [1, hash_of(@rows[0..0])],
+                   [[0], @keys[-1], 1] => [1, hash_of(@rows[1..1])]
     expect_quit_and_close
 
     assert_equal @rows,
@@ -268,9 +349,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["texttbl"]
     send_command   Commands::RANGE, ["texttbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["texttbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["texttbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -289,10 +370,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands(schema: {"tables" => [texttbl_def]})
     expect_command Commands::RANGE, ["texttbl"]
     send_command   Commands::RANGE, ["texttbl", [0], [1]]
-    expect_command Commands::HASH, ["texttbl", [], @keys[0], 1]
-    send_command   Commands::HASH, ["texttbl", [], @keys[0], 1, 1, hash_of(@rows[0..0])]
-    expect_command Commands::HASH, ["texttbl", [0], @keys[-1], 1]
-    send_command   Commands::HASH, ["texttbl", [0], @keys[-1], 1, 1, hash_of(@rows[1..1])]
+    expect_hash_multi_command "texttbl",
+                   [[], @keys[0], 1] => [1, hash_of(@rows[0..0])],
+                   [[0], @keys[-1], 1] => [1, hash_of(@rows[1..1])]
     expect_quit_and_close
 
     assert_equal @rows,
@@ -310,9 +390,32 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["texttbl"]
     send_command   Commands::RANGE, ["texttbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["texttbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
+                   ["texttbl", [], @keys[-1]],
+                   @rows
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM texttbl ORDER BY pri")
+  end
+
+  test_each "handles saving values with tabs, newlines, and backslashes into an empty table" do
+    clear_schema
+    create_texttbl
+
+    @rows = [[1, "a\tb"],
+             [2, "c\nd\r\n"],
+             [3, "\\N"],
+             [4, "e\\tf\\"]]
+    @keys = @rows.collect {|row| [row[0]]}
+
+    expect_handshake_commands(schema: {"tables" => [texttbl_def]})
+    expect_command Commands::RANGE, ["texttbl"]
+    send_command   Commands::RANGE, ["texttbl", @keys[0], @keys[-1]]
+    expect_command Commands::ROWS, ["texttbl", [], @keys[-1]]
+    send_rows      Commands::ROWS,
                    ["texttbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -334,9 +437,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["misctbl"]
     send_command   Commands::RANGE, ["misctbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["misctbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["misctbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -354,32 +457,42 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands(schema: {"tables" => [footbl_def.merge("keys" => [{"name" => "unique_key", "unique" => true, "columns" => [2]}])]})
     expect_command Commands::RANGE, ["footbl"]
     send_command   Commands::RANGE, ["footbl", @keys[0], @keys[-1]]
-    expect_command Commands::HASH, ["footbl", [], @keys[6], 1]
-    send_command   Commands::HASH, ["footbl", [], @keys[6], 1, 1, hash_of(@rows[0..0])]
-    expect_command Commands::HASH, ["footbl", @keys[6], @keys[8], 1]
-    send_command   Commands::HASH, ["footbl", @keys[6], @keys[8], 1, 1, hash_of(@rows[7..7])]
-    expect_command Commands::ROWS,
+    expect_hash_multi_command "footbl",
+                   [[], @keys[6], 1] => [1, hash_of(@rows[0..0])],
+                   [@keys[6], @keys[8], 1] => [1, hash_of(@rows[7..7])]
+    expect_command Commands::ROW_HASHES,
                    ["footbl", [], @keys[0]]
-    send_results   Commands::ROWS,
+    send_results   Commands::ROW_HASHES,
                    ["footbl", [], @keys[0]],
-                   @rows[0]
-    expect_command Commands::HASH, ["footbl", @keys[0], @keys[4], 1]
-    send_command   Commands::HASH, ["footbl", @keys[0], @keys[4], 1, 1, hash_of(@rows[1..1])]
-    expect_command Commands::HASH, ["footbl", @keys[4], @keys[6], 1]
-    send_command   Commands::HASH, ["footbl", @keys[4], @keys[6], 1, 1, hash_of(@rows[5..5])]
-    expect_command Commands::HASH, ["footbl", @keys[1], @keys[4], 2]
-    send_command   Commands::HASH, ["footbl", @keys[1], @keys[4], 2, 2, hash_of(@rows[2..3])]
-    expect_command Commands::HASH, ["footbl", @keys[5], @keys[6], 2]
-    send_command   Commands::HASH, ["footbl", @keys[5], @keys[6], 2, 1, hash_of(@rows[6..6])]
-    expect_command Commands::HASH, ["footbl", @keys[3], @keys[4], 4]
-    send_command   Commands::HASH, ["footbl", @keys[3], @keys[4], 4, 1, hash_of(@rows[4..4])]
-    expect_command Commands::HASH, ["footbl", @keys[7], @keys[8], 2]
-    send_command   Commands::HASH, ["footbl", @keys[7], @keys[8], 2, 1, hash_of(@rows[8..8])]
-    expect_command Commands::ROWS,
+                   [@keys[0], fingerprint_of(@rows[0])]
+    expect_hash_multi_command "footbl",
+                   [@keys[0], @keys[4], 1] => [1, hash_of(@rows[1..1])],
+                   [@keys[4], @keys[6], 1] => [1, hash_of(@rows[5..5])],
+                   [@keys[7], @keys[8], 2] => [1, hash_of(@rows[8..8])]
+
+    # applying this row will clear the unique value from the last row, which we've already found doesn't match
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @keys[0]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[0..0]
+    expect_command Commands::ROW_HASHES,
                    ["footbl", @keys[7], @keys[8]]
-    send_results   Commands::ROWS,
+    send_results   Commands::ROW_HASHES,
                    ["footbl", @keys[7], @keys[8]],
-                   @rows[8]
+                   [@keys[8], fingerprint_of(@rows[8])]
+    expect_hash_multi_command "footbl",
+                   [@keys[1], @keys[4], 2] => [2, hash_of(@rows[2..3])],
+                   [@keys[5], @keys[6], 2] => [1, hash_of(@rows[6..6])]
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @keys[8]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[8..8]
+    expect_command Commands::HASH, ["footbl", @keys[3], @keys[4], 4]
+    send_command   Commands::HASH, ["footbl", @keys[3], @keys[4], 4, 1, hash_of(@rows[4..4])]
     expect_quit_and_close
 
     assert_equal @rows,
@@ -397,9 +510,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["texttbl"]
     send_command   Commands::RANGE, ["texttbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["texttbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["texttbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -420,9 +533,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["secondtbl"]
     send_command   Commands::RANGE, ["secondtbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["secondtbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["secondtbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -441,9 +554,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["autotbl"]
     send_command   Commands::RANGE, ["autotbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["autotbl", [], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["autotbl", [], @keys[-1]],
-                   *@rows
+                   @rows
     expect_quit_and_close
 
     assert_equal @rows,
@@ -464,9 +577,9 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_command Commands::RANGE, ["generatedtbl"]
     send_command   Commands::RANGE, ["generatedtbl", @keys[0], @keys[-1]]
     expect_command Commands::ROWS, ["generatedtbl", @keys[0], @keys[-1]]
-    send_results   Commands::ROWS,
+    send_rows      Commands::ROWS,
                    ["generatedtbl", @keys[0], @keys[-1]],
-                   @rows[1]
+                   @rows[1..1]
     expect_command Commands::HASH, ["generatedtbl",       [], @keys[0], 1]
     send_command   Commands::HASH, ["generatedtbl",       [], @keys[0], 1, 1, hash_of(@rows[0..0])]
     expect_quit_and_close
@@ -474,4 +587,147 @@ class SyncToTest < KitchenSync::EndpointTestCase
     assert_equal connection.supports_virtual_generated_columns? ? [[1, 10, 22, 30, 100], [2, 20, 42, 60, 200]] : [[1, 10, 22, 100], [2, 20, 42, 200]],
       query("SELECT * FROM generatedtbl ORDER BY pri")
   end
+
+  test_each "accepts rows sent in columnar batches using any of the column encodings" do
+    clear_schema
+    create_footbl
+
+    @rows = [[2,   10, "test"],
+             [4,  nil,  "foo"],
+             [5,  nil, "test"],
+             [8,   -1,    nil],
+             [301,  0,  "foo"]]
+    @keys = @rows.collect {|row| [row[0]]}
+
+    expect_handshake_commands(schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", @keys[0], @keys[-1]]
+    expect_command Commands::ROWS, ["footbl", [], @keys[-1]]
+    send_results   Commands::ROWS,
+                   ["footbl", [], @keys[-1]],
+                   [3, [ColumnEncoding::DELTA, "", 2, 2, 1],
+                       [ColumnEncoding::DELTA, [0b110].pack("C"), 10],
+                       [ColumnEncoding::DICTIONARY, ["test", "foo"], 0, 1, 0]],
+                   [2, [ColumnEncoding::PLAIN, 8, 301],
+                       [ColumnEncoding::PLAIN, -1, 0],
+                       [ColumnEncoding::DICTIONARY, [nil, "foo"], 0, 1]]
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "checks ranges using hash trees if asked to, and retrieves the rows whose row hashes don't match in mismatched leaves" do
+    program_env["ENDPOINT_HASH_TREE"] = "1"
+    program_env["ENDPOINT_TARGET_MAXIMUM_BLOCK_SIZE"] = "1000"
+    setup_with_footbl
+    execute "DELETE FROM footbl WHERE col1 IN (4, 5)"
+    execute "INSERT INTO footbl VALUES (3, NULL, 'extra')"
+
+    expect_handshake_commands(schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
+
+    # each of the initial ranges is sent as a separate HASH_TREE command, with leaves up to the maximum block size,
+    # but we're free to send smaller leaves back
+    expect_command Commands::HASH_TREE, ["footbl", [], @keys[6], 1000]
+    send_results   Commands::HASH_TREE,
+                   ["footbl", [], @keys[6], 1000],
+                   [@keys[0], 1, hash_of(@rows[0..0])],
+                   [@keys[2], 2, hash_of(@rows[1..2])],
+                   [@keys[6], 4, hash_of(@rows[3..6])]
+    expect_command Commands::HASH_TREE, ["footbl", @keys[6], @keys[8], 1000]
+    send_results   Commands::HASH_TREE,
+                   ["footbl", @keys[6], @keys[8], 1000],
+                   [@keys[8], 2, hash_of(@rows[7..8])]
+
+    # the mismatched leaf is too small to be worth descending into, so we find out which of its rows have changed,
+    # and retrieve those; keys that we don't send back are deleted
+    expect_command Commands::ROW_HASHES,
+                   ["footbl", @keys[0], @keys[2]]
+    send_results   Commands::ROW_HASHES,
+                   ["footbl", @keys[0], @keys[2]],
+                   [@keys[1], fingerprint_of(@rows[1])],
+                   [@keys[2], fingerprint_of(@rows[2])]
+    expect_command Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   [3],
+                   @keys[1],
+                   @keys[2]
+    send_rows      Commands::ROWS_BY_KEYS,
+                   ["footbl"],
+                   @rows[1..2]
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "hashes ranges using aggregate queries in the database if asked to and the other end agrees" do
+    program_env["ENDPOINT_HASH_IN_DATABASE"] = "1"
+    setup_with_footbl
+    first_ranges  = [[[], @keys[6], 1], [@keys[6], @keys[8], 1]]
+    second_ranges = [[@keys[0], @keys[4], 2], [@keys[4], @keys[6], 2], [@keys[7], @keys[8], 2]]
+    last_range    =  [@keys[2], @keys[4], 4]
+    results = hashes_in_database_at_from_end("footbl", first_ranges + second_ranges + [last_range])
+
+    # the ranges checked are the same as when hashing the rows in the endpoints, but the hashes are those from the database
+    expect_handshake_commands(hash_in_database: true, schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
+    expect_hash_multi_command "footbl", results.select {|range, _| first_ranges.include?(range)}
+    expect_hash_multi_command "footbl", results.select {|range, _| second_ranges.include?(range)}
+    expect_command Commands::HASH, ["footbl", *last_range]
+    send_command   Commands::HASH, ["footbl", *last_range, *results[last_range]]
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "hashes rows in the endpoint if asked to hash in the database but the other end declines" do
+    program_env["ENDPOINT_HASH_IN_DATABASE"] = "1"
+    setup_with_footbl
+
+    expect_handshake_commands(hash_in_database: false, schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", @keys[0], @keys[8]]
+    expect_hash_multi_command "footbl",
+                   [[], @keys[6], 1] => [1, hash_of(@rows[0..0])],
+                   [@keys[6], @keys[8], 1] => [1, hash_of(@rows[7..7])]
+    expect_hash_multi_command "footbl",
+                   [@keys[0], @keys[4], 2] => [2, hash_of(@rows[1..2])],
+                   [@keys[4], @keys[6], 2] => [2, hash_of(@rows[5..6])],
+                   [@keys[7], @keys[8], 2] => [1, hash_of(@rows[8..8])]
+    expect_command Commands::HASH, ["footbl", @keys[2], @keys[4], 4]
+    send_command   Commands::HASH, ["footbl", @keys[2], @keys[4], 4, 2, hash_of(@rows[3..4])]
+    expect_quit_and_close
+  end
+
+  test_each "carries on uncompressed if the other end declines the compression algorithm asked for" do
+    program_env["ENDPOINT_COMPRESSION_ALGORITHM"] = CompressionAlgorithm::ZSTD.to_s
+    program_env["ENDPOINT_COMPRESSION_LEVEL"] = "5"
+    setup_with_footbl
+
+    expect_handshake_commands(compression_requested: [CompressionAlgorithm::ZSTD, 5], schema: {"tables" => [footbl_def]})
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", [], []]
+    expect_quit_and_close
+
+    assert_equal [],
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "starts the tables that are largest at the 'from' end first" do
+    clear_schema
+    create_footbl
+    create_secondtbl
+
+    expect_handshake_commands(schema: {"tables" => [footbl_def, secondtbl_def]}, table_sizes: {"footbl" => 1000000, "secondtbl" => 1000000000})
+    expect_command Commands::RANGE, ["secondtbl"]
+    send_command   Commands::RANGE, ["secondtbl", [], []]
+    expect_command Commands::RANGE, ["footbl"]
+    send_command   Commands::RANGE, ["footbl", [], []]
+    expect_quit_and_close
+  end
 end
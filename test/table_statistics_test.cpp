@@ -0,0 +1,108 @@
+#include "../../catch2/catch.hpp"
+
+#include <cstdlib>
+#include <unistd.h>
+#include "../src/table_statistics.h"
+
+TEST_CASE("table statistics", "[table_statistics]") {
+	TableStatistics statistics;
+
+	SECTION("start from one row and the maximum leaf size when there are no statistics") {
+		REQUIRE(statistics.initial_rows_to_hash(64*1024*1024) == 1);
+		REQUIRE(statistics.initial_bytes_per_leaf(16*1024, 64*1024*1024, 16) == 64*1024*1024);
+		REQUIRE(statistics.hash_tree_fanout(16, 64*1024*1024) == 16);
+	}
+
+	SECTION("start from the block size reached last time") {
+		statistics.rows = 10000000;
+		statistics.average_row_size = 100;
+		statistics.rows_per_block = 500000;
+		REQUIRE(statistics.initial_rows_to_hash(64*1024*1024) == 500000);
+
+		// but not more than the maximum block size now allows
+		REQUIRE(statistics.initial_rows_to_hash(10*1000*1000) == 100000);
+
+		// or more than the rows we'd expect to find a change in
+		statistics.mismatch_density = 0.0001;
+		REQUIRE(statistics.initial_rows_to_hash(64*1024*1024) == 10000);
+	}
+
+	SECTION("start hash trees with smaller leaves when changes were dense") {
+		statistics.rows = 10000000;
+		statistics.average_row_size = 100;
+		statistics.mismatch_density = 0.00001;
+		REQUIRE(statistics.initial_bytes_per_leaf(16*1024, 64*1024*1024, 16) == 10000000);
+		REQUIRE(statistics.hash_tree_fanout(16, 64*1024*1024) == 16);
+
+		// but always leave room for at least one level below the first
+		statistics.mismatch_density = 0.5;
+		REQUIRE(statistics.initial_bytes_per_leaf(16*1024, 64*1024*1024, 16) == 16*16*1024);
+	}
+
+	SECTION("use a wider fan-out when changes were isolated") {
+		statistics.rows = 10000000;
+		statistics.average_row_size = 100;
+		statistics.mismatch_density = 0.0000001;
+		REQUIRE(statistics.initial_bytes_per_leaf(16*1024, 64*1024*1024, 64) == 64*1024*1024);
+		REQUIRE(statistics.hash_tree_fanout(16, 64*1024*1024) == 64);
+	}
+
+	SECTION("can be saved and loaded again") {
+		char path[] = "/tmp/ks_table_statistics_test.XXXXXX";
+		int fd = mkstemp(path);
+		REQUIRE(fd >= 0);
+		close(fd);
+
+		StatisticsByTable saved;
+		saved["footbl"].rows = 1000;
+		saved["footbl"].mismatch_density = 0.25;
+		saved["footbl"].average_row_size = 42;
+		saved["footbl"].rows_per_block = 128;
+		saved["footbl"].seconds = 1.5;
+		saved["secondtbl"].rows = 1;
+		save_statistics(path, saved);
+
+		StatisticsByTable loaded(load_statistics(path));
+		unlink(path);
+		REQUIRE(loaded.size() == 2);
+		REQUIRE(loaded["footbl"].rows == 1000);
+		REQUIRE(loaded["footbl"].mismatch_density == 0.25);
+		REQUIRE(loaded["footbl"].average_row_size == 42);
+		REQUIRE(loaded["footbl"].rows_per_block == 128);
+		REQUIRE(loaded["footbl"].seconds == 1.5);
+		REQUIRE(loaded["secondtbl"].rows == 1);
+
+		// a missing file just means there's no statistics yet
+		REQUIRE(load_statistics(path).empty());
+	}
+}
+
+TEST_CASE("table work estimates", "[table_statistics]") {
+	StatisticsByTable previous_statistics;
+	TableSizes from_sizes, to_sizes;
+	from_sizes["bigtbl"] = 1000000;
+	from_sizes["smalltbl"] = 1000;
+	to_sizes["smalltbl"] = 5000;
+	to_sizes["newtbl"] = 20000;
+
+	SECTION("go by the larger of the two ends' sizes when there's no history") {
+		TableWorkEstimator estimator(previous_statistics, from_sizes, to_sizes);
+		REQUIRE(estimator("bigtbl") == 1000000);
+		REQUIRE(estimator("smalltbl") == 5000);
+		REQUIRE(estimator("newtbl") == 20000);
+		REQUIRE(estimator("unknowntbl") == 0);
+	}
+
+	SECTION("go by the time taken last run when there's history") {
+		// the small table was slow last time, say because it had many changes
+		previous_statistics["bigtbl"].seconds = 10;
+		previous_statistics["smalltbl"].seconds = 20;
+		TableWorkEstimator estimator(previous_statistics, from_sizes, to_sizes);
+		REQUIRE(estimator("smalltbl") > estimator("bigtbl"));
+
+		// tables without history are estimated at the overall rate we saw for the rest
+		REQUIRE(estimator.seconds_per_byte == Approx(30.0/1005000));
+		REQUIRE(estimator("newtbl") == 20000);
+		REQUIRE(estimator("bigtbl") == Approx(10/estimator.seconds_per_byte));
+	}
+}
@@ -0,0 +1,63 @@
+#include "../../catch2/catch.hpp"
+
+#include <thread>
+#include "../src/command.h"
+#include "../src/versioned_stream.h"
+#include "../src/tcp_socket.h"
+
+using namespace std;
+
+TEST_CASE("loopback TCP connection", "[tcp_socket]") {
+	int listener = TCPSocket::listen("127.0.0.1:0");
+	string address("127.0.0.1:" + to_string(TCPSocket::local_port(listener)));
+
+	// connect and accept, then talk over the socket the same way as the endpoints do, using the same descriptor for both directions
+	int client_fd = TCPSocket::connect(address);
+	int server_fd = TCPSocket::accept(listener);
+	close(listener);
+
+	thread server([server_fd]() {
+		VersionedFDReadStream input_stream(server_fd);
+		VersionedFDWriteStream output_stream(dup(server_fd));
+		Unpacker<VersionedFDReadStream> input(input_stream);
+		Packer<VersionedFDWriteStream> output(output_stream);
+
+		int protocol_version;
+		read_expected_command(input, Commands::PROTOCOL, protocol_version);
+		send_command(output, Commands::PROTOCOL, protocol_version);
+		send_command_begin(output, Commands::ROWS, string("test"));
+		for (int row = 0; row < 100000; row++) send_array(output, row);
+		send_command_end(output);
+	});
+
+	{
+		VersionedFDReadStream input_stream(client_fd);
+		VersionedFDWriteStream output_stream(dup(client_fd));
+		Unpacker<VersionedFDReadStream> input(input_stream);
+		Packer<VersionedFDWriteStream> output(output_stream);
+
+		send_command(output, Commands::PROTOCOL, 8);
+		int protocol_version;
+		read_expected_command(input, Commands::PROTOCOL, protocol_version);
+		CHECK(protocol_version == 8);
+
+		string table_name;
+		CHECK(input.next<verb_t>() == Commands::ROWS);
+		read_array(input, table_name);
+		CHECK(table_name == "test");
+		for (int row = 0; row < 100000; row++) {
+			int value;
+			read_array(input, value);
+			REQUIRE(value == row);
+		}
+		CHECK(input.next_array_length() == 0);
+
+		server.join();
+		CHECK_THROWS_AS(input.next<int>(), stream_closed_error);
+	}
+}
+
+TEST_CASE("bad TCP addresses", "[tcp_socket]") {
+	CHECK_THROWS_AS(TCPSocket::connect("127.0.0.1"), runtime_error);
+	CHECK_THROWS_AS(TCPSocket::listen("127.0.0.1:"), runtime_error);
+}
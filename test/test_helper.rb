@@ -7,6 +7,7 @@ require 'time'
 require 'msgpack'
 require 'openssl'
 require 'ruby-xxhash'
+require 'digest/xxhash'
 
 ENDPOINT_ADAPTERS = {}
 require File.expand_path(File.join(File.dirname(__FILE__), 'test_helper_postgresql')) if ENV['ENDPOINT_DATABASES'].nil? || ENV['ENDPOINT_DATABASES'].include?('postgresql')
@@ -101,12 +102,33 @@ module Commands
   HASH_ALGORITHM = 39
   FILTERS = 40
   TYPES = 41
+  COMPRESSION = 42
+  HASH_MULTI = 43
+  HASH_TREE = 44
+  ROW_HASHES = 45
+  ROWS_BY_KEYS = 46
+  HASH_IN_DATABASE = 47
+  TABLE_SIZES = 48
   QUIT = 0
 end
 
 module HashAlgorithm
   MD5 = 0
   XXH64 = 1
+  XXH128 = 2
+  BLAKE2B = 3
+  XXH128SUM = 4
+end
+
+module CompressionAlgorithm
+  NONE = 0
+  ZSTD = 1
+end
+
+module ColumnEncoding
+  PLAIN = 0
+  DELTA = 1
+  DICTIONARY = 2
 end
 
 module PrimaryKeyType
@@ -118,8 +140,13 @@ end
 module KitchenSync
   class TestCase < Test::Unit::TestCase
     EARLIEST_PROTOCOL_VERSION_SUPPORTED = 7
-    CURRENT_PROTOCOL_VERSION_USED = 8
-    LATEST_PROTOCOL_VERSION_SUPPORTED = 8
+    CURRENT_PROTOCOL_VERSION_USED = 15
+    LATEST_PROTOCOL_VERSION_SUPPORTED = 15
+    LAST_SINGLE_RANGE_HASH_PROTOCOL_VERSION = 9
+    LAST_ROW_ORIENTED_PROTOCOL_VERSION = 11
+    LAST_NO_ROW_HASHES_PROTOCOL_VERSION = 12
+    LAST_NO_HASH_IN_DATABASE_PROTOCOL_VERSION = 13
+    LAST_NO_TABLE_SIZES_PROTOCOL_VERSION = 14
 
     undef_method :default_test if instance_methods.include? 'default_test' or
                                   instance_methods.include? :default_test
@@ -159,7 +186,9 @@ module KitchenSync
       spawner.send_results(*args)
     end
 
-    def send_handshake_commands(protocol_version: LATEST_PROTOCOL_VERSION_SUPPORTED, target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::MD5, filters: nil, accepted_types: connection.supported_column_types)
+    # most of the 'from' tests are written in terms of rows sent one array per row, so by default we negotiate
+    # the last protocol version that doesn't send them in columnar batches; tests for the latter override this.
+    def send_handshake_commands(protocol_version: LAST_ROW_ORIENTED_PROTOCOL_VERSION, target_minimum_block_size: 1, hash_algorithm: HashAlgorithm::MD5, filters: nil, accepted_types: connection.supported_column_types)
       send_protocol_command(protocol_version)
       send_hash_algorithm_command(hash_algorithm)
       send_filters_command(filters) if filters
@@ -192,7 +221,7 @@ module KitchenSync
       expect_command Commands::TYPES
     end
 
-    def expect_handshake_commands(protocol_version_expected: CURRENT_PROTOCOL_VERSION_USED, protocol_version_supported: LATEST_PROTOCOL_VERSION_SUPPORTED, hash_algorithm: HashAlgorithm::MD5, filters: nil, schema:)
+    def expect_handshake_commands(protocol_version_expected: CURRENT_PROTOCOL_VERSION_USED, protocol_version_supported: LATEST_PROTOCOL_VERSION_SUPPORTED, hash_algorithm: HashAlgorithm::MD5, compression_requested: nil, hash_in_database: nil, filters: nil, schema:, table_sizes: {})
       # checking how protocol versions are handled is covered in protocol_versions_test; here we just need to get past that to get on to the commands we want to test
       expect_command Commands::PROTOCOL, [protocol_version_expected]
       @protocol_version = [protocol_version_expected, protocol_version_supported].min
@@ -201,6 +230,16 @@ module KitchenSync
       assert_equal   Commands::HASH_ALGORITHM, read_command.first
       send_command   Commands::HASH_ALGORITHM, [hash_algorithm]
 
+      if compression_requested
+        expect_command Commands::COMPRESSION, compression_requested
+        send_command   Commands::COMPRESSION, [CompressionAlgorithm::NONE] # we can't decompress their stream here, so always decline
+      end
+
+      unless hash_in_database.nil?
+        expect_command Commands::HASH_IN_DATABASE, [@database_server]
+        send_command   Commands::HASH_IN_DATABASE, [hash_in_database]
+      end
+
       if filters
         expect_command Commands::FILTERS, [filters]
         send_command   Commands::FILTERS
@@ -217,6 +256,33 @@ module KitchenSync
 
       expect_command Commands::SCHEMA
       send_command   Commands::SCHEMA, [schema]
+
+      # not asked for if the schema is unusable, so tests expecting that pass nil
+      if @protocol_version > LAST_NO_TABLE_SIZES_PROTOCOL_VERSION && table_sizes
+        expect_command Commands::TABLE_SIZES
+        send_command   Commands::TABLE_SIZES, [table_sizes]
+      end
+    end
+
+    # sends rows the way the negotiated protocol version sends them - one array per row in older versions, otherwise
+    # in columnar batches, which we always send using the plain encoding since the other encodings are optional
+    def send_rows(verb, args, rows)
+      if verb == Commands::ROWS_BY_KEYS || @protocol_version > LAST_ROW_ORIENTED_PROTOCOL_VERSION
+        send_results verb, args, *rows.each_slice(1024).collect {|batch| [batch.size, *batch.transpose.collect {|values| [ColumnEncoding::PLAIN, *values]}]}
+      else
+        send_results verb, args, *rows
+      end
+    end
+
+    # the ranges in a HASH_MULTI command come off the 'to' end's queue in an order that's an implementation detail,
+    # so this takes a hash of the expected ranges to their [row_count, hash] results and answers in the order asked
+    def expect_hash_multi_command(table_name, results)
+      command = read_command
+      verb, table_args, *ranges = command
+      raise "expected HASH_MULTI command for #{table_name} ranges: #{PP.pp(results.keys, "", 200).strip}\nbut received: #{PP.pp(command, "", 200).strip}" unless verb == Commands::HASH_MULTI && table_args == [table_name] && ranges.sort_by(&:inspect) == results.keys.sort_by(&:inspect) # use this instead of assert_equal so we get the backtrace
+      send_results   Commands::HASH_MULTI, [table_name], *ranges.collect {|range| range + results[range]}
+    rescue EOFError
+      fail "expected HASH_MULTI command for #{table_name} but the connection was closed; stderr: #{spawner.stderr_contents}"
     end
 
     def expect_quit_and_close
@@ -252,6 +318,9 @@ module KitchenSync
 
         # we force the block size down to 1 so we can test out our algorithms row-by-row, but real runs would use a bigger size
         "ENDPOINT_TARGET_MINIMUM_BLOCK_SIZE" => "1",
+
+        # similarly, the tests are written expecting a fixed number of commands to be pipelined
+        "ENDPOINT_MAXIMUM_COMMANDS_TO_PIPELINE" => "2",
       }
     end
 
@@ -272,6 +341,33 @@ module KitchenSync
       connection.tables.each {|table_name| execute "DROP TABLE #{connection.quote_ident table_name}"}
     end
 
+    def unpack_columnar_rows(batches)
+      batches.flat_map do |row_count, *columns|
+        columns.collect {|column| unpack_columnar_column(row_count, column)}.transpose
+      end
+    end
+
+    def unpack_columnar_column(row_count, column)
+      encoding, *values = column
+      case encoding
+      when ColumnEncoding::PLAIN
+        values
+
+      when ColumnEncoding::DELTA
+        nulls, *deltas = values
+        value = nil
+        (0...row_count).collect do |row|
+          next nil if !nulls.empty? && nulls.getbyte(row/8)[row % 8] == 1
+          delta = deltas.shift
+          value = value ? value + delta : delta
+        end
+
+      when ColumnEncoding::DICTIONARY
+        dictionary, *indices = values
+        indices.collect {|index| dictionary[index]}
+      end
+    end
+
     def hash_of(rows, hash_algorithm = HashAlgorithm::MD5)
       data = rows.collect {|row| MessagePack.pack(row, compatibility_mode: true)}.join
 
@@ -282,9 +378,24 @@ module KitchenSync
       when HashAlgorithm::XXH64
         result = XXhash.xxh64(data)
         [result >> 32, result & 0xFFFFFFFF].pack("NN")
+
+      when HashAlgorithm::XXH128
+        result = Digest::XXH3_128bits.idigest(data)
+        [result >> 64, result & 0xFFFFFFFFFFFFFFFF].pack("Q>Q>")
+
+      when HashAlgorithm::BLAKE2B
+        OpenSSL::Digest.new('BLAKE2b512').digest(data)
+
+      when HashAlgorithm::XXH128SUM
+        result = rows.inject(0) {|sum, row| sum + Digest::XXH3_128bits.idigest(MessagePack.pack(row, compatibility_mode: true))} % (1 << 128)
+        [result >> 64, result & 0xFFFFFFFFFFFFFFFF].pack("Q>Q>")
       end
     end
 
+    def fingerprint_of(row)
+      XXhash.xxh64(MessagePack.pack(row, compatibility_mode: true))
+    end
+
     def hash_and_count_of(rows)
       [hash_of(rows), rows.size]
     end
@@ -0,0 +1,68 @@
+#include "../../catch2/catch.hpp"
+
+#include <thread>
+#include "../src/command.h"
+#include "../src/versioned_stream.h"
+
+using namespace std;
+
+void write_test_stream(int fd, CompressionAlgorithm compression_algorithm, size_t rows) {
+	VersionedFDWriteStream output_stream(fd);
+	Packer<VersionedFDWriteStream> output(output_stream);
+
+	send_command(output, Commands::COMPRESSION, static_cast<int>(compression_algorithm));
+	output_stream.start_compression(compression_algorithm, 1);
+
+	for (size_t row = 0; row < rows; row++) {
+		send_array(output, (int64_t)row, string("some text that should compress well ") + to_string(row % 10));
+		if (row % 1000 == 999) output.flush();
+	}
+	send_command_end(output);
+}
+
+void check_test_stream(CompressionAlgorithm compression_algorithm) {
+	const size_t rows = 100000; // more than will fit in the buffers so we know it's streaming
+	int fds[2];
+	REQUIRE(pipe(fds) == 0);
+
+	thread writer(write_test_stream, fds[1], compression_algorithm, rows);
+
+	{
+		VersionedFDReadStream input_stream(fds[0]);
+		Unpacker<VersionedFDReadStream> input(input_stream);
+
+		CompressionAlgorithm received_compression_algorithm;
+		read_expected_command(input, Commands::COMPRESSION, received_compression_algorithm);
+		CHECK(received_compression_algorithm == compression_algorithm);
+		input_stream.start_decompression(received_compression_algorithm);
+
+		for (size_t row = 0; row < rows; row++) {
+			int64_t number;
+			string text;
+			read_array(input, number, text);
+			REQUIRE(number == row);
+			REQUIRE(text == string("some text that should compress well ") + to_string(row % 10));
+		}
+		CHECK(input.next_array_length() == 0);
+
+		// wait for the other end to finish writing and close the stream, so we don't give it SIGPIPE
+		writer.join();
+		CHECK_THROWS_AS(input.next<int>(), stream_closed_error);
+	}
+}
+
+TEST_CASE("uncompressed stream", "[versioned_stream]") {
+	check_test_stream(CompressionAlgorithm::none);
+}
+
+#ifdef HAVE_ZSTD
+TEST_CASE("zstd-compressed stream", "[versioned_stream]") {
+	check_test_stream(CompressionAlgorithm::zstd);
+}
+#endif
+
+TEST_CASE("unsupported compression algorithm", "[versioned_stream]") {
+	CHECK(compression_algorithm_supported(CompressionAlgorithm::none));
+	CHECK_FALSE(compression_algorithm_supported(static_cast<CompressionAlgorithm>(99)));
+	CHECK_THROWS_AS(create_stream_compressor(static_cast<CompressionAlgorithm>(99), 1), compression_error);
+}